@@ -0,0 +1,95 @@
+#ifndef RESEARCH_BROWN_MICHAEL_SCOTT_QUEUE_H
+#define RESEARCH_BROWN_MICHAEL_SCOTT_QUEUE_H
+
+#include <atomic>
+#include <stdexcept>
+#include "../SingleRoad/brown/record_manager.h"
+#include "../SingleRoad/brown/allocator_new.h"
+#include "../SingleRoad/brown/pool_perthread_and_shared.h"
+
+//The queue of MichaelScottQueue.h with its nodes managed by the brown record
+//manager, so the reclaimer is a template parameter. Reclaim is one of the epoch
+//based ones (reclaimer_debra<>, reclaimer_ebr_token<>, reclaimer_ebr_tree<>):
+//every operation runs inside a MemoryReclamationGuard and reads nodes unprotected,
+//retired nodes go back to the per-thread pools of pool_perthread_and_shared once
+//every thread left the epoch they were retired in. The hazard pointer reclaimers
+//of brown want a protect() per pointer and are not wired up here, the hazard
+//pointer queue is MichaelScottQueue.
+//
+//Threads call initThread(tid) once before their first operation. The reclaimer
+//headers are left to the user, see MSQReclaimBench.cpp.
+template<typename T, class Reclaim>
+class BrownMichaelScottQueue {
+private:
+    struct Node {
+        T *item;
+        std::atomic<Node *> next;
+    };
+
+    typedef record_manager<Reclaim, allocator_new<>, pool_perthread_and_shared<>, Node> RecordManager;
+
+    alignas(128) std::atomic<Node *> head;
+    alignas(128) std::atomic<Node *> tail;
+
+    RecordManager *mgr;
+
+    Node *new_node(T *item, const int tid) {
+        Node *node = mgr->template allocate<Node>(tid);
+        node->item = item;
+        node->next.store(nullptr, std::memory_order_relaxed);
+        return node;
+    }
+
+public:
+    BrownMichaelScottQueue(int maxThreads) : mgr(new RecordManager(maxThreads)) {
+        mgr->initThread(0);
+        Node *sentinelNode = new_node(nullptr, 0);
+        head.store(sentinelNode, std::memory_order_relaxed);
+        tail.store(sentinelNode, std::memory_order_relaxed);
+    }
+
+    ~BrownMichaelScottQueue() {
+        while (dequeue(0) != nullptr);
+        mgr->deallocate(0, head.load());
+        delete mgr;
+    }
+
+    void initThread(const int tid) { mgr->initThread(tid); }
+
+    void enqueue(T *item, const int tid) {
+        if (item == nullptr) throw std::invalid_argument("item can not be nullptr");
+        Node *newNode = new_node(item, tid);
+        typename RecordManager::MemoryReclamationGuard guard(tid, mgr);
+        while (true) {
+            Node *ltail = tail.load();
+            Node *lnext = ltail->next.load();
+            if (ltail != tail.load()) continue;
+            if (lnext == nullptr) {
+                if (ltail->next.compare_exchange_strong(lnext, newNode)) {
+                    tail.compare_exchange_strong(ltail, newNode);
+                    break;
+                }
+            } else {
+                tail.compare_exchange_strong(ltail, lnext);
+            }
+        }
+    }
+
+    T *dequeue(const int tid) {
+        T *item = nullptr;
+        typename RecordManager::MemoryReclamationGuard guard(tid, mgr);
+        while (true) {
+            Node *node = head.load();
+            if (node == tail.load()) break;
+            Node *lnext = node->next.load();
+            if (head.compare_exchange_strong(node, lnext)) {
+                item = lnext->item;
+                mgr->retire(tid, node);
+                break;
+            }
+        }
+        return item;
+    }
+};
+
+#endif //RESEARCH_BROWN_MICHAEL_SCOTT_QUEUE_H
@@ -0,0 +1,259 @@
+#ifndef RESEARCH_FILE_MICHAEL_SCOTT_QUEUE_H
+#define RESEARCH_FILE_MICHAEL_SCOTT_QUEUE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <vector>
+#include "pfences.h"
+#include "file_region.h"
+#include "HazardPointers.h"
+
+/**
+ * <h1> Durable Michael-Scott Queue on a mapped file </h1>
+ *
+ * enqueue algorithm: MS enqueue + the PWB/PFENCE/PSYNC of PMichaelScottQueue
+ * dequeue algorithm: MS dequeue + the PWB/PFENCE/PSYNC of PMichaelScottQueue
+ * Consistency: Durable Linearizable
+ * enqueue() progress: lock-free
+ * dequeue() progress: lock-free
+ * Memory Reclamation: Hazard Pointers, nodes recycled through per-thread pools
+ *
+ * PMichaelScottQueue with its nodes, head and tail in a FileRegion, linked by
+ * file_ptr offsets, so the queue is still there when the file is opened again
+ * after the process died. Items are stored by value (T trivially copyable, a
+ * pointer into the dead process would be worth nothing).
+ *
+ * Layout: a Root at offset 0, then an array of capacity nodes. Nodes are handed
+ * out by a persistent bump index and recycled in DRAM (per-thread pools and a
+ * shared spare list) once the hazard pointer scan lets them go. A crash loses the
+ * DRAM lists, and an allocated node that never got linked, so the constructor of
+ * an existing queue collects: every node below the bump that is not reachable
+ * from head is free. That is also how the leaks PMichaelScottQueue lists for
+ * allocation are closed. The same walk finds the last node and moves the tail
+ * there.
+ *
+ * A node of a T up to 56 bytes is one cache line, item and next go out with one
+ * PWB. Which PWB / PSYNC is used is picked by the PWB_IS_ define of pfences.h,
+ * e.g. PWB_IS_CLWB (cache line write back, sfence) or PWB_IS_NOP to measure
+ * without flushes.
+ *
+ * One open queue per T at a time (file_ptr has one base per type).
+ */
+template<typename T>
+class FileMichaelScottQueue {
+private:
+    static_assert(std::is_trivially_copyable<T>::value, "items are stored in the file by value");
+
+    static const int MAX_THREADS = 128;
+    static const uint64_t MAGIC = 0x46514d5351000001ull;
+    static const size_t NODE_POOL_MAX = 4096;
+    static const size_t SPARE_BATCH = 256;  // nodes a thread takes from the spare list at once
+
+    struct alignas(64) Node {
+        T item;
+        std::atomic<file_ptr<Node>> next;
+    };
+
+    struct Root {
+        uint64_t magic;
+        uint64_t capacity;
+        alignas(128) std::atomic<uint64_t> bump;  // nodes[bump..] were never handed out
+        alignas(128) std::atomic<file_ptr<Node>> head;
+        alignas(128) std::atomic<file_ptr<Node>> tail;
+    };
+
+    static const size_t NODES_OFFSET = (sizeof(Root) + 127) / 128 * 128;
+
+    FileRegion region;
+    Root *root;
+    Node *nodes;
+    const int maxThreads;
+
+    struct alignas(128) NodePool {
+        std::vector<Node *> nodes;
+    };
+    NodePool pools[MAX_THREADS];
+    std::mutex spareLock;
+    std::vector<Node *> spare;
+
+    std::function<void(Node *, int)> recycle = [this](Node *node, int tid) {
+        std::vector<Node *> &pool = pools[tid].nodes;
+        if (pool.size() < NODE_POOL_MAX) {
+            pool.push_back(node);
+            return;
+        }
+        std::lock_guard<std::mutex> guard(spareLock);
+        spare.push_back(node);
+    };
+
+    // We need two hazard pointers for dequeue()
+    HazardPointers<Node> hp{2, maxThreads, recycle};
+    static const int kHpTail = 0;
+    static const int kHpHead = 0;
+    static const int kHpNext = 1;
+
+    // only for links that are never null: head, tail, and next of a node that is not the tail
+    Node *protect(int index, const std::atomic<file_ptr<Node>> &atom, const int tid) {
+        Node *n = nullptr;
+        Node *ret;
+        while ((ret = atom.load().abs_nonnull()) != n) {
+            hp.protectPtr(index, ret, tid);
+            n = ret;
+        }
+        return ret;
+    }
+
+    Node *get_node(const int tid) {
+        std::vector<Node *> &pool = pools[tid].nodes;
+        if (pool.empty()) {
+            std::lock_guard<std::mutex> guard(spareLock);
+            size_t n = std::min(spare.size(), SPARE_BATCH);
+            pool.insert(pool.end(), spare.end() - n, spare.end());
+            spare.resize(spare.size() - n);
+        }
+        if (!pool.empty()) {
+            Node *node = pool.back();
+            pool.pop_back();
+            return node;
+        }
+        uint64_t i = root->bump.fetch_add(1);
+        if (i >= root->capacity) throw std::bad_alloc();
+        // ordered before the node gets linked by the CAS that links it
+        PWB(&root->bump);
+        return &nodes[i];
+    }
+
+    void format() {
+        root->capacity = (region.size() - NODES_OFFSET) / sizeof(Node);
+        root->bump.store(1, std::memory_order_relaxed);
+        nodes[0].next.store(file_ptr<Node>(), std::memory_order_relaxed);
+        root->head.store(&nodes[0], std::memory_order_relaxed);
+        root->tail.store(&nodes[0], std::memory_order_relaxed);
+        PWB(&nodes[0]);
+        PWB(&root->capacity);
+        PWB(&root->bump);
+        PWB(&root->head);
+        PWB(&root->tail);
+        PFENCE();
+        root->magic = MAGIC;
+        PWB(&root->magic);
+        PSYNC();
+    }
+
+    /*
+     * To be called when opening a queue that was not closed, or was closed fine:
+     * the walk from head is all the state there is.
+     */
+    void recover() {
+        uint64_t capacity = root->capacity;
+        uint64_t bump = std::min((uint64_t) root->bump.load(), capacity);
+        std::vector<bool> live(capacity);
+        Node *node = root->head.load().abs_nonnull();
+        while (true) {
+            uint64_t i = node - nodes;
+            live[i] = true;
+            bump = std::max(bump, i + 1);
+            Node *lnext = node->next.load().abs();
+            if (lnext == nullptr) break;
+            node = lnext;
+        }
+        if (root->tail.load().abs_nonnull() != node) {
+            root->tail.store(node, std::memory_order_relaxed);
+            PWB(&root->tail);
+        }
+        root->bump.store(bump, std::memory_order_relaxed);
+        PWB(&root->bump);
+        for (uint64_t i = 0; i < bump; i++)
+            if (!live[i]) spare.push_back(&nodes[i]);
+        PSYNC();
+    }
+
+public:
+    // capacity in nodes, for a new file
+    FileMichaelScottQueue(const char *path, size_t capacity = 1 << 20, int maxThreads = MAX_THREADS)
+            : region(path, NODES_OFFSET + capacity * sizeof(Node)), maxThreads{maxThreads} {
+        file_ptr<Node>::set_base(region.base());
+        root = (Root *) region.base();
+        nodes = (Node *) (region.base() + NODES_OFFSET);
+        if (root->magic != MAGIC) format();
+        else recover();
+    }
+
+    // the queue stays in the file, closing only makes it reach the disk
+    ~FileMichaelScottQueue() {
+        sync();
+    }
+
+    std::string className() { return "FileMichaelScottQueue"; }
+
+    // durable against a crash of the machine too, not only of the process
+    void sync() { region.sync(); }
+
+    size_t capacity() const { return root->capacity; }
+
+    /*
+     * Uncontended: at least 3 PWB()s and 2 CAS
+     */
+    void enqueue(const T &item, const int tid) {
+        Node *newNode = get_node(tid);
+        newNode->item = item;
+        newNode->next.store(file_ptr<Node>(), std::memory_order_relaxed);
+        flushFromTo(newNode, newNode + 1);
+        while (true) {
+            Node *ltail = protect(kHpTail, root->tail, tid);
+            if (ltail == root->tail.load().abs_nonnull()) {
+                Node *lnext = ltail->next.load().abs();
+                if (lnext == nullptr) {
+                    PWB(&root->tail);
+                    file_ptr<Node> cmp;
+                    if (ltail->next.compare_exchange_strong(cmp, newNode)) {
+                        PWB(&ltail->next);
+                        file_ptr<Node> ctail(ltail);
+                        root->tail.compare_exchange_strong(ctail, newNode);
+                        hp.clear(tid);
+                        return;
+                    }
+                } else {
+                    PWB(&ltail->next);
+                    file_ptr<Node> ctail(ltail);
+                    root->tail.compare_exchange_strong(ctail, lnext);
+                }
+            }
+        }
+    }
+
+    /*
+     * Uncontended: at least 3 PWB()s, 1 CAS, and 1 PSYNC()
+     */
+    bool dequeue(T &item, const int tid) {
+        Node *node = protect(kHpHead, root->head, tid);
+        while (node != root->tail.load().abs_nonnull()) {
+            Node *lnext = protect(kHpNext, node->next, tid);
+            PWB(&root->tail);
+            PWB(&root->head);
+            file_ptr<Node> chead(node);
+            if (root->head.compare_exchange_strong(chead, lnext)) {
+                PWB(&root->head);
+                PSYNC();
+                item = lnext->item;  // lnext is the sentinel now, kHpNext keeps it from being reused
+                hp.clear(tid);
+                hp.retire(node, tid);
+                return true;
+            }
+            node = protect(kHpHead, root->head, tid);
+        }
+        hp.clear(tid);
+        return false;                  // Queue is empty
+    }
+};
+
+// std::min takes it by reference, so it needs a definition
+template<typename T>
+const size_t FileMichaelScottQueue<T>::SPARE_BATCH;
+
+#endif //RESEARCH_FILE_MICHAEL_SCOTT_QUEUE_H
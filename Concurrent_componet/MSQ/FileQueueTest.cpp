@@ -0,0 +1,268 @@
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <signal.h>
+#include <sched.h>
+#include <sys/wait.h>
+#include "FileMichaelScottQueue.h"
+#include "MichaelScottQueue.h"
+#include "tracer.h"
+
+using namespace std;
+
+//FileMichaelScottQueue, two modes.
+//
+//crash: every round forks a child that opens the queue file and runs producers
+//and consumers on it until it gets SIGKILLed at a random point. A producer
+//enqueues round|producer|seq with seq counting up, a consumer dequeues. After
+//every returned call the child notes it in memory shared with the parent: the
+//last seq whose enqueue returned and the highest seq a dequeue returned, per
+//producer. The parent then opens the file (that is the recovery), drains it and
+//checks per producer: the seqs left are consecutive, none of them was returned by
+//a dequeue, every returned enqueue is there or was dequeued, and at most one
+//enqueue per producer / one dequeue per consumer was cut off in between.
+//
+//bench: enqueue + dequeue pairs on one queue, the DRAM MichaelScottQueue against
+//the file queue. FileQueueTest flushes with clwb, FileQueueTest_nop is the same
+//binary with PWB_IS_NOP: the difference per op is what durability costs.
+//sync_every > 0 has thread 0 msync the whole region every that many of its ops.
+//
+//./FileQueueTest crash <file> [rounds=20] [producers=2] [consumers=2]
+//./FileQueueTest bench <file> <thread_num> <test_time> [sync_every=0]
+
+static const int MAX_PRODUCERS = 16;
+static const uint64_t SEQ_BITS = 40;
+static const uint64_t PRODUCER_BITS = 8;
+static const int64_t MAX_BACKLOG = 1 << 16; // producers wait when they are that far ahead
+static const size_t CRASH_CAPACITY = 1 << 20;
+
+struct CrashLog {
+    std::atomic<int> running;
+    std::atomic<int64_t> enq_acked[MAX_PRODUCERS];
+    std::atomic<int64_t> deq_acked[MAX_PRODUCERS];
+};
+
+static uint64_t make_value(uint64_t round, uint64_t p, uint64_t seq) {
+    return (round << (SEQ_BITS + PRODUCER_BITS)) | (p << SEQ_BITS) | seq;
+}
+
+static void crash_child(const char *path, uint64_t round, int producers, int consumers, CrashLog *log) {
+    FileMichaelScottQueue<uint64_t> q(path, CRASH_CAPACITY, producers + consumers);
+    vector<thread> threads;
+    for (int p = 0; p < producers; p++) {
+        threads.push_back(thread([&, p]() {
+            for (uint64_t seq = 0;; seq++) {
+                while ((int64_t) seq - log->deq_acked[p].load() > MAX_BACKLOG) sched_yield();
+                q.enqueue(make_value(round, p, seq), p);
+                log->enq_acked[p].store(seq);
+            }
+        }));
+    }
+    for (int c = 0; c < consumers; c++) {
+        threads.push_back(thread([&, c]() {
+            uint64_t v;
+            while (true) {
+                if (!q.dequeue(v, producers + c)) continue;
+                uint64_t p = (v >> SEQ_BITS) & ((1 << PRODUCER_BITS) - 1);
+                int64_t seq = v & ((1ull << SEQ_BITS) - 1);
+                int64_t cur = log->deq_acked[p].load();
+                while (cur < seq && !log->deq_acked[p].compare_exchange_weak(cur, seq));
+            }
+        }));
+    }
+    log->running.store(1);
+    for (auto &t : threads) t.join();
+}
+
+//number of problems found
+static int crash_check(const char *path, uint64_t round, int producers, int consumers, CrashLog *log) {
+    FileMichaelScottQueue<uint64_t> q(path, CRASH_CAPACITY, 1);
+    vector<vector<int64_t>> left(producers);
+    int errors = 0;
+    uint64_t v;
+    size_t recovered = 0;
+    while (q.dequeue(v, 0)) {
+        recovered++;
+        uint64_t r = v >> (SEQ_BITS + PRODUCER_BITS);
+        uint64_t p = (v >> SEQ_BITS) & ((1 << PRODUCER_BITS) - 1);
+        if (r != round || p >= producers) {
+            cout << "  stray value " << v << endl;
+            errors++;
+            continue;
+        }
+        left[p].push_back(v & ((1ull << SEQ_BITS) - 1));
+    }
+    for (int p = 0; p < producers; p++) {
+        int64_t enq = log->enq_acked[p].load(), deq = log->deq_acked[p].load();
+        vector<int64_t> &s = left[p];
+        for (size_t i = 1; i < s.size(); i++)
+            if (s[i] != s[i - 1] + 1) {
+                cout << "  producer " << p << ": " << s[i] << " after " << s[i - 1] << endl;
+                errors++;
+            }
+        if (s.empty()) {
+            if (enq > deq + consumers) {
+                cout << "  producer " << p << ": empty, enqueued up to " << enq << ", dequeued up to " << deq << endl;
+                errors++;
+            }
+        } else if (s.front() <= deq || s.front() > deq + 1 + consumers || s.back() < enq || s.back() > enq + 1) {
+            cout << "  producer " << p << ": left " << s.front() << ".." << s.back() << ", enqueued up to " << enq
+                 << ", dequeued up to " << deq << endl;
+            errors++;
+        }
+    }
+    cout << "round " << round << " recovered " << recovered << " items";
+    for (int p = 0; p < producers; p++)
+        cout << " p" << p << " enq " << log->enq_acked[p].load() << " deq " << log->deq_acked[p].load();
+    cout << (errors ? " FAILED" : " ok") << endl;
+    return errors;
+}
+
+static int crash_test(const char *path, int rounds, int producers, int consumers) {
+    CrashLog *log = (CrashLog *) mmap(nullptr, sizeof(CrashLog), PROT_READ | PROT_WRITE,
+                                      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    srand(time(NULL));
+    int errors = 0;
+    for (int round = 1; round <= rounds; round++) {
+        log->running.store(0);
+        for (int p = 0; p < MAX_PRODUCERS; p++) {
+            log->enq_acked[p].store(-1);
+            log->deq_acked[p].store(-1);
+        }
+        pid_t pid = fork();
+        if (pid == 0) {
+            crash_child(path, round, producers, consumers, log);
+            _exit(0);
+        }
+        while (!log->running.load()) sched_yield();
+        usleep(1000 + rand() % 100000);
+        kill(pid, SIGKILL);
+        waitpid(pid, nullptr, 0);
+        errors += crash_check(path, round, producers, consumers, log);
+    }
+    cout << (errors ? "crash test FAILED" : "crash test ok") << endl;
+    return errors ? 1 : 0;
+}
+
+static int THREAD_NUM;
+static int TEST_TIME;
+static uint64_t SYNC_EVERY = 0;
+
+static const int TEST_NUM = 1 << 12;
+
+uint64_t *runtimelist;
+atomic<int> stopMeasure(0);
+uint64_t runner_count;
+uint64_t g_value;
+
+uint64_t items[TEST_NUM];
+
+struct DramQueue {
+    MichaelScottQueue<uint64_t> q{THREAD_NUM};
+
+    void enqueue(uint64_t i, int tid) { q.enqueue(&items[i], tid); }
+
+    bool dequeue(uint64_t &v, int tid) {
+        uint64_t *p = q.dequeue(tid);
+        if (p != nullptr) v = *p;
+        return p != nullptr;
+    }
+
+    void sync() {}
+};
+
+struct FileQueue {
+    FileMichaelScottQueue<uint64_t> q;
+
+    FileQueue(const char *path) : q(path, 1 << 20, THREAD_NUM) {}
+
+    void enqueue(uint64_t i, int tid) { q.enqueue(i, tid); }
+
+    bool dequeue(uint64_t &v, int tid) { return q.dequeue(v, tid); }
+
+    void sync() { q.sync(); }
+};
+
+template<typename Q>
+void bench_worker(int tid, Q *q) {
+    uint64_t l_value = 0, v, ops = 0;
+    Tracer t;
+    t.startTime();
+    while (stopMeasure.load(memory_order_relaxed) == 0) {
+        for (size_t i = 0; i < TEST_NUM; i++) {
+            q->enqueue(i, tid);
+            if (q->dequeue(v, tid)) l_value += v;
+            ops += 2;
+            if (tid == 0 && SYNC_EVERY && ops % SYNC_EVERY < 2) q->sync();
+        }
+        __sync_fetch_and_add(&runner_count, TEST_NUM * 2);
+        if (t.fetchTime() / 1000000 >= TEST_TIME) stopMeasure.store(1, memory_order_relaxed);
+    }
+    runtimelist[tid] = t.getRunTime();
+    __sync_fetch_and_add(&g_value, l_value);
+}
+
+//Mops
+template<typename Q>
+double bench_run(Q *q) {
+    stopMeasure.store(0);
+    runner_count = 0;
+    g_value = 0;
+    vector<thread> threads;
+    for (size_t i = 0; i < THREAD_NUM; i++) {
+        threads.push_back(thread(bench_worker<Q>, i, q));
+    }
+    for (size_t i = 0; i < THREAD_NUM; i++) {
+        threads[i].join();
+    }
+    delete q;
+
+    double runtime = 0;
+    for (size_t i = 0; i < THREAD_NUM; i++)
+        runtime += runtimelist[i];
+    runtime /= THREAD_NUM;
+    return runner_count * 1.0 / runtime;
+}
+
+static int bench(const char *path) {
+#if defined(PWB_IS_NOP)
+    const char *pwb = "nop";
+#elif defined(PWB_IS_CLWB)
+    const char *pwb = "clwb";
+#else
+    const char *pwb = "other";
+#endif
+    cout << "#pwb " << pwb << ", thread_num " << THREAD_NUM << ", test_time " << TEST_TIME
+         << ", sync_every " << SYNC_EVERY << endl;
+    cout << "#queue\tMops\tns/op" << endl;
+    runtimelist = new uint64_t[THREAD_NUM]();
+    for (size_t i = 0; i < TEST_NUM; i++) items[i] = i;
+
+    double dram = bench_run(new DramQueue);
+    cout << "dram\t" << dram << "\t" << 1000 / dram << endl;
+    unlink(path);
+    double file = bench_run(new FileQueue(path));
+    cout << "file\t" << file << "\t" << 1000 / file << endl;
+    unlink(path);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    string mode = argc > 2 ? argv[1] : "";
+    if (mode == "crash") {
+        int rounds = argc > 3 ? stol(argv[3]) : 20;
+        int producers = argc > 4 ? stol(argv[4]) : 2;
+        int consumers = argc > 5 ? stol(argv[5]) : 2;
+        if (producers > MAX_PRODUCERS) producers = MAX_PRODUCERS;
+        return crash_test(argv[2], rounds, producers, consumers);
+    }
+    if (mode == "bench" && argc > 4) {
+        THREAD_NUM = stol(argv[3]);
+        TEST_TIME = stol(argv[4]);
+        if (argc > 5) SYNC_EVERY = stol(argv[5]);
+        return bench(argv[2]);
+    }
+    printf("./FileQueueTest crash <file> [rounds=20] [producers=2] [consumers=2]\n");
+    printf("./FileQueueTest bench <file> <thread_num> <test_time> [sync_every=0]\n");
+    return 0;
+}
@@ -78,9 +78,9 @@ public:
     ~HazardPointers() {
         for (int ithread = 0; ithread < HP_MAX_THREADS; ithread++) {
             delete[] hp[ithread];
-            // Clear the current retired nodes
+            // Clear the current retired nodes, through the deleter as they may not come from new
             for (unsigned iret = 0; iret < retiredList[ithread * CLPAD].size(); iret++) {
-                delete retiredList[ithread * CLPAD][iret];
+                deleter(retiredList[ithread * CLPAD][iret], ithread);
             }
         }
     }
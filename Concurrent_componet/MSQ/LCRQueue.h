@@ -0,0 +1,278 @@
+#ifndef RESEARCH_LCRQUEUE_H
+#define RESEARCH_LCRQUEUE_H
+
+#include <atomic>
+#include <stdexcept>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include "HazardPointers.h"
+
+/**
+ * <h1> LCRQ </h1>
+ *
+ * enqueue algorithm: FAA on the tail ticket of the last ring, CAS2 on its cell
+ * dequeue algorithm: FAA on the head ticket of the first ring, CAS2 on its cell
+ * Consistency: Linearizable
+ * enqueue() progress: lock-free
+ * dequeue() progress: lock-free
+ * Memory Reclamation: Hazard Pointers on the rings
+ *
+ *
+ * Adam Morrison and Yehuda Afek's LCRQ, "Fast Concurrent Queues for x86 Processors"
+ * (PPoPP 2013). A ticket from the FAA picks the cell, so threads only meet on the
+ * FAA and the CAS2 on the cell mostly goes through the first time, where the
+ * Michael-Scott queue has every thread retry a CAS on head or tail. A ring (CRQ)
+ * that fills up or keeps losing cells gets closed and a fresh one is appended
+ * Michael-Scott style, so the rings form the list MichaelScottQueue has for nodes.
+ *
+ * A cell holds the item and the ticket it is meant for, the top bit of that index
+ * marks a cell a dequeuer gave up on (unsafe), the top bit of the tail ticket marks
+ * a closed ring. Both words of a cell change together with cmpxchg16b.
+ *
+ * enqueue_batch / dequeue_batch take a range of tickets with one FAA.
+ */
+template<typename T>
+class LCRQueue {
+private:
+    static const uint64_t RING_SIZE = 1 << 10;
+    static const uint64_t BATCH_MAX = RING_SIZE / 4;  // tickets taken by one FAA
+    static const uint64_t TOP_BIT = 1ull << 63;       // closed tail, unsafe cell
+    static const int STARVE_TRIES = 200000;           // dequeuer wait for a slow enqueuer
+    static const int CLOSE_TRIES = 10;
+
+    struct alignas(64) Cell {
+        std::atomic<T *> val;
+        std::atomic<uint64_t> idx;
+    };
+
+    struct Ring {
+        alignas(128) std::atomic<uint64_t> head;
+        alignas(128) std::atomic<uint64_t> tail;
+        alignas(128) std::atomic<Ring *> next;
+        Cell cells[RING_SIZE];
+
+        Ring() {
+            for (uint64_t i = 0; i < RING_SIZE; i++) {
+                cells[i].val.store(nullptr, std::memory_order_relaxed);
+                cells[i].idx.store(i, std::memory_order_relaxed);
+            }
+            head.store(0, std::memory_order_relaxed);
+            tail.store(0, std::memory_order_relaxed);
+            next.store(nullptr, std::memory_order_relaxed);
+        }
+
+        // plain new does not align to 128 before C++17
+        static void *operator new(size_t size) {
+            void *p;
+            if (posix_memalign(&p, 128, size) != 0) throw std::bad_alloc();
+            return p;
+        }
+
+        static void operator delete(void *p) { free(p); }
+    };
+
+    alignas(128) std::atomic<Ring *> head;
+    alignas(128) std::atomic<Ring *> tail;
+
+    static const int MAX_THREADS = 128;
+    const int maxThreads;
+
+    HazardPointers<Ring> hp{1, maxThreads};
+    const int kHpTail = 0;
+    const int kHpHead = 0;
+
+    static uint64_t index_of(uint64_t v) { return v & ~TOP_BIT; }
+
+    static bool cas2(Cell &cell, T *cmpVal, uint64_t cmpIdx, T *newVal, uint64_t newIdx) {
+        bool ok;
+        asm volatile("lock cmpxchg16b %1\n\tsetz %0"
+        : "=q"(ok), "+m"(cell), "+a"(cmpVal), "+d"(cmpIdx)
+        : "b"(newVal), "c"(newIdx)
+        : "cc", "memory");
+        return ok;
+    }
+
+    bool enqueue_at(Ring *ring, uint64_t ticket, T *item) {
+        Cell &cell = ring->cells[ticket & (RING_SIZE - 1)];
+        uint64_t idx = cell.idx.load();
+        if (cell.val.load() != nullptr || index_of(idx) > ticket) return false;
+        if ((idx & TOP_BIT) && ring->head.load() > ticket) return false;
+        return cas2(cell, nullptr, idx, item, ticket);
+    }
+
+    // The item of ticket, or nullptr when the ticket is burned: the cell was
+    // empty and the enqueuer of this ticket will miss it.
+    T *dequeue_at(Ring *ring, uint64_t ticket) {
+        Cell &cell = ring->cells[ticket & (RING_SIZE - 1)];
+        uint64_t tt = 0;
+        for (int r = 0;; r++) {
+            uint64_t idx = cell.idx.load();
+            T *val = cell.val.load();
+            uint64_t unsafe = idx & TOP_BIT;
+            if (index_of(idx) > ticket) return nullptr;
+            if (val != nullptr) {
+                if (index_of(idx) == ticket) {
+                    if (cas2(cell, val, idx, nullptr, unsafe | (ticket + RING_SIZE))) return val;
+                } else {
+                    // an item from a lap ago still sits there, keep enqueuers off the cell
+                    if (cas2(cell, val, idx, val, idx | TOP_BIT)) return nullptr;
+                }
+                continue;
+            }
+            if ((r & 1023) == 0) tt = ring->tail.load();
+            if (unsafe) {
+                if (cas2(cell, nullptr, idx, nullptr, unsafe | (ticket + RING_SIZE))) return nullptr;
+            } else if (index_of(tt) <= ticket || r > STARVE_TRIES || (tt & TOP_BIT)) {
+                if (cas2(cell, nullptr, idx, nullptr, ticket + RING_SIZE)) {
+                    if (r > STARVE_TRIES && index_of(tt) > RING_SIZE) ring->tail.fetch_or(TOP_BIT);
+                    return nullptr;
+                }
+            }
+        }
+    }
+
+    // dequeuers took tickets past the tail, move the tail up to them
+    void fix_state(Ring *ring) {
+        while (true) {
+            uint64_t t = ring->tail.load();
+            uint64_t h = ring->head.load();
+            if (ring->tail.load() != t) continue;
+            if (h <= t) return; // also when closed, the top bit keeps t above h
+            if (ring->tail.compare_exchange_strong(t, h)) return;
+        }
+    }
+
+    void close(Ring *ring, uint64_t ticket, int tries) {
+        uint64_t t = ticket + 1;
+        if (tries < CLOSE_TRIES) ring->tail.compare_exchange_strong(t, t | TOP_BIT);
+        else ring->tail.fetch_or(TOP_BIT);
+    }
+
+    bool append_ring(Ring *ltail, T *item) {
+        Ring *ring = new Ring();
+        ring->tail.store(1, std::memory_order_relaxed);
+        ring->cells[0].val.store(item, std::memory_order_relaxed);
+        Ring *lnext = nullptr;
+        if (ltail->next.compare_exchange_strong(lnext, ring)) {
+            tail.compare_exchange_strong(ltail, ring);
+            return true;
+        }
+        delete ring;
+        return false;
+    }
+
+    // After the tickets up to last came back short: true if the first ring is
+    // drained and it was the last one, else helps the head to the next ring.
+    bool drained(Ring *lhead, uint64_t last, const int tid) {
+        if (index_of(lhead->tail.load()) > last + 1) return false;
+        fix_state(lhead);
+        Ring *lnext = lhead->next.load();
+        if (lnext == nullptr) return true;
+        if (index_of(lhead->tail.load()) <= last + 1 && head.compare_exchange_strong(lhead, lnext)) {
+            hp.clear(tid);
+            hp.retire(lhead, tid);
+        }
+        return false;
+    }
+
+public:
+    LCRQueue(int maxThreads = MAX_THREADS) : maxThreads{maxThreads} {
+        Ring *ring = new Ring();
+        head.store(ring, std::memory_order_relaxed);
+        tail.store(ring, std::memory_order_relaxed);
+    }
+
+    ~LCRQueue() {
+        while (dequeue(0) != nullptr);
+        delete head.load();
+    }
+
+    std::string className() { return "LCRQueue"; }
+
+    void enqueue(T *item, const int tid) {
+        if (item == nullptr) throw std::invalid_argument("item can not be nullptr");
+        int tries = 0;
+        while (true) {
+            Ring *ltail = hp.protect(kHpTail, tail, tid);
+            Ring *lnext = ltail->next.load();
+            if (lnext != nullptr) {
+                tail.compare_exchange_strong(ltail, lnext);
+                continue;
+            }
+            uint64_t ticket = ltail->tail.fetch_add(1);
+            if (ticket & TOP_BIT) {
+                if (append_ring(ltail, item)) break;
+                continue;
+            }
+            if (enqueue_at(ltail, ticket, item)) break;
+            if ((int64_t) (ticket - ltail->head.load()) >= (int64_t) RING_SIZE) close(ltail, ticket, ++tries);
+        }
+        hp.clear(tid);
+    }
+
+    T *dequeue(const int tid) {
+        T *item = nullptr;
+        while (true) {
+            Ring *lhead = hp.protect(kHpHead, head, tid);
+            uint64_t ticket = lhead->head.fetch_add(1);
+            item = dequeue_at(lhead, ticket);
+            if (item != nullptr || drained(lhead, ticket, tid)) break;
+        }
+        hp.clear(tid);
+        return item;
+    }
+
+    // Items land in their tickets' cells in order. From the first one that misses
+    // its cell (the ring filled up or got closed meanwhile) the next goes through
+    // enqueue() and the rest takes fresh tickets, so the batch keeps its order.
+    void enqueue_batch(T *const *items, size_t n, const int tid) {
+        for (size_t i = 0; i < n; i++)
+            if (items[i] == nullptr) throw std::invalid_argument("item can not be nullptr");
+        size_t i = 0;
+        while (i < n) {
+            uint64_t k = std::min((uint64_t) (n - i), BATCH_MAX);
+            Ring *ltail = hp.protect(kHpTail, tail, tid);
+            Ring *lnext = ltail->next.load();
+            if (lnext != nullptr) {
+                tail.compare_exchange_strong(ltail, lnext);
+                continue;
+            }
+            uint64_t ticket = ltail->tail.fetch_add(k);
+            uint64_t j = 0;
+            if (!(ticket & TOP_BIT))
+                while (j < k && enqueue_at(ltail, ticket + j, items[i + j])) j++;
+            i += j;
+            if (j < k) enqueue(items[i++], tid);
+        }
+        hp.clear(tid);
+    }
+
+    // Up to n items in queue order, returns how many, 0 when empty. Every ticket
+    // taken is run through: a skipped one would strand the item its enqueuer puts
+    // there, so the FAA asks for no more than the ring seems to hold.
+    size_t dequeue_batch(T **items, size_t n, const int tid) {
+        size_t got = 0;
+        while (got < n) {
+            Ring *lhead = hp.protect(kHpHead, head, tid);
+            uint64_t k = std::min((uint64_t) (n - got), BATCH_MAX);
+            uint64_t h = lhead->head.load(), t = index_of(lhead->tail.load());
+            k = std::max((uint64_t) 1, std::min(k, t > h ? t - h : 0));
+            uint64_t ticket = lhead->head.fetch_add(k);
+            for (uint64_t j = 0; j < k; j++) {
+                T *item = dequeue_at(lhead, ticket + j);
+                if (item != nullptr) items[got++] = item;
+            }
+            if (drained(lhead, ticket + k - 1, tid)) break;
+        }
+        hp.clear(tid);
+        return got;
+    }
+};
+
+// std::min takes it by reference, so it needs a definition
+template<typename T>
+const uint64_t LCRQueue<T>::BATCH_MAX;
+
+#endif //RESEARCH_LCRQUEUE_H
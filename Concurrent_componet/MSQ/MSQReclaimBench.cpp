@@ -0,0 +1,133 @@
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include "tracer.h"
+#include "MichaelScottQueue.h"
+#include "BrownMichaelScottQueue.h"
+// record_manager.h brings in debraplus, whose QUIESCENT macros ebr_tree defines
+// differently; ebr_tree #undefs its own at the end, debra defines them again
+#undef QUIESCENT
+#undef GET_WITH_QUIESCENT
+#include "../SingleRoad/brown/reclaimer_ebr_tree.h"
+#include "../SingleRoad/brown/reclaimer_ebr_token.h"
+#include "../SingleRoad/brown/reclaimer_debra.h"
+
+using namespace std;
+
+//Enqueue/dequeue throughput of the Michael-Scott queue per node reclaimer. Every
+//thread runs enqueue + dequeue pairs on one shared queue that starts with
+//prefill items, so the queue length stays put and every dequeue retires a node.
+//  hp         MichaelScottQueue, hazard pointers, new / delete per node
+//  hp_pool    MichaelScottQueue, hazard pointers, per-thread node pools
+//  debra      BrownMichaelScottQueue<reclaimer_debra<>>
+//  ebr_token  BrownMichaelScottQueue<reclaimer_ebr_token<>>
+//  ebr_tree   BrownMichaelScottQueue<reclaimer_ebr_tree<>>
+//
+//./MSQReclaimBench <thread_num> <test_time> [prefill] [methods]
+
+static int THREAD_NUM;
+static int TEST_TIME;
+static int PREFILL = 1024;
+
+static const int TEST_NUM = 1 << 12;
+
+uint64_t *runtimelist;
+
+atomic<int> stopMeasure(0);
+uint64_t runner_count;
+uint64_t g_value;
+
+uint64_t items[TEST_NUM];
+
+struct HpQueue {
+    MichaelScottQueue<uint64_t> q;
+
+    HpQueue(size_t pool) : q(THREAD_NUM, pool) {}
+
+    void initThread(int tid) {}
+};
+
+template<typename Reclaim>
+struct BrownQueue {
+    BrownMichaelScottQueue<uint64_t, Reclaim> q{THREAD_NUM};
+
+    void initThread(int tid) { q.initThread(tid); }
+};
+
+template<typename Q>
+void concurrent_worker(int tid, Q *queue) {
+    queue->initThread(tid);
+    uint64_t l_value = 0;
+    Tracer t;
+    t.startTime();
+    while (stopMeasure.load(memory_order_relaxed) == 0) {
+        for (size_t i = 0; i < TEST_NUM; i++) {
+            queue->q.enqueue(&items[i], tid);
+            uint64_t *v = queue->q.dequeue(tid);
+            if (v != nullptr) l_value += *v;
+        }
+        __sync_fetch_and_add(&runner_count, TEST_NUM * 2);
+        if (t.fetchTime() / 1000000 >= TEST_TIME) stopMeasure.store(1, memory_order_relaxed);
+    }
+    runtimelist[tid] = t.getRunTime();
+    __sync_fetch_and_add(&g_value, l_value);
+}
+
+//Mops
+template<typename Q>
+double run_test(Q *queue) {
+    stopMeasure.store(0);
+    runner_count = 0;
+    g_value = 0;
+    for (int i = 0; i < PREFILL; i++) queue->q.enqueue(&items[i % TEST_NUM], 0);
+
+    vector<thread> threads;
+    for (size_t i = 0; i < THREAD_NUM; i++) {
+        threads.push_back(thread(concurrent_worker<Q>, i, queue));
+    }
+    for (size_t i = 0; i < THREAD_NUM; i++) {
+        threads[i].join();
+    }
+    delete queue;
+
+    double runtime = 0;
+    for (size_t i = 0; i < THREAD_NUM; i++)
+        runtime += runtimelist[i];
+    runtime /= THREAD_NUM;
+    return runner_count * 1.0 / runtime;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        printf("./MSQReclaimBench <thread_num> <test_time> [prefill=1024] [hp,hp_pool,debra,ebr_token,ebr_tree]\n");
+        return 0;
+    }
+    THREAD_NUM = stol(argv[1]);
+    TEST_TIME = stol(argv[2]);
+    if (argc > 3) PREFILL = stol(argv[3]);
+    string methods = argc > 4 ? argv[4] : "hp,hp_pool,debra,ebr_token,ebr_tree";
+
+    cout << "#thread_num " << THREAD_NUM << ", test_time " << TEST_TIME << ", prefill " << PREFILL << endl;
+    cout << "#method\tMops" << endl;
+
+    runtimelist = new uint64_t[THREAD_NUM]();
+    for (size_t i = 0; i < TEST_NUM; i++) items[i] = i;
+
+    stringstream ss(methods);
+    string m;
+    while (getline(ss, m, ',')) {
+        double throughput;
+        if (m == "hp") throughput = run_test(new HpQueue(0));
+        else if (m == "hp_pool") throughput = run_test(new HpQueue(4096));
+        else if (m == "debra") throughput = run_test(new BrownQueue<reclaimer_debra<>>);
+        else if (m == "ebr_token") throughput = run_test(new BrownQueue<reclaimer_ebr_token<>>);
+        else if (m == "ebr_tree") throughput = run_test(new BrownQueue<reclaimer_ebr_tree<>>);
+        else {
+            cout << "unknown method " << m << endl;
+            return -1;
+        }
+        cout << m << "\t" << throughput << endl;
+    }
+    return 0;
+}
@@ -31,6 +31,8 @@
 
 #include <atomic>
 #include <stdexcept>
+#include <functional>
+#include <vector>
 #include <assert.h>
 #include "HazardPointers.h"
 
@@ -43,6 +45,7 @@
  * enqueue() progress: lock-free
  * dequeue() progress: lock-free
  * Memory Reclamation: Hazard Pointers (lock-free)
+ * Node allocation: per-thread pools fed by the hazard pointer scan
  *
  *
  * Maged Michael and Michael Scott's Queue with Hazard Pointers
@@ -66,6 +69,11 @@ private:
 
         Node(T *userItem) : item{userItem}, next{nullptr} {}
 
+        void reset(T *userItem) {
+            item = userItem;
+            next.store(nullptr, std::memory_order_relaxed);
+        }
+
         bool casNext(Node *cmp, Node *val) {
             return next.compare_exchange_strong(cmp, val);
         }
@@ -84,16 +92,49 @@ private:
     alignas(128) std::atomic<Node *> tail;
 
     static const int MAX_THREADS = 128;
+    static const size_t NODE_POOL_MAX = 4096;
     const int maxThreads;
+    const size_t nodePoolMax;
+
+    // Nodes the hazard pointer scan found unprotected go to the pool of the
+    // thread that retired them instead of delete, and enqueue takes from its own
+    // pool before it calls new. A pool keeps at most nodePoolMax nodes and deletes
+    // the rest, so a thread that only dequeues does not hoard them. The pools go
+    // after hp, which hands its last retired nodes to recycle.
+    struct alignas(128) NodePool {
+        std::vector<Node *> nodes;
+
+        ~NodePool() {
+            for (Node *node : nodes) delete node;
+        }
+    };
+    NodePool pools[MAX_THREADS];
+
+    std::function<void(Node *, int)> recycle = [this](Node *node, int tid) {
+        std::vector<Node *> &nodes = pools[tid].nodes;
+        if (nodes.size() < nodePoolMax) nodes.push_back(node);
+        else delete node;
+    };
 
     // We need two hazard pointers for dequeue()
-    HazardPointers<Node> hp{2, maxThreads};
+    HazardPointers<Node> hp{2, maxThreads, recycle};
+
+    Node *get_node(T *item, const int tid) {
+        std::vector<Node *> &nodes = pools[tid].nodes;
+        if (nodes.empty()) return new Node(item);
+        Node *node = nodes.back();
+        nodes.pop_back();
+        node->reset(item);
+        return node;
+    }
     const int kHpTail = 0;
     const int kHpHead = 0;
     const int kHpNext = 1;
 
 public:
-    MichaelScottQueue(int maxThreads = MAX_THREADS) : maxThreads{maxThreads} {
+    // nodePoolMax 0 allocates every node with new and deletes it after the scan
+    MichaelScottQueue(int maxThreads = MAX_THREADS, size_t nodePoolMax = NODE_POOL_MAX)
+            : maxThreads{maxThreads}, nodePoolMax{nodePoolMax} {
         Node *sentinelNode = new Node(nullptr);
         head.store(sentinelNode, std::memory_order_relaxed);
         tail.store(sentinelNode, std::memory_order_relaxed);
@@ -109,7 +150,7 @@ public:
 
     void enqueue(T *item, const int tid) {
         if (item == nullptr) throw std::invalid_argument("item can not be nullptr");
-        Node *newNode = new Node(item);
+        Node *newNode = get_node(item, tid);
         while (true) {
             Node *ltail = hp.protectPtr(kHpTail, tail, tid);
             if (ltail == tail.load()) {
@@ -145,6 +186,43 @@ public:
         return nullptr;                  // Queue is empty
     }
 
+    // The items go in as one chain of nodes with a single CAS on the last node's
+    // next, the tail catches up through the usual helping
+    void enqueue_batch(T *const *items, size_t n, const int tid) {
+        if (n == 0) return;
+        for (size_t i = 0; i < n; i++)
+            if (items[i] == nullptr) throw std::invalid_argument("item can not be nullptr");
+        Node *first = get_node(items[0], tid);
+        Node *last = first;
+        for (size_t i = 1; i < n; i++) {
+            Node *node = get_node(items[i], tid);
+            last->next.store(node, std::memory_order_relaxed);
+            last = node;
+        }
+        while (true) {
+            Node *ltail = hp.protectPtr(kHpTail, tail, tid);
+            if (ltail == tail.load()) {
+                Node *lnext = ltail->next.load();
+                if (lnext == nullptr) {
+                    if (ltail->casNext(nullptr, first)) {
+                        casTail(ltail, last);
+                        hp.clear(tid);
+                        return;
+                    }
+                } else {
+                    casTail(ltail, lnext);
+                }
+            }
+        }
+    }
+
+    // Only two hazard pointers, so no walking ahead of head: one dequeue per item
+    size_t dequeue_batch(T **items, size_t n, const int tid) {
+        size_t got = 0;
+        while (got < n && (items[got] = dequeue(tid)) != nullptr) got++;
+        return got;
+    }
+
     inline bool copy_func(T * target,T * source){
         assert(source != nullptr);
         if(std::is_same<T, uint64_t>::value){
@@ -155,15 +233,17 @@ public:
         }
     }
 
+    //protect() re-reads tail until the hazard pointer covers it, once nodes get
+    //dequeued a plain protectPtr could publish a node that was already retired
     bool get_tail_item(T * target,const int tid){
-        Node *ltail = hp.protectPtr(kHpTail, tail, tid);
+        Node *ltail = hp.protect(kHpTail, tail, tid);
         //do copy work
         copy_func(target,ltail->item);
         hp.clear(tid);
         return true;
     }
     bool get_tail_item_l(uint64_t & l_value,const int tid){
-        Node *ltail = hp.protectPtr(kHpTail, tail, tid);
+        Node *ltail = hp.protect(kHpTail, tail, tid);
         //do copy work
         //copy_func(target,ltail->item);
         l_value += *ltail->item;
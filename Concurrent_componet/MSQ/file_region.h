@@ -0,0 +1,96 @@
+#ifndef RESEARCH_FILE_REGION_H
+#define RESEARCH_FILE_REGION_H
+
+#include <cassert>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+//A file mapped MAP_SHARED, standing in for persistent memory. A store to it is
+//in the page cache as soon as it is done, so it survives a kill of the process;
+//sync() msyncs the region to the file to also survive a crash of the machine.
+//PWB / PFENCE / PSYNC of pfences.h still order the stores the way they would on
+//real persistent memory.
+//
+//A new file is created with size bytes and reads as zeros, an existing one is
+//mapped with the size it has.
+class FileRegion {
+public:
+    FileRegion(const char *path, size_t size) {
+        fd = open(path, O_RDWR | O_CREAT, 0644);
+        if (fd < 0) throw std::runtime_error(std::string("can not open ") + path);
+        struct stat st;
+        fstat(fd, &st);
+        if (st.st_size == 0) {
+            if (ftruncate(fd, size) != 0) throw std::runtime_error(std::string("can not size ") + path);
+        } else {
+            size = st.st_size;
+        }
+        len = size;
+        addr = (char *) mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (addr == MAP_FAILED) throw std::runtime_error(std::string("can not map ") + path);
+    }
+
+    ~FileRegion() {
+        munmap(addr, len);
+        close(fd);
+    }
+
+    char *base() const { return addr; }
+
+    size_t size() const { return len; }
+
+    void sync() { msync(addr, len, MS_SYNC); }
+
+private:
+    int fd;
+    char *addr;
+    size_t len;
+};
+
+//Offset from the start of the mapped region, like rel_ptr of bz_rel_ptr.h: the
+//mapping may land elsewhere next time, the offsets stay valid. Offset 0 is null,
+//the region starts with a root object so no node lives there. 8 bytes and
+//trivially copyable, so std::atomic<file_ptr<T>> is lock-free.
+//
+//The base address is per T, one region of a T at a time.
+template<typename T>
+class file_ptr {
+    static char *base_address;
+    uint64_t off;
+public:
+    file_ptr() : off(0) {}
+
+    file_ptr(const T *abs_ptr) : off(abs_ptr == nullptr ? 0 : (const char *) abs_ptr - base_address) {}
+
+    explicit file_ptr(uint64_t rel_addr) : off(rel_addr) {}
+
+    T *abs() const { return off ? (T *) (base_address + off) : nullptr; }
+
+    // for links that are never null, no null branch for the compiler to follow
+    T *abs_nonnull() const {
+        assert(off != 0);
+        return (T *) (base_address + off);
+    }
+
+    T *operator->() const { return abs(); }
+
+    uint64_t rel() const { return off; }
+
+    bool operator==(const file_ptr<T> &fptr) const { return off == fptr.off; }
+
+    bool operator!=(const file_ptr<T> &fptr) const { return off != fptr.off; }
+
+    bool is_null() const { return !off; }
+
+    static void set_base(char *base) { base_address = base; }
+};
+
+template<typename T>
+char *file_ptr<T>::base_address(nullptr);
+
+#endif //RESEARCH_FILE_REGION_H
@@ -0,0 +1,178 @@
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include "MichaelScottQueue.h"
+#include "LCRQueue.h"
+#include "tracer.h"
+
+using namespace std;
+
+//kv_rw for whole queues: every thread walks the op list, a write enqueues batch
+//items, a read dequeues up to batch items, all on one shared queue that starts
+//with prefill items. batch 1 uses enqueue / dequeue, larger ones the _batch API.
+//Throughput counts items moved, latency is per call (sampled every
+//LAT_SAMPLE ops).
+//  msq   MichaelScottQueue
+//  lcrq  LCRQueue
+
+static int THREAD_NUM;
+static int TEST_NUM;
+static int TEST_TIME;
+static double WRITE_RATIO;
+static int BATCH = 1;
+static int PREFILL = 4096;
+
+static const int LAT_SAMPLE = 16;
+
+bool *writelist;
+uint64_t *runtimelist;
+
+uint64_t **opvaluelist;
+
+atomic<int> stopMeasure(0);
+uint64_t runner_count;
+uint64_t g_value;
+
+vector<uint32_t> *latencylist;
+
+template<typename Q>
+size_t queue_write(Q *q, size_t i, int tid) {
+    if (BATCH == 1) {
+        q->enqueue(opvaluelist[i], tid);
+        return 1;
+    }
+    q->enqueue_batch(&opvaluelist[i], BATCH, tid);
+    return BATCH;
+}
+
+template<typename Q>
+size_t queue_read(Q *q, uint64_t **buf, uint64_t &l_value, int tid) {
+    size_t got;
+    if (BATCH == 1) got = (buf[0] = q->dequeue(tid)) != nullptr;
+    else got = q->dequeue_batch(buf, BATCH, tid);
+    for (size_t j = 0; j < got; j++) l_value += *buf[j];
+    return got;
+}
+
+template<typename Q>
+void concurrent_worker(int tid, Q *q) {
+    uint64_t l_value = 0;
+    vector<uint64_t *> buf(BATCH);
+    vector<uint32_t> &lat = latencylist[tid];
+    Tracer t;
+    t.startTime();
+    while (stopMeasure.load(memory_order_relaxed) == 0) {
+        uint64_t moved = 0;
+        for (size_t i = 0; i < TEST_NUM; i++) {
+            bool sample = i % LAT_SAMPLE == 0;
+            chrono::steady_clock::time_point begin;
+            if (sample) begin = chrono::steady_clock::now();
+            if (writelist[i]) moved += queue_write(q, i, tid);
+            else moved += queue_read(q, buf.data(), l_value, tid);
+            if (sample)
+                lat.push_back(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - begin).count());
+        }
+
+        __sync_fetch_and_add(&runner_count, moved);
+        uint64_t tmptruntime = t.fetchTime();
+        if (tmptruntime / 1000000 >= TEST_TIME) {
+            stopMeasure.store(1, memory_order_relaxed);
+        }
+    }
+    runtimelist[tid] = t.getRunTime();
+    __sync_fetch_and_add(&g_value, l_value);
+}
+
+template<typename Q>
+double run_test() {
+    Q *q = new Q(THREAD_NUM);
+    for (size_t i = 0; i < PREFILL; i++) q->enqueue(opvaluelist[i % TEST_NUM], 0);
+    stopMeasure.store(0);
+    runner_count = 0;
+    g_value = 0;
+    for (size_t i = 0; i < THREAD_NUM; i++) latencylist[i].clear();
+
+    vector<thread> threads;
+    for (size_t i = 0; i < THREAD_NUM; i++) {
+        threads.push_back(thread(concurrent_worker<Q>, i, q));
+    }
+    for (size_t i = 0; i < THREAD_NUM; i++) {
+        threads[i].join();
+    }
+    delete q;
+
+    double runtime = 0;
+    for (size_t i = 0; i < THREAD_NUM; i++)
+        runtime += runtimelist[i];
+    runtime /= THREAD_NUM;
+    return runner_count * 1.0 / runtime;
+}
+
+void print_latency() {
+    vector<uint32_t> all;
+    for (size_t i = 0; i < THREAD_NUM; i++) all.insert(all.end(), latencylist[i].begin(), latencylist[i].end());
+    if (all.empty()) return;
+    sort(all.begin(), all.end());
+    double avg = 0;
+    for (uint32_t l : all) avg += l;
+    avg /= all.size();
+    cout << " avg_ns " << avg
+         << " p50_ns " << all[all.size() / 2]
+         << " p99_ns " << all[all.size() * 99 / 100]
+         << " p999_ns " << all[all.size() * 999 / 1000];
+}
+
+int main(int argc, char **argv) {
+    if (argc >= 5) {
+        THREAD_NUM = stol(argv[1]);
+        TEST_TIME = stol(argv[2]);
+        TEST_NUM = stol(argv[3]);
+        WRITE_RATIO = stod(argv[4]);
+    } else {
+        printf("./queue_rw <thread_num> <test_time> <test_num> <write_ratio> [batch=1] [msq,lcrq] [prefill=4096]\n");
+        return 0;
+    }
+    if (argc > 5) BATCH = stol(argv[5]);
+    string methods = argc > 6 ? argv[6] : "msq,lcrq";
+    if (argc > 7) PREFILL = stol(argv[7]);
+
+    cout << "thread_num " << THREAD_NUM << endl <<
+         "test_time " << TEST_TIME << endl <<
+         "test_num " << TEST_NUM << endl <<
+         "write_ratio " << WRITE_RATIO << endl <<
+         "batch " << BATCH << endl <<
+         "prefill " << PREFILL << endl;
+
+    // a write at i enqueues opvaluelist[i .. i + BATCH)
+    opvaluelist = new uint64_t *[TEST_NUM + BATCH];
+    for (size_t i = 0; i < TEST_NUM + BATCH; i++) {
+        opvaluelist[i] = new uint64_t(i);
+    }
+    runtimelist = new uint64_t[THREAD_NUM]();
+    latencylist = new vector<uint32_t>[THREAD_NUM];
+
+    srand(time(NULL));
+    writelist = new bool[TEST_NUM];
+    for (size_t i = 0; i < TEST_NUM; i++) {
+        writelist[i] = rand() * 1.0 / RAND_MAX * 100 < WRITE_RATIO;
+    }
+
+    stringstream ss(methods);
+    string m;
+    while (getline(ss, m, ',')) {
+        double throughput;
+        if (m == "msq") throughput = run_test<MichaelScottQueue<uint64_t>>();
+        else if (m == "lcrq") throughput = run_test<LCRQueue<uint64_t>>();
+        else {
+            cout << "unknown method " << m << endl;
+            return -1;
+        }
+        cout << m << " ***throughput " << throughput;
+        print_latency();
+        cout << " g_value " << g_value << endl;
+    }
+    return 0;
+}
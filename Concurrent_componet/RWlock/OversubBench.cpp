@@ -0,0 +1,177 @@
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include <sys/resource.h>
+#include "../../Cuckoo_improve/libcuckoo_source/cuckoohash_locks.hh" // also brings in rwlocks.h
+#include "mutexes.h"
+#include "tracer.h"
+
+using namespace std;
+
+//More threads than cores on the spin loops of spin_wait.h. Every thread takes a
+//lock, runs cs_len iterations of work inside, releases, and does the same amount of
+//work outside. conflict_ratio percent of the ops go to one shared lock, the rest to
+//the thread's own. Besides throughput it prints the CPU time the process burned per
+//wall second: busy spinning oversubscribed keeps it at the core count, parking
+//brings it down. OversubBench_raw is the same binary with SPIN_WAIT_RAW (bare busy
+//loops) to compare against.
+//
+//  rw     rwlocks.h Lock, write_ratio percent exclusive
+//  spin   libcuckoo spin_lock_policy bucket lock
+//  tas    mutexes.h TasLock, pause only, never backs off
+//
+//./OversubBench <test_time> [oversub] [cs_len] [conflict_ratio] [write_ratio] [locks]
+
+static int THREAD_NUM;
+static int TEST_TIME;
+static int CS_LEN = 100;
+static double CONFLICT_RATIO = 100;
+static double WRITE_RATIO = 50;
+
+static const int TEST_NUM = 1 << 16;
+
+bool *conflictlist;
+bool *writelist;
+uint64_t *runtimelist;
+
+atomic<int> stopMeasure(0);
+uint64_t runner_count;
+uint64_t g_value;
+
+struct RwLock : public Lock {};
+
+template<typename M>
+struct ExclusiveLock : public M {
+    void rLock() { this->lock(); }
+    void rUnlock() { this->unlock(); }
+    void wLock() { this->lock(); }
+    void wUnlock() { this->unlock(); }
+};
+
+using CuckooSpin = ExclusiveLock<libcuckoo::spin_lock_policy::lock_type>;
+
+struct alignas(128) Shared {
+    volatile uint64_t value = 0;
+};
+
+static inline uint64_t work(uint64_t x) {
+    for (int k = 0; k < CS_LEN; k++) x = x * 6364136223846793005ull + 1442695040888963407ull;
+    return x;
+}
+
+template<typename L>
+void concurrent_worker(int tid, L *locks, Shared *values) {
+    uint64_t l_value = tid;
+    Tracer t;
+    t.startTime();
+    while (stopMeasure.load(memory_order_relaxed) == 0) {
+        size_t i = 0;
+        for (; i < TEST_NUM && stopMeasure.load(memory_order_relaxed) == 0; i++) {
+            int index = conflictlist[i] ? THREAD_NUM : tid;
+            if (writelist[i]) {
+                locks[index].wLock();
+                values[index].value = work(values[index].value + 1);
+                locks[index].wUnlock();
+            } else {
+                locks[index].rLock();
+                l_value += work(values[index].value);
+                locks[index].rUnlock();
+            }
+            l_value = work(l_value);
+            if ((i & 1023) == 1023 && t.fetchTime() / 1000000 >= TEST_TIME)
+                stopMeasure.store(1, memory_order_relaxed);
+        }
+        __sync_fetch_and_add(&runner_count, i);
+        if (t.fetchTime() / 1000000 >= TEST_TIME) stopMeasure.store(1, memory_order_relaxed);
+    }
+    runtimelist[tid] = t.getRunTime();
+    __sync_fetch_and_add(&g_value, l_value);
+}
+
+static double cpu_seconds() {
+    rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+//Mops, cpu is set to CPU seconds per wall second
+template<typename L>
+double run_test(double &cpu) {
+    L *locks = new L[THREAD_NUM + 1];
+    Shared *values = new Shared[THREAD_NUM + 1];
+    stopMeasure.store(0);
+    runner_count = 0;
+    g_value = 0;
+
+    double cpu_before = cpu_seconds();
+    Tracer wall;
+    wall.startTime();
+    vector<thread> threads;
+    for (size_t i = 0; i < THREAD_NUM; i++) {
+        threads.push_back(thread(concurrent_worker<L>, i, locks, values));
+    }
+    for (size_t i = 0; i < THREAD_NUM; i++) {
+        threads[i].join();
+    }
+    cpu = (cpu_seconds() - cpu_before) / (wall.getRunTime() / 1e6);
+    delete[] locks;
+    delete[] values;
+
+    double runtime = 0;
+    for (size_t i = 0; i < THREAD_NUM; i++)
+        runtime += runtimelist[i];
+    runtime /= THREAD_NUM;
+    return runner_count * 1.0 / runtime;
+}
+
+double run_named(const string &name, double &cpu) {
+    if (name == "rw") return run_test<RwLock>(cpu);
+    if (name == "spin") return run_test<CuckooSpin>(cpu);
+    if (name == "tas") return run_test<ExclusiveLock<TasLock>>(cpu);
+    cout << "unknown lock " << name << endl;
+    exit(-1);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        printf("./OversubBench <test_time> [oversub=2] [cs_len=100] [conflict_ratio=100] [write_ratio=50] [rw,spin,tas]\n");
+        return 0;
+    }
+    TEST_TIME = stol(argv[1]);
+    int oversub = argc > 2 ? stol(argv[2]) : 2;
+    if (argc > 3) CS_LEN = stol(argv[3]);
+    if (argc > 4) CONFLICT_RATIO = stod(argv[4]);
+    if (argc > 5) WRITE_RATIO = stod(argv[5]);
+    string locks = argc > 6 ? argv[6] : "rw,spin,tas";
+
+    int cores = thread::hardware_concurrency();
+    THREAD_NUM = cores * oversub;
+
+#ifdef SPIN_WAIT_RAW
+    const char *wait_mode = "raw";
+#else
+    const char *wait_mode = "spin_wait";
+#endif
+    cout << "#wait " << wait_mode << ", rw is " << RWLOCK_NAME << ", cores " << cores << ", threads " << THREAD_NUM
+         << ", cs_len " << CS_LEN << ", conflict_ratio " << CONFLICT_RATIO << ", write_ratio " << WRITE_RATIO << endl;
+    cout << "#lock\tMops\tcpu/wall" << endl;
+
+    runtimelist = new uint64_t[THREAD_NUM]();
+    srand(time(NULL));
+    conflictlist = new bool[TEST_NUM];
+    writelist = new bool[TEST_NUM];
+    for (size_t i = 0; i < TEST_NUM; i++) {
+        conflictlist[i] = rand() * 1.0 / RAND_MAX * 100 < CONFLICT_RATIO;
+        writelist[i] = rand() * 1.0 / RAND_MAX * 100 < WRITE_RATIO;
+    }
+
+    stringstream ss(locks);
+    string name;
+    while (getline(ss, name, ',')) {
+        double cpu = 0;
+        double throughput = run_named(name, cpu);
+        cout << name << "\t" << throughput << "\t" << cpu << endl;
+    }
+    return 0;
+}
@@ -1,6 +1,9 @@
 #include <iostream>
+#include <sstream>
 #include <thread>
+#include <vector>
 #include "rwlocks.h"
+#include "mutexes.h"
 #include "tracer.h"
 
 #define VPP 1
@@ -26,7 +29,6 @@ struct alignas(128) KV_OBJ{
 };
 
 KV_OBJ * kvlist;
-Lock * locks;
 
 uint64_t ** opvaluelist;
 
@@ -39,17 +41,32 @@ uint64_t runner_count;
 
 uint64_t g_value;
 
+bool verbose = true;
+
 struct alignas(128) R_BUF{
     uint64_t r_buf;
 };
 
-void concurrent_worker(int tid){
+//exclusive locks run the same harness, readers lock like writers
+template<typename M>
+struct ExclusiveLock : public M {
+    void rLock() { this->lock(); }
+    void rUnlock() { this->unlock(); }
+    void wLock() { this->lock(); }
+    void wUnlock() { this->unlock(); }
+};
+
+template<typename L>
+void concurrent_worker(int tid, L *locks){
     uint64_t l_value=0;
     int index = 0;
     Tracer t;
     t.startTime();
     while(stopMeasure.load(memory_order_relaxed) == 0){
-        for(size_t i = 0; i < TEST_NUM; i++){
+        size_t i = 0;
+        //FIFO locks oversubscribed hand over once per time slice, so a batch may
+        //not finish in time; stop mid batch when the timer fired
+        for(; i < TEST_NUM && stopMeasure.load(memory_order_relaxed) == 0; i++){
             if(writelist[i]){
                 index = conflictlist[i] ? THREAD_NUM : tid;
                 locks[index].wLock();
@@ -69,21 +86,115 @@ void concurrent_worker(int tid){
 #endif
                 locks[index].rUnlock();
             }
+            if ((i & 1023) == 1023 && t.fetchTime() / 1000000 >= TEST_TIME)
+                stopMeasure.store(1, memory_order_relaxed);
         }
 
-        __sync_fetch_and_add(&runner_count,TEST_NUM);
+        __sync_fetch_and_add(&runner_count,i);
         uint64_t tmptruntime = t.fetchTime();
-        cout<<"--------------->runner_count "<<runner_count<<" tmptruntime"<<tmptruntime<<endl;
+        if (verbose) cout<<"--------------->runner_count "<<runner_count<<" tmptruntime"<<tmptruntime<<endl;
         if(tmptruntime / 1000000 >= TEST_TIME){
             stopMeasure.store(1, memory_order_relaxed);
         }
     }
     runtimelist[tid] = t.getRunTime();
-    g_value += l_value;
+    __sync_fetch_and_add(&g_value, l_value);
+}
+
+void gen_oplist(){
+    for(size_t i = 0; i < TEST_NUM; i++ ){
+        conflictlist[i] = rand() * 1.0 / RAND_MAX * 100  < CONFLICT_RATIO;
+        writelist[i] = rand() *1.0 / RAND_MAX * 100 < WRITE_RATIO;
+    }
+}
+
+//one measured run of lock type L with the current THREAD_NUM / CONFLICT_RATIO, returns Mops
+template<typename L>
+double run_test(){
+    L *locks = new L[THREAD_NUM + 1];
+    stopMeasure.store(0);
+    runner_count = 0;
+    g_value = 0;
+
+    vector<thread> threads;
+    for(size_t i = 0; i < THREAD_NUM; i++){
+        threads.push_back(thread(concurrent_worker<L>, i, locks));
+    }
+    for(size_t i = 0; i < THREAD_NUM; i++){
+        threads[i].join();
+    }
+    delete[] locks;
+
+    double runtime = 0;
+    for(size_t i = 0 ; i < THREAD_NUM; i++)
+        runtime += runtimelist[i];
+    runtime /= THREAD_NUM;
+    return runner_count * 1.0 / runtime;
+}
+
+double run_named(const string &name){
+    if (name == "rw") return run_test<Lock>();
+    if (name == "tas") return run_test<ExclusiveLock<TasLock>>();
+    if (name == "ticket") return run_test<ExclusiveLock<TicketLock>>();
+    if (name == "mcs") return run_test<ExclusiveLock<McsLock>>();
+    if (name == "clh") return run_test<ExclusiveLock<ClhLock>>();
+    if (name == "cohort") return run_test<ExclusiveLock<CohortLock>>();
+    cout << "unknown lock " << name << endl;
+    exit(-1);
+}
+
+template<typename T>
+vector<T> parse_list(const char *val){
+    vector<T> res;
+    stringstream ss(val);
+    string item;
+    while (getline(ss, item, ',')) {
+        stringstream is(item);
+        T v;
+        is >> v;
+        res.push_back(v);
+    }
+    return res;
+}
+
+//./RWLockTest sweep <test_time> <test_num> <write_ratio> <threads list> <conflict list> [locks list]
+int sweep(int argc, char **argv){
+    TEST_TIME = stol(argv[2]);
+    TEST_NUM = stol(argv[3]);
+    WRITE_RATIO = stod(argv[4]);
+    vector<int> thread_list = parse_list<int>(argv[5]);
+    vector<double> conflict_list = parse_list<double>(argv[6]);
+    vector<string> lock_list = parse_list<string>(argc > 7 ? argv[7] : "rw,tas,ticket,mcs,clh,cohort");
+    verbose = false;
+
+    int max_thread = 0;
+    for (int t : thread_list) max_thread = max(max_thread, t);
+    runtimelist = new uint64_t[max_thread]();
+    conflictlist = new bool[TEST_NUM];
+    writelist = new bool[TEST_NUM];
+    srand(time(NULL));
+
+    cout << "#rw is " << RWLOCK_NAME << ", write_ratio " << WRITE_RATIO << endl;
+    cout << "#lock\tthreads\tconflict\tMops" << endl;
+    for (double conflict : conflict_list) {
+        CONFLICT_RATIO = conflict;
+        gen_oplist();
+        for (int threads : thread_list) {
+            THREAD_NUM = threads;
+            for (auto &name : lock_list) {
+                double throughput = run_named(name);
+                cout << name << "\t" << threads << "\t" << conflict << "\t" << throughput << endl;
+            }
+        }
+    }
+    return 0;
 }
 
 
 int main(int argc, char **argv){
+    if (argc >= 7 && string(argv[1]) == "sweep") {
+        return sweep(argc, argv);
+    }
     if (argc == 6) {
         THREAD_NUM = stol(argv[1]);
         TEST_TIME = stol(argv[2]);
@@ -92,10 +203,12 @@ int main(int argc, char **argv){
         WRITE_RATIO = stod(argv[5]);
     } else {
         printf("./kv_rw <thread_num>  <test_time> <test_num> <conflict_ratio> <write_ratio>\n");
+        printf("./kv_rw sweep <test_time> <test_num> <write_ratio> <threads,..> <conflict_ratio,..> [rw,tas,ticket,mcs,clh,cohort]\n");
         return 0;
     }
 
-    cout<<"thread_num "<<THREAD_NUM<<endl<<
+    cout<<"lock "<<RWLOCK_NAME<<endl<<
+        "thread_num "<<THREAD_NUM<<endl<<
         "test_time "<<TEST_TIME<<endl<<
         "test_num "<<TEST_NUM<<endl<<
         "conflict_ratio "<<CONFLICT_RATIO<<endl<<
@@ -109,42 +222,27 @@ int main(int argc, char **argv){
         kvlist[i].vp = tmp ;
     }
 
-    locks = new Lock[THREAD_NUM + 1];
-
     opvaluelist = new uint64_t *[TEST_NUM];
     for(size_t i = 0;i < TEST_NUM;i++){
         opvaluelist[i] = new uint64_t(i);
     }
 
-    g_value = 0;
-
     runtimelist = new uint64_t[THREAD_NUM]();
 
 
     srand(time(NULL));
     conflictlist = new bool[TEST_NUM];
     writelist = new bool[TEST_NUM];
-    for(size_t i = 0; i < TEST_NUM; i++ ){
-        conflictlist[i] = rand() * 1.0 / RAND_MAX * 100  < CONFLICT_RATIO;
-        writelist[i] = rand() *1.0 / RAND_MAX * 100 < WRITE_RATIO;
-    }
+    gen_oplist();
 
-    vector<thread> threads;
-    for(size_t i = 0; i < THREAD_NUM; i++){
-        threads.push_back(thread(concurrent_worker,i));
-    }
-    for(size_t i = 0; i < THREAD_NUM; i++){
-        threads[i].join();
-    }
-
-    double runtime = 0 , throughput = 0;
+    double throughput = run_test<Lock>();
+    double runtime = 0;
     for(size_t i = 0 ; i < THREAD_NUM; i++)
         runtime += runtimelist[i];
     runtime /= THREAD_NUM;
-    throughput = runner_count * 1.0 / runtime;
     cout<<"runner_count "<<runner_count<<endl;
     cout<<"g_value "<<g_value<<endl;
     cout<<"runtime "<<runtime / 1000000<<"s"<<endl;
     cout<<"***throughput "<<throughput<<endl<<endl;
 
-}
\ No newline at end of file
+}
@@ -0,0 +1,342 @@
+#ifndef RESEARCH_MUTEXES_H
+#define RESEARCH_MUTEXES_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "spin_wait.h"
+
+//Exclusive locks sharing lock() / unlock() / try_lock(), to compare with the
+//test-and-set spinlock of libcuckoo and the rwlocks.h locks under contention.
+//
+//  TasLock     test-and-test-and-set, the baseline
+//  TicketLock  FIFO, everyone spins on the now_serving word
+//  McsLock     FIFO queue, each waiter spins on its own node
+//  ClhLock     FIFO queue, each waiter spins on its predecessor's node
+//  CohortLock  C-TKT-MCS: ticket lock between NUMA nodes, MCS inside a node,
+//              the lock is handed within a node up to COHORT_PASS_LIMIT times
+//
+//MCS and CLH queue nodes come from a small per-thread pool, so a thread can
+//hold at most QNODE_POOL of them at once (enough for a bucket pair, not for a
+//lock_all over a whole table). The holder remembers its node in the lock, so
+//locks may be released in any order.
+//
+//Waiters go through SpinWait (spin_wait.h) on the word they wait for, and every
+//release is an exchange followed by spin_wake on that word, so a FIFO waiter that
+//parked is let in as soon as its turn comes instead of after its park times out.
+
+static const int QNODE_POOL = 16;
+
+class alignas(128) TasLock {
+public:
+    TasLock() : word(0) {}
+    TasLock(const TasLock &other) : word(0) {}
+
+    void lock() {
+        SpinWait w;
+        auto unlocked = [this]() { return !word.load(std::memory_order_relaxed); };
+        while (1) {
+            while (!unlocked()) w.wait(unlocked, &word);
+            if (!word.exchange(1, std::memory_order_acquire)) return;
+        }
+    }
+
+    bool try_lock() {
+        return !word.load(std::memory_order_relaxed) && !word.exchange(1, std::memory_order_acquire);
+    }
+
+    void unlock() {
+        word.exchange(0, std::memory_order_seq_cst);
+        spin_wake(&word);
+    }
+
+private:
+    std::atomic<int> word;
+};
+
+class alignas(128) TicketLock {
+public:
+    TicketLock() : next(0), serving(0) {}
+    TicketLock(const TicketLock &other) : next(0), serving(0) {}
+
+    void lock() {
+        uint32_t my = next.fetch_add(1, std::memory_order_relaxed);
+        spin_until([&]() { return serving.load(std::memory_order_acquire) == my; }, &serving);
+    }
+
+    bool try_lock() {
+        uint32_t s = serving.load(std::memory_order_acquire);
+        uint32_t n = s;
+        return next.compare_exchange_strong(n, s + 1, std::memory_order_acquire);
+    }
+
+    void unlock() {
+        serving.fetch_add(1, std::memory_order_seq_cst);
+        spin_wake(&serving);
+    }
+
+    //someone is queued behind the holder
+    bool has_waiters() {
+        return next.load(std::memory_order_relaxed) - serving.load(std::memory_order_relaxed) > 1;
+    }
+
+private:
+    std::atomic<uint32_t> next;
+    std::atomic<uint32_t> serving;
+};
+
+//per-thread pool of queue nodes, a set bit in used is a node some lock holds
+template<typename Node>
+struct QNodePool {
+    Node *nodes[QNODE_POOL];
+    uint32_t used = 0;
+
+    QNodePool() {
+        for (int i = 0; i < QNODE_POOL; i++) nodes[i] = new Node();
+    }
+
+    int get() {
+        for (int i = 0; i < QNODE_POOL; i++) {
+            if (!(used & (1u << i))) {
+                used |= 1u << i;
+                return i;
+            }
+        }
+        fprintf(stderr, "more than %d queue locks held by one thread\n", QNODE_POOL);
+        abort();
+    }
+
+    void put(int i) { used &= ~(1u << i); }
+};
+
+struct alignas(128) McsNode {
+    std::atomic<McsNode *> next;
+    std::atomic<bool> locked;
+};
+
+class alignas(128) McsLock {
+public:
+    McsLock() : tail(nullptr), holder(nullptr), holder_slot(-1) {}
+    McsLock(const McsLock &other) : tail(nullptr), holder(nullptr), holder_slot(-1) {}
+
+    void lock() {
+        QNodePool<McsNode> &p = pool();
+        int slot = p.get();
+        McsNode *me = p.nodes[slot];
+        me->next.store(nullptr, std::memory_order_relaxed);
+        me->locked.store(true, std::memory_order_relaxed);
+        McsNode *pred = tail.exchange(me, std::memory_order_acq_rel);
+        if (pred) {
+            pred->next.store(me, std::memory_order_release);
+            spin_until([me]() { return !me->locked.load(std::memory_order_acquire); }, &me->locked);
+        }
+        holder = me;
+        holder_slot = slot;
+    }
+
+    bool try_lock() {
+        if (tail.load(std::memory_order_relaxed)) return false;
+        QNodePool<McsNode> &p = pool();
+        int slot = p.get();
+        McsNode *me = p.nodes[slot];
+        me->next.store(nullptr, std::memory_order_relaxed);
+        McsNode *expected = nullptr;
+        if (!tail.compare_exchange_strong(expected, me, std::memory_order_acq_rel)) {
+            p.put(slot);
+            return false;
+        }
+        holder = me;
+        holder_slot = slot;
+        return true;
+    }
+
+    void unlock() {
+        McsNode *me = holder;
+        int slot = holder_slot;
+        McsNode *succ = me->next.load(std::memory_order_acquire);
+        if (!succ) {
+            McsNode *expected = me;
+            if (tail.compare_exchange_strong(expected, nullptr, std::memory_order_acq_rel)) {
+                pool().put(slot);
+                return;
+            }
+            //a successor swapped the tail but has not linked itself yet, a matter of
+            //a few instructions unless it got descheduled
+            SpinWait w;
+            while (!(succ = me->next.load(std::memory_order_acquire))) w.wait();
+        }
+        succ->locked.exchange(false, std::memory_order_seq_cst);
+        spin_wake(&succ->locked);
+        pool().put(slot);
+    }
+
+    //called by the holder: somebody queued behind it
+    bool has_waiters() {
+        return holder->next.load(std::memory_order_relaxed) || tail.load(std::memory_order_relaxed) != holder;
+    }
+
+private:
+    static QNodePool<McsNode> &pool() {
+        static thread_local QNodePool<McsNode> p;
+        return p;
+    }
+
+    std::atomic<McsNode *> tail;
+    McsNode *holder; // written and read only by the lock holder
+    int holder_slot;
+};
+
+struct alignas(128) ClhNode {
+    std::atomic<bool> locked;
+};
+
+//Nodes travel between threads: after unlock the releaser keeps its
+//predecessor's node and leaves its own to the successor. A lock owns one
+//dummy node at any time, leaked with the lock.
+//
+//The tail word is the tail node in the low 48 bits and a count of enqueues
+//above them, bumped by every enqueue. try_lock CASes the very word it saw
+//released, so a node that was released, queued again and is the tail once more
+//(ABA) fails the CAS instead of enqueueing behind a holder it cannot back out
+//from. Only 65536 enqueues between its load and its CAS would fool it.
+class alignas(128) ClhLock {
+public:
+    ClhLock() : tail((uint64_t) new ClhNode()), holder_slot(-1), holder_pred(nullptr) {
+        node_of(tail.load())->locked.store(false);
+    }
+
+    ClhLock(const ClhLock &other) : ClhLock() {}
+
+    void lock() {
+        QNodePool<ClhNode> &p = pool();
+        int slot = p.get();
+        ClhNode *me = p.nodes[slot];
+        me->locked.store(true, std::memory_order_relaxed);
+        //a CAS loop instead of the swap, the count has to move with the node
+        uint64_t t = tail.load(std::memory_order_relaxed);
+        while (!tail.compare_exchange_weak(t, next_tail(t, me), std::memory_order_acq_rel));
+        ClhNode *pred = node_of(t);
+        spin_until([pred]() { return !pred->locked.load(std::memory_order_acquire); }, &pred->locked);
+        holder_slot = slot;
+        holder_pred = pred;
+    }
+
+    bool try_lock() {
+        uint64_t t = tail.load(std::memory_order_acquire);
+        if (node_of(t)->locked.load(std::memory_order_acquire)) return false;
+        QNodePool<ClhNode> &p = pool();
+        int slot = p.get();
+        ClhNode *me = p.nodes[slot];
+        me->locked.store(true, std::memory_order_relaxed);
+        if (!tail.compare_exchange_strong(t, next_tail(t, me), std::memory_order_acq_rel)) {
+            p.put(slot);
+            return false;
+        }
+        //nobody enqueued since the check, so the predecessor is still released
+        holder_slot = slot;
+        holder_pred = node_of(t);
+        return true;
+    }
+
+    void unlock() {
+        QNodePool<ClhNode> &p = pool();
+        int slot = holder_slot;
+        ClhNode *me = p.nodes[slot];
+        p.nodes[slot] = holder_pred;
+        me->locked.exchange(false, std::memory_order_seq_cst);
+        //the successor may already have moved on with the node, a stray wake is harmless
+        spin_wake(&me->locked);
+        p.put(slot);
+    }
+
+private:
+    static const int COUNT_SHIFT = 48;
+
+    static QNodePool<ClhNode> &pool() {
+        static thread_local QNodePool<ClhNode> p;
+        return p;
+    }
+
+    static ClhNode *node_of(uint64_t t) { return (ClhNode *) (t & ((1ull << COUNT_SHIFT) - 1)); }
+
+    static uint64_t next_tail(uint64_t t, ClhNode *me) {
+        return ((t >> COUNT_SHIFT) + 1) << COUNT_SHIFT | (uint64_t) me;
+    }
+
+    std::atomic<uint64_t> tail;
+    int holder_slot;       // pool slot of the holder's node
+    ClhNode *holder_pred;  // becomes the holder's node on unlock
+};
+
+//NUMA node of the calling thread, looked up once per thread
+inline int current_numa_node() {
+    static thread_local int node = -1;
+    if (node < 0) {
+        unsigned cpu = 0, n = 0;
+        node = syscall(SYS_getcpu, &cpu, &n, nullptr) == 0 ? (int) n : 0;
+    }
+    return node;
+}
+
+//Cohort lock (Dice, Marathe, Shavit, PPoPP'12). A thread first takes the
+//MCS lock of its node. The first of a cohort then takes the global ticket
+//lock, which is thread-oblivious, so a releaser with local waiters can leave
+//it held and pass it to the next thread of its node. Passing stops after
+//COHORT_PASS_LIMIT handoffs so other nodes are not starved.
+class alignas(128) CohortLock {
+public:
+    static const int MAX_NODES = 8;
+    static const int COHORT_PASS_LIMIT = 64;
+
+    CohortLock() : holder_node(0) {}
+    CohortLock(const CohortLock &other) : holder_node(0) {}
+
+    void lock() {
+        int node = current_numa_node() % MAX_NODES;
+        Local &l = locals[node];
+        l.mcs.lock();
+        if (!l.global_passed) global.lock();
+        holder_node = node;
+    }
+
+    bool try_lock() {
+        int node = current_numa_node() % MAX_NODES;
+        Local &l = locals[node];
+        if (!l.mcs.try_lock()) return false;
+        if (!l.global_passed && !global.try_lock()) {
+            l.mcs.unlock();
+            return false;
+        }
+        holder_node = node;
+        return true;
+    }
+
+    void unlock() {
+        Local &l = locals[holder_node];
+        if (l.mcs.has_waiters() && l.passes < COHORT_PASS_LIMIT) {
+            l.passes++;
+            l.global_passed = true;
+        } else {
+            l.passes = 0;
+            l.global_passed = false;
+            global.unlock();
+        }
+        l.mcs.unlock();
+    }
+
+private:
+    struct alignas(128) Local {
+        McsLock mcs;
+        bool global_passed = false; // the next local holder already owns global
+        int passes = 0;
+    };
+
+    TicketLock global;
+    Local locals[MAX_NODES];
+    int holder_node;
+};
+
+#endif //RESEARCH_MUTEXES_H
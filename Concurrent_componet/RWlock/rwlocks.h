@@ -1,9 +1,44 @@
 //#define WRITERS_FAVOR_RWLOCK
-#define READERS_FAVOR_RWLOCK
+//#define READERS_FAVOR_RWLOCK
 //#define PTHREAD_RWLOCK
+//#define BIG_READER_RWLOCK
+//#define BRAVO_RWLOCK
+
+//readers favor is the default, a build can pick another one with -D
+#if !defined(WRITERS_FAVOR_RWLOCK) && !defined(READERS_FAVOR_RWLOCK) && !defined(PTHREAD_RWLOCK) && \
+    !defined(BIG_READER_RWLOCK) && !defined(BRAVO_RWLOCK)
+#define READERS_FAVOR_RWLOCK
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <pthread.h>
+#include "spin_wait.h"
+
+//small dense ids of the calling threads, for the per-thread reader slots
+inline std::atomic<int> &rwlock_thread_count() {
+    static std::atomic<int> count(0);
+    return count;
+}
+
+inline int rwlock_thread_id() {
+    static thread_local int id = rwlock_thread_count().fetch_add(1);
+    return id;
+}
+
+//waits until no bit of mask is set in the lock word; whoever clears bits calls
+//rwlock_wake right after, so a waiter that went to sleep (spin_wait.h) is let in
+inline void rwlock_wait_clear(volatile long long &word, long long mask) {
+    spin_until([&]() { return !(word & mask); }, &word);
+}
+
+inline void rwlock_wake(volatile long long &word) { spin_wake(&word); }
 
 
 #ifdef WRITERS_FAVOR_RWLOCK
+#define RWLOCK_NAME "writers_favor"
 class alignas(128) Lock  {
 public:
     Lock() : rwlock(0){}
@@ -22,33 +57,38 @@ public:
 
     void wLock() noexcept {
         //printf("%lu try lock write %lu:%lld\n",pthread_self()%1000,(uint64_t)(&rwlock)%1000,rwlock);
-        while(isWriteLocked());
+        rwlock_wait_clear(rwlock, 1);
         while (1) {
             long long v = rwlock;
             if (__sync_bool_compare_and_swap(&rwlock, v & ~1, v | 1)) {
-                while (v & ~1) { // while there are still readers
-                    v = rwlock;
-                }
+                rwlock_wait_clear(rwlock, ~1ll); // while there are still readers
                 return;
             }
         }
     }
 
+    //no readers and no writer right now, or false without waiting
+    bool try_write_lock() noexcept {
+        return !rwlock && __sync_bool_compare_and_swap(&rwlock, 0, 1);
+    }
+
     void rLock(){
         //printf("--------------------------%lu try lock read %lu:%lld\n",pthread_self()%1000,(uint64_t)(&rwlock)%1000,rwlock);
         while (1) {
-            while (isWriteLocked()) {}
+            rwlock_wait_clear(rwlock, 1);
             if ((__sync_add_and_fetch(&rwlock, 2) & 1) == 0) return; // when we tentatively read-locked, there was no writer
             __sync_add_and_fetch(&rwlock, -2); // release our tentative read-lock
+            rwlock_wake(rwlock);
         }
     }
 
     void rLock_1(){
         //printf("--------------------------%lu try lock read %lu:%lld\n",pthread_self()%1000,(uint64_t)(&rwlock)%1000,rwlock);
         while (1) {
-            while (isWriteLocked()) {}
+            rwlock_wait_clear(rwlock, 1);
             if ((__sync_add_and_fetch(&rwlock, 2) & 1) == 0) return; // when we tentatively read-locked, there was no writer
             __sync_add_and_fetch(&rwlock, -2); // release our tentative read-lock
+            rwlock_wake(rwlock);
         }
     }
 
@@ -56,9 +96,7 @@ public:
         long long v = rwlock;
         if (__sync_bool_compare_and_swap(&rwlock, v & ~1, v | 1)) {
             __sync_add_and_fetch(&rwlock, -2);
-            while (v & ~1) { // while there are still readers
-                v = rwlock;
-            }
+            rwlock_wait_clear(rwlock, ~1ll); // while there are still readers
             return true;
         }
         return false;
@@ -70,10 +108,12 @@ public:
 
     void rUnlock() noexcept{
         __sync_add_and_fetch(&rwlock, -2);
+        rwlock_wake(rwlock);
     }
 
     void wUnlock() noexcept{
         __sync_add_and_fetch(&rwlock, -1);
+        rwlock_wake(rwlock);
     }
 
 //private:
@@ -82,6 +122,7 @@ public:
 #endif
 
 #ifdef READERS_FAVOR_RWLOCK
+#define RWLOCK_NAME "readers_favor"
 class alignas(128) Lock  {
 public:
     Lock() : rwlock(0){}
@@ -104,27 +145,33 @@ public:
 
     void wLock() noexcept {
         while (1) {
-            while (isLocked()) {}
+            rwlock_wait_clear(rwlock, -1);
             if (__sync_bool_compare_and_swap(&rwlock, 0, 1)) {
                 return;
             }
         }
     }
 
+    //no readers, upgrader or writer right now, or false without waiting
+    bool try_write_lock() noexcept {
+        return !rwlock && __sync_bool_compare_and_swap(&rwlock, 0, 1);
+    }
+
     void wUnlock() noexcept{
         __sync_add_and_fetch(&rwlock, -1);
+        rwlock_wake(rwlock);
     }
 
     void rLock(){
         __sync_add_and_fetch(&rwlock, 4);
-        while (isWriteLocked());
+        rwlock_wait_clear(rwlock, 1);
         return;
     }
 
     void rLock_1(){
-        while(isUpgraeding());
+        rwlock_wait_clear(rwlock, 2);
         __sync_add_and_fetch(&rwlock, 4);
-        while (isWriteLocked());
+        rwlock_wait_clear(rwlock, 1);
         return;
     }
 
@@ -137,8 +184,9 @@ public:
             if (seenval == expval) { // cas success
                 // cas to writer
                 while (1) {
-                    while (rwlock & ~2 /* locked by someone else */) {}
+                    rwlock_wait_clear(rwlock, ~2ll); // locked by someone else
                     if (__sync_bool_compare_and_swap(&rwlock, 2, 1)) {
+                        rwlock_wake(rwlock); // rLock_1 waits for the upgrader bit
                         return true;
                     }
                 }
@@ -148,10 +196,12 @@ public:
 
     void degradeLock(){
         __sync_fetch_and_add(&rwlock, 3);
+        rwlock_wake(rwlock);
     }
 
     void rUnlock() noexcept{
         __sync_add_and_fetch(&rwlock, -4);
+        rwlock_wake(rwlock);
     }
 
 //private:
@@ -160,6 +210,7 @@ public:
 #endif
 
 #ifdef PTHREAD_RWLOCK
+#define RWLOCK_NAME "pthread"
 class alignas(128) Lock  {
 public:
     Lock()  {
@@ -179,6 +230,9 @@ public:
     inline void wLock() {
         pthread_rwlock_wrlock(&rwlock) ;
     }
+    inline bool try_write_lock() {
+        return pthread_rwlock_trywrlock(&rwlock) == 0;
+    }
     inline void wUnlock() {
         pthread_rwlock_unlock(&rwlock) ;
     }
@@ -188,3 +242,252 @@ public:
 };
 #endif
 
+#ifdef BIG_READER_RWLOCK
+#define RWLOCK_NAME "big_reader"
+//Big-reader lock: every lock has READER_SLOTS padded reader counters and a thread
+//only touches the one of its id, so readers never share a cache line (threads
+//beyond READER_SLOTS share slots, which is still correct). Writers take the writer
+//word and then wait for every slot to drain, so a write costs a scan of all slots.
+class alignas(128) Lock  {
+public:
+    static const int READER_SLOTS = 64;
+
+    Lock() : writer(0){
+        for (int i = 0; i < READER_SLOTS; i++) slots[i].readers = 0;
+    }
+    Lock(const Lock & other) : Lock(){}
+
+    inline bool isWriteLocked() {
+        return writer;
+    }
+    inline bool isReadLocked() {
+        for (int i = 0; i < READER_SLOTS; i++)
+            if (slots[i].readers) return true;
+        return false;
+    }
+
+    inline bool isLocked() {
+        return isWriteLocked() || isReadLocked();
+    }
+
+    void wLock() noexcept {
+        while (1) {
+            rwlock_wait_clear(writer, -1);
+            if (__sync_bool_compare_and_swap(&writer, 0, 1)) break;
+        }
+        waitReaders(-1);
+    }
+
+    void wUnlock() noexcept{
+        __atomic_exchange_n(&writer, 0, __ATOMIC_SEQ_CST); // locked, see spin_wake
+        rwlock_wake(writer);
+    }
+
+    //takes the writer word only to look at the slots, a reader in any of them
+    //makes it back out instead of waiting
+    bool try_write_lock() noexcept {
+        if (writer || !__sync_bool_compare_and_swap(&writer, 0, 1)) return false;
+        if (!isReadLocked()) return true;
+        wUnlock();
+        return false;
+    }
+
+    void rLock(){
+        Slot &s = mySlot();
+        while (1) {
+            rwlock_wait_clear(writer, -1);
+            __sync_add_and_fetch(&s.readers, 1); // full barrier before we look at the writer again
+            if (!isWriteLocked()) return;
+            __sync_add_and_fetch(&s.readers, -1);
+            rwlock_wake(s.readers);
+        }
+    }
+
+    void rUnlock() noexcept{
+        Slot &s = mySlot();
+        __sync_add_and_fetch(&s.readers, -1);
+        rwlock_wake(s.readers);
+    }
+
+    //fails if another writer or upgrader got in first, the read lock is then still held
+    inline bool try_upgradeLock() {
+        if (!__sync_bool_compare_and_swap(&writer, 0, 1)) return false;
+        __sync_add_and_fetch(&mySlot().readers, -1);
+        waitReaders(-1);
+        return true;
+    }
+
+    void degradeLock(){
+        __sync_add_and_fetch(&mySlot().readers, 1);
+        __atomic_exchange_n(&writer, 0, __ATOMIC_SEQ_CST);
+        rwlock_wake(writer);
+    }
+
+private:
+    struct alignas(128) Slot {
+        volatile long long readers;
+    };
+
+    inline Slot &mySlot() {
+        return slots[rwlock_thread_id() % READER_SLOTS];
+    }
+
+    inline void waitReaders(int skip) {
+        for (int i = 0; i < READER_SLOTS; i++) {
+            if (i == skip) continue;
+            rwlock_wait_clear(slots[i].readers, -1);
+        }
+    }
+
+    Slot slots[READER_SLOTS];
+    volatile long long writer;
+};
+#endif
+
+#ifdef BRAVO_RWLOCK
+#define RWLOCK_NAME "bravo"
+//BRAVO (Dice and Kogan, ATC'19) over the writers favor lock. While a lock is read
+//biased, a reader publishes the lock's address in its own padded row of a global
+//visible readers table and never touches the lock word. A writer first takes the
+//underlying lock, then revokes the bias and waits until no row holds the lock.
+//Revocation is a scan of the rows handed out so far, so the bias stays off for
+//BRAVO_INHIBIT_MULT times the last revocation, and a slow path reader turns it
+//back on once that window passed. Threads beyond BRAVO_MAX_THREADS always use the
+//slow path. No upgrade / degrade: a biased reader holds nothing to upgrade.
+static const int BRAVO_MAX_THREADS = 256;
+static const int BRAVO_ROW_SLOTS = 8; // read locks one thread can hold biased at once
+static const uint64_t BRAVO_INHIBIT_MULT = 9;
+
+struct alignas(128) BravoRow {
+    void *volatile slot[BRAVO_ROW_SLOTS];
+};
+
+inline BravoRow *bravo_table() {
+    static BravoRow rows[BRAVO_MAX_THREADS];
+    return rows;
+}
+
+inline uint64_t bravo_now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+class alignas(128) Lock  {
+public:
+    Lock() : rwlock(0), rbias(true), inhibit_until(0){}
+    Lock(const Lock & other) : Lock(){}
+
+    inline bool isWriteLocked() {
+        return rwlock & 1;
+    }
+    inline bool isReadLocked() {
+        return rwlock & ~1;
+    }
+
+    inline bool isLocked() {
+        return rwlock;
+    }
+
+    void wLock() noexcept {
+        rwlock_wait_clear(rwlock, 1);
+        while (1) {
+            long long v = rwlock;
+            if (__sync_bool_compare_and_swap(&rwlock, v & ~1, v | 1)) {
+                rwlock_wait_clear(rwlock, ~1ll); // while there are still readers
+                break;
+            }
+        }
+        if (rbias) revoke();
+    }
+
+    void wUnlock() noexcept{
+        __sync_add_and_fetch(&rwlock, -1);
+        rwlock_wake(rwlock);
+    }
+
+    //Like wLock, but a biased reader found by the revocation makes it back out
+    //instead of waiting. The bias stays off, a slow path reader turns it on again.
+    bool try_write_lock() noexcept {
+        if (rwlock || !__sync_bool_compare_and_swap(&rwlock, 0, 1)) return false;
+        if (rbias && !try_revoke()) {
+            wUnlock();
+            return false;
+        }
+        return true;
+    }
+
+    void rLock(){
+        if (rbias) {
+            int tid = rwlock_thread_id();
+            if (tid < BRAVO_MAX_THREADS) {
+                BravoRow &row = bravo_table()[tid];
+                for (int i = 0; i < BRAVO_ROW_SLOTS; i++) {
+                    if (row.slot[i]) continue;
+                    __atomic_store_n(&row.slot[i], (void *) this, __ATOMIC_SEQ_CST);
+                    if (__atomic_load_n(&rbias, __ATOMIC_SEQ_CST)) return;
+                    // a writer is revoking, back off to the lock word
+                    __atomic_store_n(&row.slot[i], (void *) nullptr, __ATOMIC_RELEASE);
+                    break;
+                }
+            }
+        }
+        while (1) {
+            rwlock_wait_clear(rwlock, 1);
+            if ((__sync_add_and_fetch(&rwlock, 2) & 1) == 0) break;
+            __sync_add_and_fetch(&rwlock, -2);
+            rwlock_wake(rwlock);
+        }
+        // holding the read lock keeps writers out, so it is safe to bias again
+        if (!rbias && bravo_now() >= inhibit_until) rbias = true;
+    }
+
+    void rUnlock() noexcept{
+        int tid = rwlock_thread_id();
+        if (tid < BRAVO_MAX_THREADS) {
+            BravoRow &row = bravo_table()[tid];
+            for (int i = 0; i < BRAVO_ROW_SLOTS; i++) {
+                if (row.slot[i] == this) {
+                    __atomic_store_n(&row.slot[i], (void *) nullptr, __ATOMIC_RELEASE);
+                    return;
+                }
+            }
+        }
+        __sync_add_and_fetch(&rwlock, -2);
+        rwlock_wake(rwlock);
+    }
+
+//private:
+    volatile long long rwlock;
+    volatile bool rbias;
+    uint64_t inhibit_until;
+
+private:
+    //false if a biased reader still holds the lock
+    bool try_revoke() {
+        __atomic_store_n(&rbias, false, __ATOMIC_SEQ_CST);
+        BravoRow *rows = bravo_table();
+        int threads = std::min(rwlock_thread_count().load(), BRAVO_MAX_THREADS);
+        for (int t = 0; t < threads; t++)
+            for (int i = 0; i < BRAVO_ROW_SLOTS; i++)
+                if (__atomic_load_n(&rows[t].slot[i], __ATOMIC_ACQUIRE) == this) return false;
+        return true;
+    }
+
+    void revoke() {
+        uint64_t start = bravo_now();
+        __atomic_store_n(&rbias, false, __ATOMIC_SEQ_CST);
+        BravoRow *rows = bravo_table();
+        // a thread that gets its id after this load publishes after rbias went false
+        int threads = std::min(rwlock_thread_count().load(), BRAVO_MAX_THREADS);
+        for (int t = 0; t < threads; t++) {
+            for (int i = 0; i < BRAVO_ROW_SLOTS; i++) {
+                // biased unlocks stay a plain store and never wake, the park times out
+                spin_until([&]() { return __atomic_load_n(&rows[t].slot[i], __ATOMIC_ACQUIRE) != this; },
+                           &rows[t].slot[i]);
+            }
+        }
+        uint64_t now = bravo_now();
+        inhibit_until = now + (now - start) * BRAVO_INHIBIT_MULT;
+    }
+};
+#endif
@@ -0,0 +1,194 @@
+#ifndef RESEARCH_SPIN_WAIT_H
+#define RESEARCH_SPIN_WAIT_H
+
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <ctime>
+#include <sched.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+//Waiting for another thread to change something, shared by the spin loops of the
+//locks and maps. A SpinWait gets more patient round by round:
+//  pause      1, 2, 4 .. SPIN_WAIT_MAX_PAUSE pause instructions
+//  yield      SPIN_WAIT_YIELDS rounds of sched_yield, a descheduled holder can run
+//  park       futex wait on the word the caller waits on, at most SPIN_WAIT_PARK_NS
+//             per round, or a plain sleep of that long when there is no such word
+//
+//A releaser that wants parked waiters up at once calls spin_wake on the word after
+//changing it. The park is bounded, so a word some writers never wake for (or a
+//wake that raced the park) only costs one SPIN_WAIT_PARK_NS. Words are found by
+//byte address and parking uses the aligned 32 bit word holding that byte (x86 is
+//little endian: for a 64 bit word pass the byte of the bit that changes, see
+//spin_byte_of).
+//
+//With SPIN_WAIT_RAW defined every wait is a bare busy loop, to measure against.
+//
+//WaitGate and QuiescenceBarrier wake on every change, their waiters sleep until
+//woken instead of in bounded rounds.
+
+#define SPIN_PAUSE() asm volatile("pause" ::: "memory")
+
+static const uint32_t SPIN_WAIT_MAX_PAUSE = 1024;
+static const uint32_t SPIN_WAIT_YIELDS = 16;
+static const long SPIN_WAIT_PARK_NS = 200 * 1000;
+static const int SPIN_WAIT_STRIPES = 64;
+
+//number of parked threads per hash of the futex word, lets a waker skip the syscall
+struct alignas(128) SpinWaitStripe {
+    std::atomic<int> parked;
+};
+
+inline SpinWaitStripe &spin_wait_stripe(const volatile uint32_t *word) {
+    static SpinWaitStripe stripes[SPIN_WAIT_STRIPES];
+    return stripes[((uintptr_t) word >> 2) % SPIN_WAIT_STRIPES];
+}
+
+inline volatile uint32_t *spin_futex_word(const volatile void *p) {
+    return (volatile uint32_t *) ((uintptr_t) p & ~(uintptr_t) 3);
+}
+
+//byte of a multi byte word that holds the lowest bit of mask
+inline const volatile void *spin_byte_of(const volatile void *word, uint64_t mask) {
+    return (const volatile char *) word + __builtin_ctzll(mask) / 8;
+}
+
+//Wakes the threads parked on the word at p. Call it after the store that ends the
+//wait; the store has to be a locked RMW (any __sync / CAS / exchange), a plain
+//release store needs a seq_cst fence in between.
+inline void spin_wake(const volatile void *p) {
+#ifndef SPIN_WAIT_RAW
+    volatile uint32_t *word = spin_futex_word(p);
+    if (spin_wait_stripe(word).parked.load(std::memory_order_seq_cst))
+        syscall(SYS_futex, (uint32_t *) word, FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+#endif
+}
+
+class SpinWait {
+public:
+    //woken: every change of the word that ends the wait is followed by spin_wake,
+    //then parks need no timeout (WaitGate and QuiescenceBarrier below)
+    explicit SpinWait(bool woken = false) : woken(woken) {}
+
+    //One round of waiting. done() is checked again right before parking, so a
+    //change between the caller's check and the park is not slept through.
+    template<typename Done>
+    void wait(Done done, const volatile void *p = nullptr) {
+#ifndef SPIN_WAIT_RAW
+        if (spins <= SPIN_WAIT_MAX_PAUSE) {
+            for (uint32_t i = 0; i < spins; i++) SPIN_PAUSE();
+            spins <<= 1;
+            return;
+        }
+        if (yields < SPIN_WAIT_YIELDS) {
+            yields++;
+            sched_yield();
+            return;
+        }
+        park(done, p);
+#endif
+    }
+
+    void wait() { wait([]() { return false; }); }
+
+    void reset() {
+        spins = 1;
+        yields = 0;
+    }
+
+private:
+    template<typename Done>
+    void park(Done done, const volatile void *p) {
+        struct timespec ts = {0, SPIN_WAIT_PARK_NS};
+        if (p == nullptr) {
+            nanosleep(&ts, nullptr);
+            return;
+        }
+        volatile uint32_t *word = spin_futex_word(p);
+        SpinWaitStripe &s = spin_wait_stripe(word);
+        s.parked.fetch_add(1, std::memory_order_seq_cst);
+        uint32_t seen = *word;
+        //returns at once if the word moved since seen
+        if (!done()) syscall(SYS_futex, (uint32_t *) word, FUTEX_WAIT_PRIVATE, seen, woken ? nullptr : &ts, nullptr, 0);
+        s.parked.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    uint32_t spins = 1;
+    uint32_t yields = 0;
+    bool woken;
+};
+
+//waits until done(), p as for SpinWait::wait
+template<typename Done>
+inline void spin_until(Done done, const volatile void *p = nullptr) {
+    if (done()) return;
+    SpinWait w;
+    do w.wait(done, p); while (!done());
+}
+
+//A gate one thread closes for a while (a rehash, a snapshot) and the others wait
+//at. Waiters spin for a moment and then sleep until open() wakes them.
+class WaitGate {
+public:
+    WaitGate() : closed(0) {}
+
+    bool is_closed() const { return closed.load(); }
+
+    bool try_close() {
+        uint32_t open_v = 0;
+        return closed.compare_exchange_strong(open_v, 1);
+    }
+
+    //waits for the gate to open and closes it
+    void close() {
+        while (!try_close()) wait_open();
+    }
+
+    void open() {
+        closed.exchange(0);
+        spin_wake(&closed);
+    }
+
+    void wait_open() const {
+        SpinWait w(true);
+        auto is_open = [this]() { return !closed.load(); };
+        while (!is_open()) w.wait(is_open, &closed);
+    }
+
+private:
+    std::atomic<uint32_t> closed;
+};
+
+//Counts the participants one thread waits for. The waiter begin()s, add()s one per
+//participant it found, then wait()s; each counted participant calls arrive() once
+//when done and the last one wakes the waiter. The waiter holds a count of its own
+//until wait(), so the barrier cannot complete while participants are still added.
+class QuiescenceBarrier {
+public:
+    QuiescenceBarrier() : pending(0) {}
+
+    void begin() { pending.store(1); }
+
+    void add() { pending.fetch_add(1); }
+
+    //undo an add() whose participant turned out to be gone already
+    void remove() { pending.fetch_sub(1); }
+
+    void arrive() {
+        if (pending.fetch_sub(1) == 1) spin_wake(&pending);
+    }
+
+    void wait() {
+        arrive();
+        SpinWait w(true);
+        auto done = [this]() { return pending.load() == 0; };
+        while (!done()) w.wait(done, &pending);
+    }
+
+private:
+    std::atomic<uint32_t> pending;
+};
+
+#endif //RESEARCH_SPIN_WAIT_H
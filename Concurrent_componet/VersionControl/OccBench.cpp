@@ -0,0 +1,243 @@
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include "tracer.h"
+#include "occ.h"
+#include "../RWlock/rwlocks.h"
+#include "../MSQ/MichaelScottQueue.h"
+
+using namespace std;
+
+//Same workload as VersionControl / RWLockTest / kv_rw (THREAD_NUM + 1 objects, a
+//conflicting op goes to the shared last one, otherwise to the thread's own), run
+//once per synchronization method:
+//  occ  value guarded by an AtomicGenLock through occ.h; relocate_ratio percent of
+//       the writes move the value to the object's other copy and mark the old
+//       one replaced
+//  rw   value guarded by the rwlocks.h Lock
+//  msq  every write enqueues a new version, readers read the tail (kv_rw), the
+//       oldest version is dequeued so the queue stays short
+
+static int THREAD_NUM;
+static int TEST_NUM;
+static int TEST_TIME;
+static double CONFLICT_RATIO;
+static double WRITE_RATIO;
+static double RELOCATE_RATIO = 0;
+
+static const uint64_t key_demo = 12345678;
+
+uint64_t **opvaluelist;
+
+bool *conflictlist;
+bool *writelist;
+bool *relocatelist;
+uint64_t *runtimelist;
+
+atomic<int> stopMeasure(0);
+uint64_t runner_count;
+uint64_t g_value;
+uint64_t relocations;
+
+struct OccCopy {
+    AtomicGenLock lock;
+    uint64_t value;
+};
+
+struct alignas(128) OccKV {
+    uint64_t key;
+    std::atomic<int> cur; // copies[cur] is live, the other one is replaced
+    OccCopy copies[2];
+
+    OccKV() : key(key_demo), cur(0) {
+        copies[0].value = copies[1].value = 0;
+        GenLock dead;
+        dead.replaced = 1;
+        copies[1].lock.store(dead);
+    }
+
+    uint64_t read() {
+        uint64_t v = 0;
+        while (true) {
+            OccCopy &c = copies[cur.load()];
+            if (read_optimistic(c.lock, [&]() { v = c.value; }) == OCC_OK) return v;
+        }
+    }
+
+    //true if it relocated
+    bool write(uint64_t v, bool relocate) {
+        while (true) {
+            int k = cur.load();
+            OccCopy &c = copies[k];
+            if (occ_lock(c.lock) == OCC_REPLACED) continue;
+            if (!relocate) {
+                c.value = v;
+                occ_unlock(c.lock);
+                return false;
+            }
+            OccCopy &n = copies[k ^ 1];
+            occ_revive_locked(n.lock);
+            n.value = v;
+            cur.store(k ^ 1);
+            occ_unlock_replaced(c.lock);
+            occ_unlock(n.lock);
+            return true;
+        }
+    }
+};
+
+struct alignas(128) RwKV {
+    uint64_t key = key_demo;
+    Lock lock;
+    uint64_t value = 0;
+
+    uint64_t read() {
+        lock.rLock();
+        uint64_t v = value;
+        lock.rUnlock();
+        return v;
+    }
+
+    bool write(uint64_t v, bool) {
+        lock.wLock();
+        value = v;
+        lock.wUnlock();
+        return false;
+    }
+};
+
+struct alignas(128) MsqKV {
+    uint64_t key = key_demo;
+    MichaelScottQueue<uint64_t> value_queue{THREAD_NUM}; // hazard pointer scans cover only our threads
+
+    MsqKV() { value_queue.enqueue(opvaluelist[0], 0); }
+
+    uint64_t read(int tid) {
+        uint64_t v = 0;
+        value_queue.get_tail_item_l(v, tid);
+        return v;
+    }
+
+    bool write(uint64_t *vp, int tid) {
+        value_queue.enqueue(vp, tid);
+        value_queue.dequeue(tid);
+        return false;
+    }
+};
+
+template<typename KV>
+uint64_t kv_read(KV &kv, int tid) { return kv.read(); }
+
+uint64_t kv_read(MsqKV &kv, int tid) { return kv.read(tid); }
+
+template<typename KV>
+bool kv_write(KV &kv, size_t i, int tid) { return kv.write(*opvaluelist[i], relocatelist[i]); }
+
+bool kv_write(MsqKV &kv, size_t i, int tid) { return kv.write(opvaluelist[i], tid); }
+
+template<typename KV>
+void concurrent_worker(int tid, KV *kvlist) {
+    uint64_t l_value = 0, l_reloc = 0;
+    int index = 0;
+    Tracer t;
+    t.startTime();
+    while (stopMeasure.load(memory_order_relaxed) == 0) {
+        for (size_t i = 0; i < TEST_NUM; i++) {
+            index = conflictlist[i] ? THREAD_NUM : tid;
+            if (writelist[i]) {
+                l_reloc += kv_write(kvlist[index], i, tid);
+            } else {
+                l_value += kv_read(kvlist[index], tid);
+            }
+        }
+
+        __sync_fetch_and_add(&runner_count, TEST_NUM);
+        uint64_t tmptruntime = t.fetchTime();
+        if (tmptruntime / 1000000 >= TEST_TIME) {
+            stopMeasure.store(1, memory_order_relaxed);
+        }
+    }
+    runtimelist[tid] = t.getRunTime();
+    __sync_fetch_and_add(&g_value, l_value);
+    __sync_fetch_and_add(&relocations, l_reloc);
+}
+
+template<typename KV>
+double run_test() {
+    KV *kvlist = new KV[THREAD_NUM + 1];
+    stopMeasure.store(0);
+    runner_count = 0;
+    g_value = 0;
+    relocations = 0;
+
+    vector<thread> threads;
+    for (size_t i = 0; i < THREAD_NUM; i++) {
+        threads.push_back(thread(concurrent_worker<KV>, i, kvlist));
+    }
+    for (size_t i = 0; i < THREAD_NUM; i++) {
+        threads[i].join();
+    }
+    delete[] kvlist;
+
+    double runtime = 0;
+    for (size_t i = 0; i < THREAD_NUM; i++)
+        runtime += runtimelist[i];
+    runtime /= THREAD_NUM;
+    return runner_count * 1.0 / runtime;
+}
+
+int main(int argc, char **argv) {
+    if (argc >= 6) {
+        THREAD_NUM = stol(argv[1]);
+        TEST_TIME = stol(argv[2]);
+        TEST_NUM = stol(argv[3]);
+        CONFLICT_RATIO = stod(argv[4]);
+        WRITE_RATIO = stod(argv[5]);
+    } else {
+        printf("./OccBench <thread_num> <test_time> <test_num> <conflict_ratio> <write_ratio> [occ,rw,msq] [relocate_ratio]\n");
+        return 0;
+    }
+    string methods = argc > 6 ? argv[6] : "occ,rw,msq";
+    if (argc > 7) RELOCATE_RATIO = stod(argv[7]);
+
+    cout << "thread_num " << THREAD_NUM << endl <<
+         "test_time " << TEST_TIME << endl <<
+         "test_num " << TEST_NUM << endl <<
+         "conflict_ratio " << CONFLICT_RATIO << endl <<
+         "write_ratio " << WRITE_RATIO << endl <<
+         "relocate_ratio " << RELOCATE_RATIO << endl;
+
+    opvaluelist = new uint64_t *[TEST_NUM];
+    for (size_t i = 0; i < TEST_NUM; i++) {
+        opvaluelist[i] = new uint64_t(i);
+    }
+    runtimelist = new uint64_t[THREAD_NUM]();
+
+    srand(time(NULL));
+    conflictlist = new bool[TEST_NUM];
+    writelist = new bool[TEST_NUM];
+    relocatelist = new bool[TEST_NUM];
+    for (size_t i = 0; i < TEST_NUM; i++) {
+        conflictlist[i] = rand() * 1.0 / RAND_MAX * 100 < CONFLICT_RATIO;
+        writelist[i] = rand() * 1.0 / RAND_MAX * 100 < WRITE_RATIO;
+        relocatelist[i] = rand() * 1.0 / RAND_MAX * 100 < RELOCATE_RATIO;
+    }
+
+    stringstream ss(methods);
+    string m;
+    while (getline(ss, m, ',')) {
+        double throughput;
+        if (m == "occ") throughput = run_test<OccKV>();
+        else if (m == "rw") throughput = run_test<RwKV>();
+        else if (m == "msq") throughput = run_test<MsqKV>();
+        else {
+            cout << "unknown method " << m << endl;
+            return -1;
+        }
+        cout << m << " ***throughput " << throughput << " g_value " << g_value;
+        if (m == "occ") cout << " relocations " << relocations;
+        cout << endl;
+    }
+    return 0;
+}
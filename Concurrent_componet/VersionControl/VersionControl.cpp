@@ -1,7 +1,7 @@
 #include <iostream>
 #include <thread>
 #include "tracer.h"
-#include "version_control.h"
+#include "occ.h"
 
 #define VPP 1
 
@@ -54,31 +54,23 @@ void concurrent_worker(int tid){
         for(size_t i = 0; i < TEST_NUM; i++){
             if(writelist[i]){
                 index = conflictlist[i] ? THREAD_NUM : tid;
-                bool replaced = false;
-                while (!locks[index].try_lock(replaced) && !replaced) {
-                    std::this_thread::yield();
-                }
+                occ_lock(locks[index]);
 #ifdef VPP
                 l_value++;
 #else
                 * kvlist[index].vp = * opvaluelist[i];
 #endif
-                locks[index].unlock(false);
+                occ_unlock(locks[index]);
 
             }else{
                 index = conflictlist[i] ? THREAD_NUM : tid;
-                GenLock before, after;
-                do {
-                    before = locks[index].load();
-#ifdef VPP
-                    l_value;
-#else
-                    l_value += * kvlist[index].vp;
+                uint64_t v = 0;
+                read_optimistic(locks[index], [&]() {
+#ifndef VPP
+                    v = * kvlist[index].vp;
 #endif
-                    do {
-                        after = locks[index].load();
-                    } while (after.locked /*|| after.replaced*/);
-                } while (before.gen_number != after.gen_number);
+                });
+                l_value += v;
             }
         }
 
@@ -0,0 +1,129 @@
+#ifndef RESEARCH_OCC_H
+#define RESEARCH_OCC_H
+
+#include <atomic>
+#include <cstdint>
+#include "version_control.h"
+#include "../RWlock/spin_wait.h"
+
+//Optimistic concurrency control on top of AtomicGenLock.
+//
+//Readers never write the lock word: they snapshot it unlocked, read, and
+//validate that the word did not move. Writers lock it, which bumps the
+//generation on unlock. The replaced bit marks an object that has been moved
+//elsewhere (its new copy is reachable from wherever the reader found this one):
+//a reader or writer meeting it gets OCC_REPLACED back and has to look the object
+//up again instead of retrying in place.
+
+enum OccStatus {
+    OCC_OK,
+    OCC_REPLACED,
+};
+
+//Backoff for lock and validation retries, the SpinWait of spin_wait.h: pauses
+//doubling up to SPIN_WAIT_MAX_PAUSE, then yields, then short sleeps. AtomicGenLock
+//unlocks do not wake anybody, so it sleeps rather than parking on the lock word.
+class OccBackoff {
+public:
+    void pause() { w.wait(); }
+
+    void reset() { w.reset(); }
+
+private:
+    SpinWait w;
+};
+
+//snapshot of an unlocked lock word, waits out writers
+inline GenLock occ_wait_unlocked(const AtomicGenLock &lock, OccBackoff &backoff) {
+    GenLock v = lock.load();
+    while (v.locked) {
+        backoff.pause();
+        v = lock.load();
+    }
+    return v;
+}
+
+//Runs f() until it saw a consistent object. f may run on data a writer is
+//changing, so it must only copy out and never act on what it read before
+//returning OCC_OK.
+template<typename F>
+OccStatus read_optimistic(const AtomicGenLock &lock, F f) {
+    OccBackoff backoff;
+    while (true) {
+        GenLock before = occ_wait_unlocked(lock, backoff);
+        if (before.replaced) return OCC_REPLACED;
+        f();
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (lock.load().control_ == before.control_) return OCC_OK;
+        backoff.pause();
+    }
+}
+
+//Validation set for a read that spans several objects. add() each lock before
+//reading its object, validate() once everything is read; a failed validate
+//means the whole read has to start over (clear() and add again).
+template<int N>
+class OccReadSet {
+public:
+    OccStatus add(const AtomicGenLock &lock) {
+        if (count == N) return OCC_REPLACED; // full, treat like a lookup miss
+        GenLock v = occ_wait_unlocked(lock, backoff);
+        if (v.replaced) return OCC_REPLACED;
+        locks[count] = &lock;
+        seen[count] = v;
+        count++;
+        return OCC_OK;
+    }
+
+    bool validate() {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        for (int i = 0; i < count; i++)
+            if (locks[i]->load().control_ != seen[i].control_) {
+                backoff.pause();
+                return false;
+            }
+        return true;
+    }
+
+    void clear() { count = 0; }
+
+    int size() const { return count; }
+
+private:
+    const AtomicGenLock *locks[N];
+    GenLock seen[N];
+    int count = 0;
+    OccBackoff backoff;
+};
+
+//Writer lock with exponential backoff. OCC_REPLACED: the object moved, nothing is held.
+inline OccStatus occ_lock(AtomicGenLock &lock) {
+    OccBackoff backoff;
+    bool replaced = false;
+    while (!lock.try_lock(replaced)) {
+        if (replaced) return OCC_REPLACED;
+        backoff.pause();
+    }
+    return OCC_OK;
+}
+
+inline void occ_unlock(AtomicGenLock &lock) { lock.unlock(false); }
+
+//Unlock an object whose contents were copied to a new location, after the new
+//location was published. Readers and writers of the old one see OCC_REPLACED.
+inline void occ_unlock_replaced(AtomicGenLock &lock) { lock.unlock(true); }
+
+//Reuse a replaced object as a relocation target. It comes back locked by the
+//caller with a newer generation, so stale snapshots of it still fail and stale
+//writers cannot get in before it is published. Only the writer holding the
+//object in use may call it; then publish, occ_unlock_replaced the old one and
+//occ_unlock this one.
+inline void occ_revive_locked(AtomicGenLock &lock) {
+    GenLock v = lock.load();
+    v.gen_number++;
+    v.locked = 1;
+    v.replaced = 0;
+    lock.store(v);
+}
+
+#endif //RESEARCH_OCC_H
@@ -1,3 +1,9 @@
+#ifndef RESEARCH_VERSION_CONTROL_H
+#define RESEARCH_VERSION_CONTROL_H
+
+#include <atomic>
+#include <cstdint>
+
 class GenLock {
 public:
     GenLock() : control_{0} {}
@@ -70,4 +76,6 @@ private:
     std::atomic<uint64_t> control_;
 };
 
-static_assert(sizeof(AtomicGenLock) == 128, "sizeof(AtomicGenLock) != 128");
\ No newline at end of file
+static_assert(sizeof(AtomicGenLock) == 128, "sizeof(AtomicGenLock) != 128");
+
+#endif //RESEARCH_VERSION_CONTROL_H
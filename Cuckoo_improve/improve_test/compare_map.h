@@ -0,0 +1,43 @@
+#ifndef RESEARCH_COMPARE_MAP_H
+#define RESEARCH_COMPARE_MAP_H
+
+#include <cstddef>
+#include <cstdint>
+
+//Common face of every map compare_test drives. new_cuckoohash_map and the stock
+//libcuckoo map both define libcuckoo::bucket_container, so each map lives in its
+//own translation unit and is reached only through this interface; every map pays
+//the same virtual call.
+class CompareMap {
+public:
+    virtual ~CompareMap() {}
+
+    //called once by every thread before it touches the map, tid < thread_num
+    virtual void init_thread(int tid) {}
+
+    virtual bool find(uint64_t key) = 0;
+
+    virtual bool insert(uint64_t key, uint64_t value) = 0;
+
+    //insert_or_assign
+    virtual bool update(uint64_t key, uint64_t value) = 0;
+
+    virtual bool erase(uint64_t key) = 0;
+
+    //items / slots
+    virtual double load_factor() = 0;
+};
+
+//All tables are sized to hashsize(hashpower) * 4 slots so the same key count
+//gives the same load factor. thread_num: the largest thread count that will use the map.
+CompareMap *make_new_cuckoo_map(size_t hashpower, int thread_num);
+
+CompareMap *make_libcuckoo_map(size_t hashpower, int thread_num);
+
+//libcuckoo with seqlock reads: finds try `retries` lock-free reads before locking
+CompareMap *make_libcuckoo_opt_map(size_t hashpower, int thread_num, size_t retries);
+
+//std::unordered_map behind one mutex, the floor every concurrent map should beat
+CompareMap *make_locked_map(size_t hashpower, int thread_num);
+
+#endif //RESEARCH_COMPARE_MAP_H
@@ -0,0 +1,103 @@
+#include <mutex>
+#include <unordered_map>
+#include "compare_map.h"
+#include "../libcuckoo_source/cuckoohash_map.hh"
+
+//same hash as new_cuckoohash_map, std::hash<uint64_t> is the identity
+struct murmur_hash64 {
+    std::size_t operator()(const uint64_t &key) const noexcept {
+        const uint64_t m = 0xc6a4a7935bd1e995ull;
+        const int r = 47;
+        uint64_t h = 7079 ^(sizeof(uint64_t) * m);
+        uint64_t k = key;
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+        h ^= k;
+        h *= m;
+        h ^= h >> r;
+        h *= m;
+        h ^= h >> r;
+        return h;
+    }
+};
+
+static const size_t compare_slot_per_bucket = 4;
+
+typedef libcuckoo::cuckoohash_map<uint64_t, uint64_t, murmur_hash64, std::equal_to<uint64_t>,
+        std::allocator<std::pair<const uint64_t, uint64_t>>, compare_slot_per_bucket> cmap;
+
+class LibcuckooMap : public CompareMap {
+public:
+    LibcuckooMap(size_t hashpower, int thread_num, size_t optimistic_retries = 0)
+            : map((1ull << hashpower) * compare_slot_per_bucket) {
+        map.optimistic_read_retries(optimistic_retries);
+    }
+
+    bool find(uint64_t key) override {
+        uint64_t value;
+        return map.find(key, value);
+    }
+
+    bool insert(uint64_t key, uint64_t value) override { return map.insert(key, value); }
+
+    bool update(uint64_t key, uint64_t value) override { return map.insert_or_assign(key, value); }
+
+    bool erase(uint64_t key) override { return map.erase(key); }
+
+    double load_factor() override { return map.load_factor(); }
+
+private:
+    cmap map;
+};
+
+class LockedMap : public CompareMap {
+public:
+    LockedMap(size_t hashpower, int thread_num) : slots((1ull << hashpower) * compare_slot_per_bucket) {
+        map.reserve(slots);
+    }
+
+    bool find(uint64_t key) override {
+        std::lock_guard<std::mutex> lock(mtx);
+        return map.find(key) != map.end();
+    }
+
+    bool insert(uint64_t key, uint64_t value) override {
+        std::lock_guard<std::mutex> lock(mtx);
+        return map.emplace(key, value).second;
+    }
+
+    bool update(uint64_t key, uint64_t value) override {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto res = map.emplace(key, value);
+        if (!res.second) res.first->second = value;
+        return res.second;
+    }
+
+    bool erase(uint64_t key) override {
+        std::lock_guard<std::mutex> lock(mtx);
+        return map.erase(key) != 0;
+    }
+
+    double load_factor() override {
+        std::lock_guard<std::mutex> lock(mtx);
+        return map.size() * 1.0 / slots;
+    }
+
+private:
+    std::mutex mtx;
+    std::unordered_map<uint64_t, uint64_t, murmur_hash64> map;
+    size_t slots;
+};
+
+CompareMap *make_libcuckoo_map(size_t hashpower, int thread_num) {
+    return new LibcuckooMap(hashpower, thread_num);
+}
+
+CompareMap *make_libcuckoo_opt_map(size_t hashpower, int thread_num, size_t retries) {
+    return new LibcuckooMap(hashpower, thread_num, retries);
+}
+
+CompareMap *make_locked_map(size_t hashpower, int thread_num) {
+    return new LockedMap(hashpower, thread_num);
+}
@@ -0,0 +1,40 @@
+#include <iostream>
+#include <vector>
+#include <atomic>
+#include "tracer.h"
+#include "item.h"
+#include "compare_map.h"
+#include "new_map.hh"
+
+using namespace libcuckoo;
+
+class NewCuckooMap : public CompareMap {
+public:
+    NewCuckooMap(size_t hashpower, int thread_num) : map(hashpower, thread_num) {}
+
+    void init_thread(int tid) override {
+        cuckoo_thread_id = tid;
+        map.brown_init_thread(tid);
+    }
+
+    bool find(uint64_t key) override { return map.find((char *) &key, sizeof(uint64_t)); }
+
+    bool insert(uint64_t key, uint64_t value) override {
+        return map.insert((char *) &key, sizeof(uint64_t), (char *) &value, sizeof(uint64_t));
+    }
+
+    bool update(uint64_t key, uint64_t value) override {
+        return map.insert_or_assign((char *) &key, sizeof(uint64_t), (char *) &value, sizeof(uint64_t));
+    }
+
+    bool erase(uint64_t key) override { return map.erase((char *) &key, sizeof(uint64_t)); }
+
+    double load_factor() override { return map.get_item_num() * 1.0 / map.slot_num(); }
+
+private:
+    new_cuckoohash_map map;
+};
+
+CompareMap *make_new_cuckoo_map(size_t hashpower, int thread_num) {
+    return new NewCuckooMap(hashpower, thread_num);
+}
@@ -0,0 +1,243 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <cstring>
+#include <algorithm>
+#include <mutex>
+#include <pthread.h>
+#include "tracer.h"
+#include "assert_msg.h"
+#include "latency_histogram.h"
+#include "workload.h"
+#include "compare_map.h"
+#include "perf_counters.h"
+
+//Runs every map over the same pregenerated stream with the same thread pinning,
+//timer and metrics, and prints one row per cell of
+//  map x threads x read ratio x skew x load factor
+//Each cell preloads a fresh table of hashsize(hashpower) * 4 slots to the given
+//load factor, then the stream only finds and overwrites preloaded keys so the
+//load factor holds for the whole run.
+
+size_t hashpower = 16;
+int timer_range = 1;
+size_t stream_len = 1 << 22;
+bool pin = true;
+int sample_every = 16; // one latency sample per sample_every ops
+bool perf = false;     // append per-op hardware counters of the run phase to every row
+size_t opt_retries = 4; // lock-free find attempts of libcuckoo_opt before it locks
+std::vector<int> thread_list{1, 2, 4};
+std::vector<int> read_list{50, 95, 100};
+std::vector<double> skew_list{0, 0.99}; // 0 -> uniform, otherwise zipf theta
+std::vector<double> lf_list{0.5, 0.9};
+std::vector<std::string> map_list{"new", "libcuckoo", "locked"};
+
+uint64_t *keys;
+Workload_op *ops;
+CompareMap *map;
+int cur_thread_num;
+
+std::atomic<int> stopMeasure(0);
+uint64_t op_num;
+uint64_t *runtimelist;
+LatencyHistogram *latency_hists;
+
+PerfGroup::Sample perf_run;
+bool perf_opened, perf_sw_only;
+bool perf_has[PerfGroup::EVENT_NUM];
+std::mutex perf_mtx;
+
+CompareMap *make_map(const std::string &name, int max_thread) {
+    if (name == "new") return make_new_cuckoo_map(hashpower, max_thread);
+    if (name == "libcuckoo") return make_libcuckoo_map(hashpower, max_thread);
+    if (name == "libcuckoo_opt") return make_libcuckoo_opt_map(hashpower, max_thread, opt_retries);
+    if (name == "locked") return make_locked_map(hashpower, max_thread);
+    ASSERT(false, "unknown map");
+    return nullptr;
+}
+
+void pin_thread(int tid) {
+    if (!pin) return;
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(tid % std::thread::hardware_concurrency(), &cpuset);
+    int rc = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+    if (rc != 0) std::cerr << "Error calling pthread_setaffinity_np: " << rc << "\n";
+}
+
+void load_worker(int tid, uint64_t record_count) {
+    pin_thread(tid);
+    map->init_thread(tid);
+    for (uint64_t k = tid; k < record_count; k += cur_thread_num) {
+        ASSERT(map->insert(k, k), "preload insert failed");
+    }
+}
+
+void worker(int tid) {
+    pin_thread(tid);
+    map->init_thread(tid);
+
+    size_t step = stream_len / cur_thread_num;
+    size_t base = tid * step;
+    uint64_t done = 0;
+    LatencyHistogram &hist = latency_hists[tid];
+
+    PerfGroup group;
+    if (perf) group.open();
+
+    Tracer t;
+    t.startTime();
+    group.start();
+    while (stopMeasure.load(std::memory_order_relaxed) == 0) {
+        for (size_t i = base; i < base + step; i++) {
+            bool sample = done++ % sample_every == 0;
+            std::chrono::steady_clock::time_point beg;
+            if (sample) beg = std::chrono::steady_clock::now();
+
+            if (ops[i] == W_Read) map->find(keys[i]);
+            else map->update(keys[i], i);
+
+            if (sample)
+                hist.record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now() - beg).count());
+        }
+        if (t.fetchTime() / 1000000 >= timer_range) stopMeasure.store(1, std::memory_order_relaxed);
+    }
+    runtimelist[tid] = t.getRunTime();
+    __sync_fetch_and_add(&op_num, done);
+
+    if (group.opened()) {
+        PerfGroup::Sample s;
+        s.clear();
+        group.stop(s);
+        std::lock_guard<std::mutex> lock(perf_mtx);
+        perf_run.add(s);
+        perf_opened = true;
+        perf_sw_only = group.software_only();
+        for (int e = 0; e < PerfGroup::EVENT_NUM; e++) perf_has[e] = group.has(e);
+    }
+}
+
+template<typename F>
+void run_threads(int n, F f) {
+    std::vector<std::thread> threads;
+    for (int i = 0; i < n; i++) threads.emplace_back(f, i);
+    for (auto &th : threads) th.join();
+}
+
+void run_cell(const std::string &map_name, int threads, int read, double skew, double lf, uint64_t record_count) {
+    int max_thread = thread_list.back();
+    map = make_map(map_name, max_thread);
+    cur_thread_num = threads;
+    run_threads(threads, [record_count](int tid) { load_worker(tid, record_count); });
+
+    stopMeasure.store(0);
+    op_num = 0;
+    perf_run.clear();
+    perf_opened = false;
+    for (int i = 0; i < threads; i++) latency_hists[i].reset();
+    run_threads(threads, worker);
+
+    uint64_t runtime = 0;
+    LatencyHistogram total;
+    for (int i = 0; i < threads; i++) {
+        runtime = std::max(runtime, runtimelist[i]);
+        total.merge(latency_hists[i]);
+    }
+
+    std::cout << map_name << "\t" << threads << "\t" << read << "\t" << skew << "\t" << lf << "\t"
+              << op_num * 1.0 / runtime << "\t" << total.percentile(0.5) << "\t" << total.percentile(0.99)
+              << "\t" << map->load_factor();
+    if (perf_opened) std::cout << "\t" << perf_per_op_str(perf_run, op_num, perf_sw_only, perf_has);
+    std::cout << std::endl;
+    delete map;
+}
+
+template<typename T>
+std::vector<T> parse_list(const char *val) {
+    std::vector<T> res;
+    std::stringstream ss(val);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        std::stringstream is(item);
+        T v;
+        is >> v;
+        res.push_back(v);
+    }
+    return res;
+}
+
+bool parse_option(const char *arg) {
+    const char *eq = strchr(arg, '=');
+    std::string name(arg, eq - arg);
+    const char *val = eq + 1;
+    if (name == "threads") thread_list = parse_list<int>(val);
+    else if (name == "reads") read_list = parse_list<int>(val);
+    else if (name == "skew") skew_list = parse_list<double>(val);
+    else if (name == "lf") lf_list = parse_list<double>(val);
+    else if (name == "maps") map_list = parse_list<std::string>(val);
+    else if (name == "ops") stream_len = std::atol(val);
+    else if (name == "pin") pin = std::atoi(val) != 0;
+    else if (name == "perf") perf = std::atoi(val) != 0;
+    else if (name == "sample") sample_every = std::atoi(val);
+    else if (name == "retries") opt_retries = std::atol(val);
+    else return false;
+    return true;
+}
+
+int main(int argc, char **argv) {
+    std::vector<char *> args{argv[0]};
+    bool bad_option = false;
+    for (int i = 1; i < argc; i++) {
+        if (strchr(argv[i], '=') == nullptr) args.push_back(argv[i]);
+        else if (!parse_option(argv[i])) bad_option = true;
+    }
+
+    if (args.size() != 3 || bad_option) {
+        cout << "./compare_test <hashpower> <timer_range> [options]" << endl;
+        cout << "options (comma separated lists, the matrix is their cross product):" << endl;
+        cout << "  threads=1,2,4  reads=50,95,100 (percent finds, the rest insert_or_assign)" << endl;
+        cout << "  skew=0,0.99 (0 uniform, otherwise zipf theta)  lf=0.5,0.9 (preload load factor)" << endl;
+        cout << "  maps=new,libcuckoo,libcuckoo_opt,locked  ops=<stream length>  pin=<0|1>  sample=<every n ops>" << endl;
+        cout << "  retries=<n> (libcuckoo_opt: lock-free find attempts before it locks, default 4)" << endl;
+        cout << "  perf=1 (per-op cycles, L1D/LLC/dTLB misses and branch misses of the run phase)" << endl;
+        exit(-1);
+    }
+    hashpower = std::atol(args[1]);
+    timer_range = std::atol(args[2]);
+
+    std::sort(thread_list.begin(), thread_list.end());
+    int max_thread = thread_list.back();
+    //every thread count splits the same stream, the tail beyond a multiple of max_thread is dropped
+    stream_len -= stream_len % max_thread;
+    ASSERT(stream_len >= (size_t) max_thread, "stream shorter than thread count");
+
+    keys = new uint64_t[stream_len];
+    ops = new Workload_op[stream_len];
+    runtimelist = new uint64_t[max_thread];
+    latency_hists = new LatencyHistogram[max_thread];
+    uint64_t slots = (1ull << hashpower) * 4;
+
+    std::cout << "#hashpower " << hashpower << " slots " << slots << " stream " << stream_len << " timer "
+              << timer_range << "s pin " << pin << std::endl;
+    std::cout << "#map\tthreads\tread\tskew\tlf\tMops\tp50_ns\tp99_ns\tlf_after" << std::endl;
+
+    for (double lf : lf_list) {
+        uint64_t record_count = (uint64_t) (slots * lf);
+        ASSERT(record_count > 0, "load factor too small");
+        for (double skew : skew_list) {
+            WorkloadGenerator gen(record_count, skew > 0 ? Zipfian : Uniform, skew > 0 ? skew : 0.5);
+            for (int read : read_list) {
+                Workload_mix mix{'m', read, 100 - read, 0, 0, 0, 0};
+                gen.generate(keys, ops, &mix, stream_len, max_thread, 1);
+                for (int threads : thread_list) {
+                    for (auto &name : map_list) run_cell(name, threads, read, skew, lf, record_count);
+                }
+            }
+        }
+    }
+    return 0;
+}
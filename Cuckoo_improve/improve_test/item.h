@@ -6,6 +6,13 @@
 
 //#define FIX_LEN 1;
 
+//per item expiry, an expire deadline in the header (table_test_ttl builds with it)
+//#define ITEM_TTL
+
+#if defined(ITEM_TTL) && defined(FIX_LEN)
+#error "ITEM_TTL needs the variable length Item"
+#endif
+
 
 typedef  uint32_t ltype;
 
@@ -34,21 +41,41 @@ struct Item{
 
 #else
 
-#define ITEM_LEN_ALLOC(kl,vl) (kl+vl+2* sizeof(ltype))
+#define ITEM_HEADER_LEN sizeof(Item)
+#define ITEM_LEN_ALLOC(kl,vl) (kl+vl+ITEM_HEADER_LEN)
 
 #define ITEM_KEY(item_ptr) ((Item*)item_ptr)->buf
 #define ITEM_VALUE(item_ptr) (((Item * )item_ptr)->buf + ITEM_KEY_LEN(item_ptr))
-#define ITEM_LEN(item_ptr)  (ITEM_KEY_LEN(item_ptr) + ITEM_VALUE_LEN(item_ptr) + 2* sizeof(ltype))
+#define ITEM_LEN(item_ptr)  (ITEM_KEY_LEN(item_ptr) + ITEM_VALUE_LEN(item_ptr) + ITEM_HEADER_LEN)
 
 struct Item{
     ltype key_len;
     ltype value_len;
+#ifdef ITEM_TTL
+    ltype expire;   // ttl_now_ms() deadline, 0 never expires
+    ltype pad;      // keeps buf (and 8 byte values behind 8 byte keys) aligned
+#endif
     char buf[];
     inline uint64_t get_struct_len(){
-        return key_len + value_len +2* sizeof(ltype);
+        return key_len + value_len + ITEM_HEADER_LEN;
     }
 };
 
+#ifdef ITEM_TTL
+#include <time.h>
+
+//coarse monotonic milliseconds, wraps after ~49 days which expired() tolerates
+static inline ltype ttl_now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (ltype) (ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+static inline bool item_expired(const Item *item, ltype now) {
+    return item->expire != 0 && (int32_t) (now - item->expire) >= 0;
+}
+#endif
+
 #endif
 
 //Key length and value length must be assigned firstly during initialzation
@@ -60,6 +87,9 @@ static inline void init_item(Item * item,
                              ltype value_len){
     item->key_len = key_len;
     item->value_len = value_len;
+#ifdef ITEM_TTL
+    item->expire = 0;
+#endif
     memcpy(ITEM_KEY(item),key,key_len);
     memcpy(ITEM_VALUE(item),value,value_len);
 }
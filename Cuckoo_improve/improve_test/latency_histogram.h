@@ -0,0 +1,116 @@
+#ifndef RESEARCH_LATENCY_HISTOGRAM_H
+#define RESEARCH_LATENCY_HISTOGRAM_H
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <thread>
+
+//Log-linear histogram of latencies in nanoseconds.
+//Every power of two is split into SUB_BUCKETS linear buckets, so the relative
+//error of a reported percentile is bounded by 1/SUB_BUCKETS.
+class LatencyHistogram {
+public:
+    static const int SUB_BITS = 4;
+    static const int SUB_BUCKETS = 1 << SUB_BITS;
+    static const int BUCKET_NUM = (64 - SUB_BITS + 1) * SUB_BUCKETS;
+
+    LatencyHistogram() { reset(); }
+
+    void reset() {
+        memset(counts, 0, sizeof(counts));
+        total = 0;
+        max_value = 0;
+    }
+
+    inline void record(uint64_t ns) {
+        counts[bucket_of(ns)]++;
+        total++;
+        if (ns > max_value) max_value = ns;
+    }
+
+    void merge(const LatencyHistogram &other) {
+        for (int i = 0; i < BUCKET_NUM; i++) counts[i] += other.counts[i];
+        total += other.total;
+        if (other.max_value > max_value) max_value = other.max_value;
+    }
+
+    //q in [0,1], returns the upper bound of the bucket holding the q-th sample
+    uint64_t percentile(double q) const {
+        if (total == 0) return 0;
+        uint64_t target = (uint64_t) (q * total);
+        if (target >= total) target = total - 1;
+        uint64_t seen = 0;
+        for (int i = 0; i < BUCKET_NUM; i++) {
+            seen += counts[i];
+            if (seen > target) {
+                uint64_t upper = bucket_upper(i);
+                return upper < max_value ? upper : max_value;
+            }
+        }
+        return max_value;
+    }
+
+    uint64_t count() const { return total; }
+
+    uint64_t max() const { return max_value; }
+
+private:
+    static inline int bucket_of(uint64_t v) {
+        if (v < SUB_BUCKETS) return (int) v;
+        int msb = 63 - __builtin_clzll(v);
+        int sub = (int) ((v >> (msb - SUB_BITS)) & (SUB_BUCKETS - 1));
+        return (msb - SUB_BITS + 1) * SUB_BUCKETS + sub;
+    }
+
+    static inline uint64_t bucket_upper(int idx) {
+        if (idx < SUB_BUCKETS) return (uint64_t) idx;
+        int msb = idx / SUB_BUCKETS + SUB_BITS - 1;
+        uint64_t sub = idx % SUB_BUCKETS;
+        return ((SUB_BUCKETS + sub + 1) << (msb - SUB_BITS)) - 1;
+    }
+
+    uint64_t counts[BUCKET_NUM];
+    uint64_t total;
+    uint64_t max_value;
+};
+
+//Issues requests on a Poisson schedule. Latency should be taken against
+//intended(), not against the moment the request was actually sent, otherwise
+//a stalled server hides its own queueing delay (coordinated omission).
+class PoissonArrival {
+public:
+    using clock = std::chrono::steady_clock;
+
+    //rate: requests per second issued by this generator
+    PoissonArrival(double rate, uint64_t seed) : rng(seed), gap(rate / 1e9), next_ns(0) {
+        start = clock::now();
+    }
+
+    //block until the next intended send time and return it (ns since start)
+    uint64_t wait_next() {
+        next_ns += gap(rng);
+        uint64_t target = (uint64_t) next_ns;
+        while (true) {
+            uint64_t now = elapsed_ns();
+            if (now >= target) break;
+            //sleep only when far ahead, the scheduler overshoots short sleeps
+            if (target - now > 200000)
+                std::this_thread::sleep_for(std::chrono::nanoseconds(target - now - 100000));
+        }
+        return target;
+    }
+
+    inline uint64_t elapsed_ns() const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count();
+    }
+
+private:
+    std::mt19937_64 rng;
+    std::exponential_distribution<double> gap; // inter-arrival in ns
+    double next_ns;
+    clock::time_point start;
+};
+
+#endif //RESEARCH_LATENCY_HISTOGRAM_H
@@ -0,0 +1,181 @@
+#ifndef RESEARCH_MWCAS_H
+#define RESEARCH_MWCAS_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include "assert_msg.h"
+
+//Multi-word CAS over std::atomic<uint64_t> words.
+//
+//A word taking part in an operation holds a tagged descriptor word: FLAG | seq << TID_BITS | tid.
+//FLAG is a set of bits the caller never uses all together in a plain value, the tag lives in the
+//low 48 bits. Every thread owns one descriptor and reuses it for all of its operations, bumping
+//its sequence number each time, the way brown/descriptors_impl.h recycles SCX records: a reader
+//holding a stale tag sees the sequence number moved on when it snapshots the descriptor and just
+//reads the word again. So no descriptor is ever freed and none needs a grace period.
+//
+//Only the owner installs its tags (expected -> tag, in the order the words were added): a helper
+//installing into a recycled descriptor could not tell a live operation from one that already
+//ended. The status, though, is decided by a CAS on mutables that anyone may take. Once all tags
+//are in the owner tries UNDECIDED -> SUCCEEDED; a reader meeting the tag of an undecided
+//operation takes UNDECIDED -> FAILED instead of waiting, and reads expected. Either way every
+//word of the operation reads the same side of it, and no reader ever waits for the owner. The
+//owner then replaces its tags by desired or expected. A second owner that meets a tag while
+//installing fails instead of helping, the caller retries.
+template<uint64_t FLAG>
+class MwCAS {
+public:
+    static const int MAX_WORDS = 16;
+    static const int TID_BITS = 10;
+    static const uint64_t TAG_MASK = 0xffffffffffffull;
+    static const uint64_t SEQ_MASK = TAG_MASK >> TID_BITS;
+
+    static_assert((FLAG & TAG_MASK) == 0, "flag bits must be above the 48 bit tag");
+
+    explicit MwCAS(int thread_num) : thread_num(thread_num) {
+        ASSERT(thread_num <= (1 << TID_BITS), "too many threads for the descriptor tag");
+        descs = (Descriptor *) aligned_alloc(sizeof(Descriptor), thread_num * sizeof(Descriptor));
+        for (int i = 0; i < thread_num; i++) new(&descs[i]) Descriptor();
+    }
+
+    ~MwCAS() { free(descs); }
+
+    MwCAS(const MwCAS &) = delete;
+
+    MwCAS &operator=(const MwCAS &) = delete;
+
+    static inline bool is_descriptor(uint64_t v) { return (v & FLAG) == FLAG; }
+
+    //start a new operation of thread tid, older tags of its descriptor turn stale
+    void begin(int tid) {
+        Descriptor &d = descs[tid];
+        uint64_t seq = (d.mutables.load(std::memory_order_relaxed) >> STATUS_BITS) + 1;
+        d.mutables.store(seq << STATUS_BITS | UNDECIDED);
+        //the words of the new operation must not show before its sequence number
+        std::atomic_thread_fence(std::memory_order_release);
+        d.count.store(0, std::memory_order_relaxed);
+    }
+
+    void add(int tid, std::atomic<uint64_t> *addr, uint64_t expected, uint64_t desired) {
+        Descriptor &d = descs[tid];
+        int n = d.count.load(std::memory_order_relaxed);
+        ASSERT(n < MAX_WORDS, "too many words in one mwcas");
+        ASSERT(!is_descriptor(expected) && !is_descriptor(desired), "plain value with the descriptor flag");
+        d.words[n].addr.store(addr, std::memory_order_relaxed);
+        d.words[n].expected.store(expected, std::memory_order_relaxed);
+        d.words[n].desired.store(desired, std::memory_order_relaxed);
+        d.count.store(n + 1, std::memory_order_release);
+    }
+
+    //Installs the tags, then calls check() while every word holds one, so nothing else can
+    //change them, and tries to decide SUCCEEDED. A word no longer at expected, check() returning
+    //false, or a reader deciding FAILED first aborts. done() runs only once the operation has
+    //succeeded, before the tags are replaced. true when the new values are in place.
+    template<typename C, typename D>
+    bool execute(int tid, C check, D done) {
+        Descriptor &d = descs[tid];
+        const uint64_t m = d.mutables.load(std::memory_order_relaxed);
+        const uint64_t seq = m >> STATUS_BITS;
+        const uint64_t tag = make_tag(tid, seq);
+        const int n = d.count.load(std::memory_order_relaxed);
+
+        int installed = 0;
+        for (; installed < n; installed++) {
+            //a reader already failed it
+            if (d.mutables.load() != m) break;
+            Word &w = d.words[installed];
+            uint64_t expected = w.expected.load(std::memory_order_relaxed);
+            if (!w.addr.load(std::memory_order_relaxed)->compare_exchange_strong(expected, tag)) break;
+        }
+        uint64_t undecided = m;
+        bool ok = installed == n && check() &&
+                  d.mutables.compare_exchange_strong(undecided, seq << STATUS_BITS | SUCCEEDED);
+        if (ok) {
+            done();
+        } else {
+            undecided = m;
+            d.mutables.compare_exchange_strong(undecided, seq << STATUS_BITS | FAILED);
+        }
+
+        for (int i = 0; i < installed; i++) {
+            Word &w = d.words[i];
+            uint64_t cur = tag;
+            w.addr.load(std::memory_order_relaxed)->compare_exchange_strong(
+                    cur, ok ? w.desired.load(std::memory_order_relaxed) : w.expected.load(std::memory_order_relaxed));
+        }
+        return ok;
+    }
+
+    template<typename C>
+    bool execute(int tid, C check) { return execute(tid, check, []() {}); }
+
+    bool execute(int tid) { return execute(tid, []() { return true; }); }
+
+    //logical value of a word that may hold a tag: v is what was loaded from word. Never waits
+    //for the owner, an undecided operation is failed instead.
+    uint64_t resolve(std::atomic<uint64_t> &word, uint64_t v) {
+        while (is_descriptor(v)) {
+            const int tid = (int) (v & ((1ull << TID_BITS) - 1));
+            const uint64_t seq = (v & TAG_MASK) >> TID_BITS;
+            Descriptor &d = descs[tid];
+
+            uint64_t m1 = d.mutables.load();
+            uint64_t res = 0;
+            bool found = false;
+            int n = d.count.load(std::memory_order_acquire);
+            for (int i = 0; i < n && i < MAX_WORDS; i++) {
+                if (d.words[i].addr.load(std::memory_order_relaxed) != &word) continue;
+                uint64_t expected = d.words[i].expected.load(std::memory_order_relaxed);
+                uint64_t desired = d.words[i].desired.load(std::memory_order_relaxed);
+                res = expected;
+                if ((m1 & STATUS_MASK) == SUCCEEDED) res = desired;
+                found = true;
+                break;
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            uint64_t m2 = d.mutables.load();
+            //the owner moved on: the operation is over and the word no longer holds its tag
+            if (((m1 >> STATUS_BITS) & SEQ_MASK) != seq || m2 != m1 || !found) {
+                v = word.load();
+                continue;
+            }
+            if ((m1 & STATUS_MASK) == UNDECIDED) {
+                //whoever wins, the next round sees a decided status (or the owner gone)
+                d.mutables.compare_exchange_strong(m1, seq << STATUS_BITS | FAILED);
+                continue;
+            }
+            //the owner swaps the tag out itself, after done() of a successful operation
+            return res;
+        }
+        return v;
+    }
+
+    uint64_t read(std::atomic<uint64_t> &word) { return resolve(word, word.load()); }
+
+private:
+    static const int STATUS_BITS = 2;
+    static const uint64_t STATUS_MASK = 3;
+    static const uint64_t UNDECIDED = 0, SUCCEEDED = 1, FAILED = 2;
+
+    struct Word {
+        std::atomic<std::atomic<uint64_t> *> addr;
+        std::atomic<uint64_t> expected, desired;
+    };
+
+    struct alignas(64) Descriptor {
+        std::atomic<uint64_t> mutables{0}; // seq << STATUS_BITS | status
+        std::atomic<int> count{0};
+        Word words[MAX_WORDS];
+    };
+
+    static inline uint64_t make_tag(int tid, uint64_t seq) {
+        return FLAG | ((seq << TID_BITS) & TAG_MASK) | (uint64_t) tid;
+    }
+
+    Descriptor *descs;
+    int thread_num;
+};
+
+#endif //RESEARCH_MWCAS_H
@@ -31,6 +31,8 @@ AllocatorNew<T>::AllocatorNew() {}
 template<typename T>
 T * AllocatorNew<T>::allocate(uint64_t len) {
 
+    tw_info.num_item_alloc++;
+    tw_info.num_new_item_malloc++;
     void * tp=malloc(len + 2 * sizeof(POINTER)); //buffer size + two pointer spaces used to construct lists
     ((Listhead *)tp)->prev= nullptr;
     ((Listhead *)tp)->next= nullptr;
@@ -38,7 +38,9 @@
 thread_local int debug_tid;
 
 struct Debug_thread_work_info{
-    uint64_t num_new_item_malloc;
+    uint64_t num_item_alloc;      //every allocate() call
+    uint64_t num_new_item_malloc; //allocate() calls that had to go to malloc, the rest reused freed memory
+    uint64_t num_retire;
     uint64_t num_mlq_reclaim;
 };
 
@@ -48,7 +50,9 @@ std::mutex debug_mtx;
 static void dump_debug_thread_work_info(){
     debug_mtx.lock();
     cout<<"thread: "<<debug_tid<<endl;
+    cout<<"num_item_alloc  "<<tw_info.num_item_alloc<<endl;
     cout<<"num_new_item_alloc  "<<tw_info.num_new_item_malloc<<endl;
+    cout<<"num_retire  "<<tw_info.num_retire<<endl;
     cout<<"num_mlq_reclaimer  "<<tw_info.num_mlq_reclaim<<endl;
     debug_mtx.unlock();
 }
@@ -43,8 +43,10 @@ uint64_t MultiLevelQueue<T>::get_total_size() {
 template<typename T>
 T * MultiLevelQueue<T>::allocate(uint64_t len) {
 
+    tw_info.num_item_alloc++;
     //size is too large,malloc directly
     if(len > MAX_UNIF_SIZE){
+        tw_info.num_new_item_malloc++;
         void * tp=malloc(len + 2 * sizeof(POINTER)); //buffer size + two pointer spaces used to construct lists
         ((Listhead *)tp)->prev= nullptr;
         ((Listhead *)tp)->next= nullptr;
@@ -81,12 +81,17 @@ public:
     inline storeType * allocate(int tid, uint64_t len);
     bool deallocate(int tid, storeType * ptr);
 
+    //number of retired items still waiting in the epoch bags, i.e. the reclamation backlog
+    uint64_t get_limbo_size(int tid);
+    uint64_t get_limbo_size();
+
     //void dump();
 };
 
 Reclaimer_debra::Reclaimer_debra(int thread_num) : NUM_PROCESSES(thread_num) {
     epoch = 0;
-    for (int tid = 0; tid < NUM_PROCESSES; ++tid) {
+    //bags of every slot must start NULL, get_limbo_size() and initThread() look at all of them
+    for (int tid = 0; tid < MAX_THREADS_POW2; ++tid) {
         threadData[tid].index = 0;
         threadData[tid].localvar_announcedEpoch = GET_WITH_QUIESCENT(0);
         threadData[tid].announcedEpoch.store(GET_WITH_QUIESCENT(0), std::memory_order_relaxed);
@@ -195,7 +200,22 @@ void Reclaimer_debra::read(int tid) {
     //endOp(tid);
 }
 
+uint64_t Reclaimer_debra::get_limbo_size(int tid) {
+    uint64_t size = 0;
+    for (int i = 0; i < NUMBER_OF_EPOCH_BAGS; ++i) {
+        if (threadData[tid].epochbags[i] != NULL) size += threadData[tid].epochbags[i]->get_size();
+    }
+    return size;
+}
+
+uint64_t Reclaimer_debra::get_limbo_size() {
+    uint64_t size = 0;
+    for (int tid = 0; tid < MAX_THREADS_POW2; ++tid) size += get_limbo_size(tid);
+    return size;
+}
+
 void Reclaimer_debra::retire(int tid, storeType *ptr) {
+    tw_info.num_retire++;
     uint64_t len = ptr->get_struct_len();
     threadData[tid].currentBag->add(ptr,len);
 }
@@ -0,0 +1,86 @@
+#ifndef RESEARCH_NEGATIVE_FILTER_H
+#define RESEARCH_NEGATIVE_FILTER_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+//Blocked counting Bloom filter in front of new_cuckoohash_map for lookups that miss.
+//A key maps to one 64 byte block (one cache line) and to K of its 128 four bit
+//counters, so a query is a single line. Counters saturate at 15 and then stay put,
+//which only costs false positives, never a false negative. add / remove are CAS
+//loops on the 8 byte word holding a counter, queries are plain loads.
+class NegativeFilter {
+public:
+    static const int K = 4;
+    static const int COUNTERS_PER_BLOCK = 128;
+    static const uint64_t COUNTER_MAX = 0xf;
+
+    //expected_keys: the table's slot count; counters_per_key: space / accuracy trade
+    explicit NegativeFilter(uint64_t expected_keys, uint64_t counters_per_key = 8) {
+        uint64_t want = expected_keys * counters_per_key / COUNTERS_PER_BLOCK;
+        block_num = 1;
+        while (block_num < want) block_num <<= 1;
+        blocks = (Block *) aligned_alloc(sizeof(Block), block_num * sizeof(Block));
+        memset((void *) blocks, 0, block_num * sizeof(Block));
+    }
+
+    ~NegativeFilter() { free(blocks); }
+
+    NegativeFilter(const NegativeFilter &) = delete;
+
+    NegativeFilter &operator=(const NegativeFilter &) = delete;
+
+    void add(uint64_t hash) { update(hash, true); }
+
+    void remove(uint64_t hash) { update(hash, false); }
+
+    //false: the key is certainly absent
+    bool may_contain(uint64_t hash) const {
+        uint64_t h = mix(hash);
+        const Block &b = blocks[(h >> 32) & (block_num - 1)];
+        for (int i = 0; i < K; i++, h >>= 7) {
+            unsigned c = h & (COUNTERS_PER_BLOCK - 1);
+            if (((b.w[c >> 4].load(std::memory_order_acquire) >> ((c & 15) * 4)) & COUNTER_MAX) == 0) return false;
+        }
+        return true;
+    }
+
+    uint64_t bytes() const { return block_num * sizeof(Block); }
+
+private:
+    struct alignas(64) Block {
+        std::atomic<uint64_t> w[8];
+    };
+
+    static inline uint64_t mix(uint64_t h) {
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdull;
+        h ^= h >> 33;
+        return h;
+    }
+
+    void update(uint64_t hash, bool inc) {
+        uint64_t h = mix(hash);
+        Block &b = blocks[(h >> 32) & (block_num - 1)];
+        for (int i = 0; i < K; i++, h >>= 7) {
+            unsigned c = h & (COUNTERS_PER_BLOCK - 1);
+            std::atomic<uint64_t> &w = b.w[c >> 4];
+            const int shift = (c & 15) * 4;
+            uint64_t old = w.load(std::memory_order_relaxed);
+            while (true) {
+                uint64_t n = (old >> shift) & COUNTER_MAX;
+                //a saturated counter has lost count of its keys, it stays
+                if (n == COUNTER_MAX || (!inc && n == 0)) break;
+                uint64_t desired = inc ? old + (1ull << shift) : old - (1ull << shift);
+                if (w.compare_exchange_weak(old, desired)) break;
+            }
+        }
+    }
+
+    Block *blocks;
+    uint64_t block_num;
+};
+
+#endif //RESEARCH_NEGATIVE_FILTER_H
@@ -17,11 +17,16 @@
 //#include "brown_reclaim.h"
 //#include "my_reclaimer/reclaimer_ebr_token.h"
 #include "my_reclaimer/reclaimer_debra.h"
+#include "mwcas.h"
 
 namespace libcuckoo {
 
     static const int ATOMIC_ALIGN_RATIO = 1;
 
+    //a slot taking part in a path move by MwCAS: the kick lock bit, so raw loads see the slot as
+    //locked, plus bit 53 that no item word uses
+    typedef MwCAS<(1ull << 55) | (1ull << 53)> SlotMwCAS;
+
     thread_local int cuckoo_thread_id;
 
 
@@ -100,6 +105,7 @@ public:
         bc.hashpower(hashpower());
         hashpower(bc_hashpower);
         this->deallocator = bc.deallocator;
+        this->mwcas = bc.mwcas;
         std::swap(buckets_, bc.buckets_);
     }
 
@@ -118,12 +124,14 @@ public:
 
 
   inline size_type read_from_slot( bucket &b,size_type slot){
-      return (size_type)deallocator->load(cuckoo_thread_id,b.values_[slot * ATOMIC_ALIGN_RATIO]);
+      size_type v = (size_type)deallocator->load(cuckoo_thread_id,b.values_[slot * ATOMIC_ALIGN_RATIO]);
+      if (mwcas && SlotMwCAS::is_descriptor(v)) v = mwcas->resolve(b.values_[slot * ATOMIC_ALIGN_RATIO], v);
+      return v;
       //return b.values_[slot * ATOMIC_ALIGN_RATIO].load();
   }
 
   inline size_type read_from_bucket_slot(size_type ind,size_type slot){
-      return (size_type)deallocator->load(cuckoo_thread_id,std::ref( buckets_[ind].values_[slot * ATOMIC_ALIGN_RATIO]));
+      return read_from_slot(buckets_[ind], slot);
       //return buckets_[ind].values_[slot * ATOMIC_ALIGN_RATIO].load();
   }
 
@@ -131,6 +139,10 @@ public:
       return buckets_[ind].values_[slot * ATOMIC_ALIGN_RATIO];
   }
 
+  inline atomic<size_t> & slot_word(bucket &b,size_type slot){
+      return b.values_[slot * ATOMIC_ALIGN_RATIO];
+  }
+
 
   // ptr has been packaged with partial
   bool try_insertKV(size_type ind, size_type slot, uint64_t insert_ptr) {
@@ -145,7 +157,7 @@ public:
         uint64_t old = b.values_[slot * ATOMIC_ALIGN_RATIO].load();
         if(old != old_ptr) return false;
         if(b.values_[slot * ATOMIC_ALIGN_RATIO].compare_exchange_strong(old,update_ptr)){
-            deallocator->deallocate(cuckoo_thread_id,(Item *)old);
+            retire_item(old);
             return true;
         }else{
             return false;
@@ -157,7 +169,7 @@ public:
         uint64_t old = b.values_[slot * ATOMIC_ALIGN_RATIO].load();
         if(old != erase_ptr) return false;
         if(b.values_[slot * ATOMIC_ALIGN_RATIO].compare_exchange_strong(old,(uint64_t) nullptr)){
-            deallocator->deallocate(cuckoo_thread_id,(Item *)old);
+            retire_item(old);
             return true;
         }else{
             return false;
@@ -171,6 +183,9 @@ public:
         ASSERT(p!= nullptr,"malloc failure");
         p->key_len = key_len;
         p->value_len = value_len;
+#ifdef ITEM_TTL
+        p->expire = 0;
+#endif
         memcpy(ITEM_KEY(p),key,key_len);
         memcpy(ITEM_VALUE(p),value,value_len);
         return p;
@@ -226,7 +241,17 @@ public:
       ready_to_destory = true;
   }
 
+    //items of a loaded snapshot live inside its mapping and are never freed
+    inline void retire_item(uint64_t par_ptr) {
+        uint64_t ptr = par_ptr & brown_ptr_mask;
+        if (ptr >= mapped_begin && ptr < mapped_end) return;
+        deallocator->deallocate(cuckoo_thread_id, (Item *) par_ptr);
+    }
+
     Reclaimer_debra *deallocator;
+    //set in the PATH_MWCAS mode of new_cuckoohash_map, slot reads then see through its tags
+    SlotMwCAS *mwcas = nullptr;
+    uint64_t mapped_begin = 0, mapped_end = 0;
 private:
     bool ready_to_destory;
 
@@ -1,4 +1,15 @@
 #include <cstring>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <unordered_set>
+#include <vector>
+#include <random>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "new_bucket_container.hh"
 #include "cuckoohash_config.hh"
 #include "cuckoohash_util.hh"
@@ -6,6 +17,8 @@
 
 #include "assert_msg.h"
 #include "kick_haza_pointer.h"
+#include "negative_filter.h"
+#include "../../Concurrent_componet/RWlock/spin_wait.h"
 //#include "brown_reclaim.h"
 
 
@@ -17,6 +30,7 @@ namespace libcuckoo {
     static const uint64_t partial_mask = 0xffull << partial_offset;
     static const uint64_t ptr_mask = 0xffffffffffffull; //lower 48bit
     static const uint64_t kick_lock_mask = 1ull << (partial_offset - 1);
+    static const uint64_t cache_ref_mask = 1ull << (partial_offset - 2); // CLOCK reference bit, cache mode only
 
 
     //thread_local size_t kick_num_l;
@@ -31,6 +45,47 @@ namespace libcuckoo {
                         key_duplicated_after_kick_l;
     thread_local size_t kick_path_length_log_l[6];
 
+    thread_local size_t shrink_check_l; // successful erases since this thread last sampled the load factor
+    thread_local size_t cache_hand_l;   // where this thread's CLOCK sweep over a full bucket pair starts
+    thread_local uint64_t walk_rand_l;  // LCG state of the random walk path search
+
+    thread_local size_t filter_negative_l,       // finds the negative filter answered alone
+                        filter_false_positive_l, // finds the filter let through that missed anyway
+                        partial_false_match_l;   // slots whose partial matched a different key
+
+    static const size_t SHRINK_CHECK_INTERVAL = 4096;
+    static const size_t SHRINK_SAMPLE_BUCKETS = 256;
+
+    //concurrent scans; scan g owns epoch / registration slot cuckoo_thread_num + g
+    static const int MAX_SCAN_GROUPS = 4;
+    static const int MAX_SCAN_PARTS = 64;
+
+    //the TTL sweeper owns slot cuckoo_thread_num + MAX_SCAN_GROUPS
+    static const size_t TTL_SWEEP_CHUNK = 64;  // buckets per registration, what a rehash may wait for
+    static const size_t TTL_SWEEP_BATCH = 16;  // chunks between two looks at the CPU budget
+
+    //snapshot file: header, hashsize(hashpower) * SLOT_PER_BUCKET slots, item region.
+    //A slot holds partial << 56 | file offset of its item, 0 when empty. Items are
+    //packed in slot order, each 8 byte aligned.
+    static const uint64_t SNAPSHOT_MAGIC = 0x50414e534b435543ull; // "CUCKSNAP"
+#ifdef ITEM_TTL
+    static const uint32_t SNAPSHOT_VERSION = 0x101; // items carry the expire header
+#else
+    static const uint32_t SNAPSHOT_VERSION = 1;
+#endif
+
+    static const double BULK_LOAD_FACTOR = 0.9;  // bulk_load presizes so the table ends at most this full
+    static const size_t BULK_MAX_WALK = 512;     // offline displacement steps before growing the table
+
+    struct SnapshotHeader {
+        uint64_t magic;
+        uint32_t version;
+        uint32_t slot_per_bucket;
+        uint64_t hashpower;
+        uint64_t item_num;
+        uint64_t file_len;
+    };
+
     class new_cuckoohash_map {
     private:
 
@@ -111,7 +166,7 @@ namespace libcuckoo {
 
         static constexpr uint16_t slot_per_bucket() { return SLOT_PER_BUCKET; }
 
-        new_cuckoohash_map(size_type n = DEFAULT_HASHPOWER,int tn=0) : buckets_(n,tn),rehash_flag(false) {
+        new_cuckoohash_map(size_type n = DEFAULT_HASHPOWER,int tn=0) : buckets_(n,tn + MAX_SCAN_GROUPS + 1) {
             cuckoo_thread_num = tn;
         }
 
@@ -122,6 +177,7 @@ namespace libcuckoo {
 
         void swap_first(new_cuckoohash_map &other) noexcept {
             buckets_.swap_first(other.buckets_);
+            std::swap(cuckoo_thread_num, other.cuckoo_thread_num);
         }
 
         class hashpower_changed {};
@@ -190,7 +246,7 @@ namespace libcuckoo {
                     //uint64_t par_ptr = buckets_.read_from_bucket_slot(i,j);
                     uint64_t par_ptr = buckets_[i].values_[j].load();
                     if( par_ptr != (uint64_t)nullptr){
-                        size_t tmp = par_ptr & ~partial_mask & ~ptr_mask;
+                        size_t tmp = par_ptr & ~partial_mask & ~ptr_mask & ~cache_ref_mask;
                         if(tmp != 0ull)
                             return false;
                     }
@@ -308,15 +364,40 @@ namespace libcuckoo {
                 return &manager[tid * ALIGN_RATIO];
             }
 
-            bool empty(){
+            //a registration the rehasher counted arrives at its barrier
+            void unregister(atomic<size_type> *record) {
+                if (record->exchange(0ul) & counted_mask) quiescence.arrive();
+            }
+
+            //Sleeps until every operation registered now has unregistered. Each live
+            //record gets the counted bit, set with a CAS so the owner either sees it on
+            //unregister or was gone already; the last one wakes us. Records that
+            //show up later see the closed rehash gate and back out on their own.
+            void wait_quiescent() {
+                quiescence.begin();
+                for (int i = 0; i < HP_MAX_THREADS; i++) {
+                    atomic<size_type> &record = manager[i * ALIGN_RATIO];
+                    size_type v = record.load();
+                    while (is_handled(v) && !(v & counted_mask)) {
+                        quiescence.add();
+                        if (record.compare_exchange_strong(v, v | counted_mask)) break;
+                        quiescence.remove();
+                    }
+                }
+                quiescence.wait();
+            }
+
+            //no operation wait_quiescent waited for is still registered. Records without
+            //the counted bit may remain, they see the closed gate and back out untouched.
+            bool quiescent(){
                 for(int i  = 0 ; i < HP_MAX_THREADS ; i++){
                     size_type store_record = manager[i * ALIGN_RATIO].load();
-                    if(is_handled(store_record)) return false;
+                    if(store_record & counted_mask) return false;
                 }
                 return true;
             }
 
-            inline size_type con_store_record(size_type hash){return hash | 1ul;}
+            inline size_type con_store_record(size_type hash){return (hash & hash_mask) | handle_mask;}
             inline bool is_handled(size_type store_record){return store_record & handle_mask;}
             inline bool equal_hash(size_type store_record,size_type hash){
                 ASSERT(is_handled(store_record),"compare record not be handled");
@@ -327,13 +408,17 @@ namespace libcuckoo {
 
             atomic<size_type> manager[HP_MAX_THREADS * ALIGN_RATIO];
 
-            size_type hash_mask = ~0x1ul;
+            size_type hash_mask = ~0x3ul;
             size_type handle_mask = 0x1ul;
+            size_type counted_mask = 0x2ul; // wait_quiescent waits for this record
+
+            QuiescenceBarrier quiescence;
 
         };
 
         struct ParRegisterDeleter {
-            void operator()(atomic<size_type> *l) const { l->store(0ul); }
+            KickHazaManager *manager;
+            void operator()(atomic<size_type> *l) const { manager->unregister(l); }
         };
 
         using ParRegisterManager = std::unique_ptr<atomic<size_type>, ParRegisterDeleter>;
@@ -351,9 +436,13 @@ namespace libcuckoo {
             //LOOP CONTROL
 
             size_t loop_count = 0;
+            //a pass after the first follows a conflict: back off (spin_wait.h), timed parks
+            //only, a reader leaving its registration wakes nobody
+            SpinWait w;
 
             while(true){
 
+                if (loop_count > 0) w.wait();
                 loop_count++;
 
                 if (loop_count >= 1000000 ){
@@ -478,6 +567,23 @@ namespace libcuckoo {
             ASSERT(is_kick_locked(par_ptr),"try kick unlock an unlocked par_ptr ");
             bool res = atomic_par_ptr.compare_exchange_strong(par_ptr, par_ptr & ~kick_lock_mask);
             ASSERT(res,"unlock failure")
+            spin_wake(spin_byte_of(&atomic_par_ptr, kick_lock_mask));
+        }
+
+        //slot word once no kick holds it. Waiters back off and then park on the byte
+        //of the kick bit (spin_wait.h), kick_unlock_par_ptr wakes them
+        inline size_type read_unkicked(bucket &b, size_type slot) const {
+            size_type par_ptr = buckets_.read_from_slot(b, slot);
+            if (!is_kick_locked(par_ptr)) return par_ptr;
+            auto unkicked = [&]() { return !is_kick_locked(par_ptr = buckets_.read_from_slot(b, slot)); };
+            SpinWait w;
+            do w.wait(unkicked, spin_byte_of(&buckets_.slot_word(b, slot), kick_lock_mask));
+            while (!unkicked());
+            return par_ptr;
+        }
+
+        inline size_type read_unkicked(size_type ind, size_type slot) const {
+            return read_unkicked(buckets_[ind], slot);
         }
 
         int try_read_from_bucket( bucket &b, const partial_t partial,
@@ -485,11 +591,7 @@ namespace libcuckoo {
 
             for (int i = 0; i < static_cast<int>(slot_per_bucket()); ++i) {
                 //block when kick
-                size_type par_ptr;
-                do{
-                    par_ptr = buckets_.read_from_slot(b,i);
-                }
-                while(is_kick_locked(par_ptr));
+                size_type par_ptr = read_unkicked(b,i);
 
                 partial_t read_partial = get_partial(par_ptr);
                 uint64_t read_ptr = get_ptr(par_ptr);
@@ -500,6 +602,7 @@ namespace libcuckoo {
                 } else if (str_equal_to()(ITEM_KEY(read_ptr), ITEM_KEY_LEN(read_ptr), key, key_len)) {
                     return i;
                 }
+                partial_false_match_l++;
             }
             return -1;
         }
@@ -526,11 +629,7 @@ namespace libcuckoo {
             slot = -1;
             for (int i = 0; i < static_cast<int>(slot_per_bucket()); ++i) {
                 //block when kick
-                size_type par_ptr;
-                do{
-                    par_ptr = buckets_.read_from_slot(b,i);
-                }
-                while(is_kick_locked(par_ptr));
+                size_type par_ptr = read_unkicked(b,i);
 
                 partial_t read_partial = get_partial(par_ptr);
                 uint64_t read_ptr = get_ptr(par_ptr);
@@ -565,8 +664,12 @@ namespace libcuckoo {
         // maximum number of slots we search when cuckooing.
         static constexpr uint8_t MAX_BFS_PATH_LEN = 5;
 
+        // Slots of a random walk path (PATH_RANDOM_WALK), and walks tried before giving up
+        static constexpr uint8_t MAX_WALK_PATH_LEN = 32;
+        static constexpr int RANDOM_WALK_TRIES = 16;
+
         // An array of CuckooRecords
-        using CuckooRecords = std::array<CuckooRecord, MAX_BFS_PATH_LEN>;
+        using CuckooRecords = std::array<CuckooRecord, MAX_WALK_PATH_LEN>;
 
         // A constexpr version of pow that we can use for various compile-time
         // constants and checks.
@@ -675,10 +778,7 @@ namespace libcuckoo {
                     uint16_t slot = (starting_slot + i) % slot_per_bucket();
 
                     //block when kick locked
-                    size_type par_ptr;
-                    do{
-                        par_ptr = buckets_.read_from_slot(b,slot);
-                    } while (is_kick_locked(par_ptr));
+                    size_type par_ptr = read_unkicked(b,slot);
 
                     partial_t kick_partial = get_partial(par_ptr);
 
@@ -733,10 +833,7 @@ namespace libcuckoo {
                  bucket &b = buckets_[first.bucket];
 
                 //block when kick locked
-                size_type par_ptr;
-                do{
-                    par_ptr = buckets_.read_from_slot(b,first.slot);
-                } while (is_kick_locked(par_ptr));
+                size_type par_ptr = read_unkicked(b,first.slot);
                 uint64_t ptr = get_ptr(par_ptr);
 
                 if (par_ptr == (uint64_t) nullptr) {
@@ -758,10 +855,7 @@ namespace libcuckoo {
                 bucket &b = buckets_[curr.bucket];
 
                 //block when kick locked
-                size_type par_ptr;
-                do{
-                    par_ptr = buckets_.read_from_slot(b,curr.slot);
-                } while (is_kick_locked(par_ptr));
+                size_type par_ptr = read_unkicked(b,curr.slot);
 
                 uint64_t ptr = get_ptr(par_ptr);
 
@@ -792,10 +886,7 @@ namespace libcuckoo {
 
                 //block when kick locked
                 bucket & b = buckets_[bucket_i];
-                size_type par_ptr;
-                do{
-                    par_ptr = buckets_.read_from_slot(b,cuckoo_path[0].slot);
-                } while (is_kick_locked(par_ptr));
+                size_type par_ptr = read_unkicked(b,cuckoo_path[0].slot);
 
                 if (par_ptr == (uint64_t) nullptr ){
                     return true;
@@ -851,6 +942,9 @@ namespace libcuckoo {
                         return false;
                 }
 
+                if (active_scans.load() > 0)
+                    scan_report_move(from.bucket * SLOT_PER_BUCKET + fs, to.bucket * SLOT_PER_BUCKET + ts, from_ptr);
+
                 buckets_.set_ptr(to.bucket,to.slot,from_par_ptr);
                 buckets_.set_ptr(from.bucket,from.slot,((uint64_t) nullptr | kick_lock_mask));
 
@@ -863,6 +957,206 @@ namespace libcuckoo {
         }
 
 
+        //PATH_RANDOM_WALK: from a random one of i1 / i2, take the first empty slot of the
+        //bucket, else kick a random slot that is not on the path yet and continue in the
+        //alternate bucket of its item. Only the buckets on the walk are read, against up to
+        //the whole 5 level tree of the BFS, for longer paths. Result as cuckoopath_search.
+        int random_walk_search(const size_type hp, CuckooRecords &cuckoo_path,
+                               const size_type i1, const size_type i2) {
+            if (walk_rand_l == 0) walk_rand_l = (uint64_t) &walk_rand_l;
+            for (int t = 0; t < RANDOM_WALK_TRIES; t++) {
+                uint64_t r = walk_rand_l = walk_rand_l * 6364136223846793005ull + 1442695040888963407ull;
+                size_type ind = (r >> 33) & 1 ? i2 : i1;
+                for (int depth = 0; depth < MAX_WALK_PATH_LEN; depth++) {
+                    CuckooRecord &curr = cuckoo_path[depth];
+                    curr.bucket = ind;
+                    bool found_empty = false;
+                    for (size_type slot = 0; slot < slot_per_bucket(); slot++) {
+                        size_type par_ptr = read_unkicked(ind, slot);
+                        if (par_ptr == (uint64_t) nullptr) {
+                            curr.slot = slot;
+                            found_empty = true;
+                            break;
+                        }
+                    }
+                    if (found_empty) return walk_fill_hv(hp, cuckoo_path, depth);
+                    if (depth == MAX_WALK_PATH_LEN - 1) break;
+
+                    r = walk_rand_l = walk_rand_l * 6364136223846793005ull + 1442695040888963407ull;
+                    const size_type start = (r >> 33) % slot_per_bucket();
+                    int chosen = -1;
+                    for (size_type k = 0; k < slot_per_bucket() && chosen == -1; k++) {
+                        size_type slot = (start + k) % slot_per_bucket();
+                        bool on_path = false;
+                        for (int p = 0; p < depth; p++)
+                            if (cuckoo_path[p].bucket == ind && cuckoo_path[p].slot == slot) on_path = true;
+                        if (!on_path) chosen = slot;
+                    }
+                    if (chosen == -1) break;
+                    curr.slot = chosen;
+
+                    size_type par_ptr = read_unkicked(ind, curr.slot);
+                    //emptied since the look above
+                    if (par_ptr == (uint64_t) nullptr) return walk_fill_hv(hp, cuckoo_path, depth);
+                    ind = alt_index(hp, get_partial(par_ptr), ind);
+                }
+            }
+            return -1;
+        }
+
+        //the walk steps on the partials of the slot words, only the items of the path
+        //found are read, like cuckoopath_search does after its BFS
+        int walk_fill_hv(const size_type hp, CuckooRecords &cuckoo_path, int depth) {
+            for (int i = 0; i < depth; i++) {
+                CuckooRecord &curr = cuckoo_path[i];
+                size_type par_ptr = read_unkicked(curr.bucket, curr.slot);
+                uint64_t ptr = get_ptr(par_ptr);
+                if (ptr == 0) return i;
+                curr.hv = hashed_key(ITEM_KEY(ptr), ITEM_KEY_LEN(ptr));
+                //the slot took another item since the walk, whose alternate bucket is not the
+                //next hop. The move only checks the hash it is given, so end the path at this
+                //full slot: the move fails on it and run_cuckoo searches again
+                if (alt_index(hp, curr.hv.partial, curr.bucket) != cuckoo_path[i + 1].bucket) return i;
+            }
+            return depth;
+        }
+
+        //PATH_LOCK_ALL: kick lock every slot of the path at once, the empty end last, check
+        //each against the search, then move the last hop first and unlock. No hop leaves a
+        //free slot behind for another insert to take, and nothing changes unless the whole
+        //path is still valid. A slot someone else holds fails the move instead of waiting,
+        //so two movers of crossing paths cannot deadlock.
+        bool cuckoopath_move_all(const size_type hp, CuckooRecords &cuckoo_path,
+                                 size_type depth, TwoBuckets &b) {
+            if (depth == 0) return cuckoopath_move(hp, cuckoo_path, depth, b);
+
+            uint64_t locked[MAX_WALK_PATH_LEN];
+            size_type n = 0;
+            auto unlock_all = [&]() {
+                for (size_type k = 0; k < n; k++)
+                    kick_unlock_par_ptr(buckets_.get_atomic_par_ptr(cuckoo_path[k].bucket, cuckoo_path[k].slot));
+            };
+            auto registered = [&](uint64_t par_ptr) {
+                uint64_t ptr = get_ptr(par_ptr);
+                return kickHazaManager.inquiry_is_registerd(hashed_key(ITEM_KEY(ptr), ITEM_KEY_LEN(ptr)).hash);
+            };
+
+            for (; n <= depth; n++) {
+                const CuckooRecord &rec = cuckoo_path[n];
+                atomic<uint64_t> &slot = buckets_.get_atomic_par_ptr(rec.bucket, rec.slot);
+                uint64_t par_ptr = (uint64_t) buckets_.deallocator->load(cuckoo_thread_id, slot);
+                if (is_kick_locked(par_ptr)) {
+                    kick_lock_failure_other_lock_l++;
+                    unlock_all();
+                    return false;
+                }
+                uint64_t ptr = get_ptr(par_ptr);
+                bool valid = n == depth ? par_ptr == (uint64_t) nullptr
+                                        : ptr != 0 && hashed_key(ITEM_KEY(ptr), ITEM_KEY_LEN(ptr)).hash == rec.hv.hash;
+                if (!valid) {
+                    kick_lock_failure_data_check_l++;
+                    unlock_all();
+                    return false;
+                }
+                if (n < depth && registered(par_ptr)) {
+                    kick_lock_failure_haza_check_l++;
+                    unlock_all();
+                    return false;
+                }
+                if (!slot.compare_exchange_strong(par_ptr, par_ptr | kick_lock_mask)) {
+                    kick_lock_failure_other_lock_l++;
+                    unlock_all();
+                    return false;
+                }
+                locked[n] = par_ptr | kick_lock_mask;
+            }
+
+            //a reader that registered between its check and our lock
+            for (size_type k = 0; k < depth; k++) {
+                if (registered(locked[k])) {
+                    kick_lock_failure_haza_check_after_l++;
+                    unlock_all();
+                    return false;
+                }
+            }
+
+            for (size_type k = depth; k > 0; k--) {
+                const CuckooRecord &from = cuckoo_path[k - 1];
+                const CuckooRecord &to = cuckoo_path[k];
+                if (active_scans.load() > 0)
+                    scan_report_move(from.bucket * SLOT_PER_BUCKET + from.slot, to.bucket * SLOT_PER_BUCKET + to.slot,
+                                     get_ptr(locked[k - 1]));
+                buckets_.set_ptr(to.bucket, to.slot, locked[k - 1]);
+            }
+            buckets_.set_ptr(cuckoo_path[0].bucket, cuckoo_path[0].slot, (uint64_t) nullptr | kick_lock_mask);
+            unlock_all();
+            return true;
+        }
+
+        //PATH_MWCAS: the path of the BFS in one multi-word CAS (mwcas.h). Every slot is
+        //checked like cuckoopath_move_all does, then the MwCAS swaps them all from what was
+        //read to the shifted path. Readers resolve the tags instead of spinning on kick locks
+        //(one that catches the move undecided fails it), another mover meeting a tag fails its
+        //own path.
+        bool cuckoopath_move_mwcas(const size_type hp, CuckooRecords &cuckoo_path,
+                                   size_type depth, TwoBuckets &b) {
+            if (depth == 0) return cuckoopath_move(hp, cuckoo_path, depth, b);
+
+            uint64_t old[MAX_WALK_PATH_LEN];
+            for (size_type k = 0; k <= depth; k++) {
+                const CuckooRecord &rec = cuckoo_path[k];
+                uint64_t par_ptr = buckets_.read_from_bucket_slot(rec.bucket, rec.slot);
+                uint64_t ptr = get_ptr(par_ptr);
+                if (is_kick_locked(par_ptr)) {
+                    kick_lock_failure_other_lock_l++;
+                    return false;
+                }
+                bool valid = k == depth ? par_ptr == (uint64_t) nullptr
+                                        : ptr != 0 && hashed_key(ITEM_KEY(ptr), ITEM_KEY_LEN(ptr)).hash == rec.hv.hash;
+                if (!valid) {
+                    kick_lock_failure_data_check_l++;
+                    return false;
+                }
+                if (k < depth && kickHazaManager.inquiry_is_registerd(rec.hv.hash)) {
+                    kick_lock_failure_haza_check_l++;
+                    return false;
+                }
+                old[k] = par_ptr;
+            }
+
+            const int tid = cuckoo_thread_id;
+            path_mwcas->begin(tid);
+            for (size_type k = 0; k <= depth; k++) {
+                const CuckooRecord &rec = cuckoo_path[k];
+                path_mwcas->add(tid, &buckets_.get_atomic_par_ptr(rec.bucket, rec.slot), old[k],
+                                k == 0 ? (uint64_t) nullptr : old[k - 1]);
+            }
+            bool registered_after = false;
+            bool ok = path_mwcas->execute(tid, [&]() {
+                //a reader that registered between the check and the install
+                for (size_type k = 0; k < depth; k++) {
+                    if (kickHazaManager.inquiry_is_registerd(cuckoo_path[k].hv.hash)) {
+                        registered_after = true;
+                        return false;
+                    }
+                }
+                return true;
+            }, [&]() {
+                //only for a move that happened: a reader may still fail it up to the decision
+                if (active_scans.load() > 0) {
+                    for (size_type k = depth; k > 0; k--)
+                        scan_report_move(cuckoo_path[k - 1].bucket * SLOT_PER_BUCKET + cuckoo_path[k - 1].slot,
+                                         cuckoo_path[k].bucket * SLOT_PER_BUCKET + cuckoo_path[k].slot,
+                                         get_ptr(old[k - 1]));
+                }
+            });
+            if (!ok) {
+                if (registered_after) kick_lock_failure_haza_check_after_l++;
+                else kick_lock_failure_data_check_after_l++;
+            }
+            return ok;
+        }
+
         cuckoo_status run_cuckoo(TwoBuckets &b, size_type &insert_bucket,
                                  size_type &insert_slot) {
             size_type hp = hashpower();
@@ -875,17 +1169,22 @@ namespace libcuckoo {
                     loop_count ++;
 
                     ASSERT(loop_count < 1000000,"MAYBE DEAD LOOP");
-                    const int depth =
-                            cuckoopath_search(hp, cuckoo_path, b.i1, b.i2);
+                    const int depth = path_strategy == PATH_RANDOM_WALK
+                                      ? random_walk_search(hp, cuckoo_path, b.i1, b.i2)
+                                      : cuckoopath_search(hp, cuckoo_path, b.i1, b.i2);
 
-                    kick_path_length_log_l[depth]++;
                     if (depth < 0) {
                         break;
                     }
+                    kick_path_length_log_l[std::min(depth, 5)]++;
 
                     //show_cuckoo_path(cuckoo_path,depth);
 
-                    if (cuckoopath_move(hp, cuckoo_path, depth, b)) {
+                    bool moved;
+                    if (path_strategy == PATH_LOCK_ALL) moved = cuckoopath_move_all(hp, cuckoo_path, depth, b);
+                    else if (path_strategy == PATH_MWCAS) moved = cuckoopath_move_mwcas(hp, cuckoo_path, depth, b);
+                    else moved = cuckoopath_move(hp, cuckoo_path, depth, b);
+                    if (moved) {
                         insert_bucket = cuckoo_path[0].bucket;
                         insert_slot = cuckoo_path[0].slot;
 
@@ -1004,7 +1303,173 @@ namespace libcuckoo {
             return str_equal_to()(ITEM_KEY(ptr), ITEM_KEY_LEN(ptr), key, key_len);
         }
 
+        //position and par_ptr of key, the caller holds pm and an epoch. Items of a mapped
+        //snapshot are read only, they get replaced by a heap copy first so the value can be
+        //written in place.
+        bool find_writable(const hash_value hv, char *key, size_type key_len, table_position &pos,
+                           uint64_t &par_ptr) {
+            while (true) {
+                TwoBuckets b = get_two_buckets(hv);
+                pos = cuckoo_find(key, key_len, hv.partial, b.i1, b.i2);
+                if (pos.status != ok) return false;
+                par_ptr = buckets_.read_from_bucket_slot(pos.index, pos.slot);
+                uint64_t ptr = get_ptr(par_ptr);
+                if (!check_ptr(ptr, key, key_len)) continue;
+#ifdef ITEM_TTL
+                if (ttl_reap(pos, par_ptr)) continue;
+#endif
+                if (ptr < buckets_.mapped_begin || ptr >= buckets_.mapped_end) return true;
+                Item *copy = buckets_.allocate_item(key, key_len, ITEM_VALUE(ptr), ITEM_VALUE_LEN(ptr));
+                if (!buckets_.try_updateKV(pos.index, pos.slot, par_ptr, merge_partial(hv.partial, (uint64_t) copy)))
+                    buckets_.deallocator->deallocate(cuckoo_thread_id, copy);
+            }
+        }
+
+        //find hit in cache mode: set the reference bit once, a hot item costs no further writes.
+        //Only an unlocked non empty word is tagged so an emptied slot never keeps a stray bit.
+        inline void cache_touch(const table_position &pos) {
+            atomic<uint64_t> &a = buckets_.get_atomic_par_ptr(pos.index, pos.slot);
+            uint64_t par_ptr = a.load(std::memory_order_relaxed);
+            if (get_ptr(par_ptr) == 0 || (par_ptr & (cache_ref_mask | kick_lock_mask))) return;
+            a.compare_exchange_strong(par_ptr, par_ptr | cache_ref_mask);
+        }
+
+        //The pair of buckets of a key that found no cuckoo path is full. CLOCK over its
+        //2 * SLOT_PER_BUCKET slots, starting at a per thread hand: a referenced item loses its
+        //bit, the first unreferenced one is unlinked with try_eraseKV and retired to DEBRA.
+        //The second round takes whatever lost its bit in the first. true once a slot is free.
+        bool cache_evict(const TwoBuckets &b) {
+            const size_type n = 2 * SLOT_PER_BUCKET;
+            size_type hand = cache_hand_l++;
+            for (size_type k = 0; k < 2 * n; k++) {
+                size_type s = (hand + k) % n;
+                size_type ind = s < SLOT_PER_BUCKET ? b.i1 : b.i2;
+                size_type slot = s % SLOT_PER_BUCKET;
+                atomic<uint64_t> &a = buckets_.get_atomic_par_ptr(ind, slot);
+                uint64_t par_ptr = a.load();
+                if (get_ptr(par_ptr) == 0) return true;
+                if (is_kick_locked(par_ptr)) continue;
+                if (par_ptr & cache_ref_mask) {
+                    a.compare_exchange_strong(par_ptr, par_ptr & ~cache_ref_mask);
+                    continue;
+                }
+                if (buckets_.try_eraseKV(ind, slot, par_ptr)) {
+                    filter_forget(get_ptr(par_ptr));
+                    evict_num.fetch_add(1, std::memory_order_relaxed);
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        //At capacity a path search over a full table is all misses, so when both buckets of a
+        //new key are full the victim is taken right away.
+        inline void cache_make_room(const hash_value hv, const TwoBuckets &b, char *key, size_type key_len) {
+            if (!cache_max_hp || hashpower() < cache_max_hp) return;
+            int s1, s2;
+            if (!try_find_insert_bucket(buckets_[b.i1], s1, hv.partial, key, key_len) || s1 != -1) return;
+            if (!try_find_insert_bucket(buckets_[b.i2], s2, hv.partial, key, key_len) || s2 != -1) return;
+            cache_evict(b);
+        }
+
+#ifdef ITEM_TTL
+        static inline ltype ttl_deadline(size_t ttl_ms) {
+            if (ttl_ms == 0) return 0;
+            ltype d = ttl_now_ms() + (ltype) ttl_ms;
+            return d == 0 ? 1 : d;
+        }
+
+        //lazy expiry: par_ptr, the caller's match at pos, is past its deadline, unlink it. The
+        //slot is not read again, so an item kicked in since the match is left alone. true when
+        //it was expired, whoever won the unlink; the caller treats the key as absent and retries.
+        //Caller holds pm and an epoch.
+        bool ttl_reap(const table_position &pos, uint64_t par_ptr) {
+            uint64_t ptr = get_ptr(par_ptr);
+            if (ptr == 0 || is_kick_locked(par_ptr) || !item_expired((Item *) ptr, ttl_now_ms())) return false;
+            if (buckets_.try_eraseKV(pos.index, pos.slot, par_ptr)) {
+                filter_forget(ptr);
+                ttl_lazy_num.fetch_add(1, std::memory_order_relaxed);
+            }
+            return true;
+        }
+
+        //One chunk of the background sweep. It registers like any operation, so a rehash
+        //waits for one chunk at most, and it starts no chunk while a rehash is pending.
+        //Expired items go through try_eraseKV; no table_mtx. Returns the items unlinked.
+        size_type ttl_sweep_chunk() {
+            const int tid = cuckoo_thread_num + MAX_SCAN_GROUPS;
+            if (rehash_gate.is_closed()) return 0;
+            ParRegisterManager pm(kickHazaManager.register_hash(tid, 0), ParRegisterDeleter{&kickHazaManager});
+            if (rehash_gate.is_closed()) return 0;
+            EpochManager epochManager(buckets_);
+
+            size_type n = bucket_num();
+            size_type begin = ttl_sweep_cursor < n ? ttl_sweep_cursor : 0;
+            size_type end = std::min(begin + TTL_SWEEP_CHUNK, n);
+            ltype now = ttl_now_ms();
+            size_type reaped = 0;
+            for (size_type i = begin; i < end; i++) {
+                for (size_type slot = 0; slot < SLOT_PER_BUCKET; slot++) {
+                    uint64_t par_ptr = buckets_.read_from_bucket_slot(i, slot);
+                    uint64_t ptr = get_ptr(par_ptr);
+                    if (ptr == 0 || is_kick_locked(par_ptr) || !item_expired((Item *) ptr, now)) continue;
+                    if (buckets_.try_eraseKV(i, slot, par_ptr)) {
+                        filter_forget(ptr);
+                        reaped++;
+                    }
+                }
+            }
+            if (end == n) {
+                ttl_sweep_cursor = 0;
+                ttl_sweep_passes.fetch_add(1, std::memory_order_relaxed);
+            } else {
+                ttl_sweep_cursor = end;
+            }
+            return reaped;
+        }
+
+        //Background sweeper thread using about cpu_pct percent of one core: after every
+        //TTL_SWEEP_BATCH chunks it sleeps (100 - cpu_pct) / cpu_pct times the time it worked.
+        void start_ttl_sweeper(int cpu_pct) {
+            ASSERT(cpu_pct > 0 && cpu_pct <= 100, "sweeper cpu budget out of range");
+            ASSERT(!ttl_sweeper.joinable(), "sweeper already running");
+            ttl_sweeper_stop.store(false);
+            ttl_sweeper = std::thread([this, cpu_pct]() {
+                cuckoo_thread_id = cuckoo_thread_num + MAX_SCAN_GROUPS;
+                buckets_.deallocator->initThread(cuckoo_thread_id);
+                while (!ttl_sweeper_stop.load()) {
+                    auto begin = std::chrono::steady_clock::now();
+                    size_type reaped = 0;
+                    for (size_t k = 0; k < TTL_SWEEP_BATCH; k++) reaped += ttl_sweep_chunk();
+                    ttl_sweep_num.fetch_add(reaped, std::memory_order_relaxed);
+                    auto busy = std::chrono::steady_clock::now() - begin;
+                    if (cpu_pct < 100) std::this_thread::sleep_for(busy * (100 - cpu_pct) / cpu_pct);
+                }
+            });
+        }
+
+        void stop_ttl_sweeper() {
+            if (!ttl_sweeper.joinable()) return;
+            ttl_sweeper_stop.store(true);
+            ttl_sweeper.join();
+        }
+
+        ~new_cuckoohash_map() { stop_ttl_sweeper(); }
+
+        //expired items unlinked by finds / inserts, by the sweeper, and full sweeps done
+        uint64_t get_ttl_lazy_num() { return ttl_lazy_num.load(); }
+        uint64_t get_ttl_sweep_num() { return ttl_sweep_num.load(); }
+        uint64_t get_ttl_sweep_passes() { return ttl_sweep_passes.load(); }
+
+        std::thread ttl_sweeper;
+        atomic<bool> ttl_sweeper_stop{false};
+        size_type ttl_sweep_cursor = 0; // sweeper thread only
+        atomic<uint64_t> ttl_lazy_num{0}, ttl_sweep_num{0}, ttl_sweep_passes{0};
+#endif
+
         uint64_t get_item_num() { return buckets_.get_item_num(); }
+        uint64_t get_limbo_size() { return buckets_.deallocator->get_limbo_size(); }
+        uint64_t get_limbo_size(int tid) { return buckets_.deallocator->get_limbo_size(tid); }
         void get_key_position_info(vector<double> & kpv){buckets_.get_key_position_info(kpv);}
 
         size_type move_bucket(buckets_t &old_buckets, buckets_t &new_buckets,
@@ -1066,8 +1531,8 @@ namespace libcuckoo {
         //guarantee that no other thread is working on this hashtable ==> haza_manageer is all empty
         void migrate_to_new(){
             //check there are no other threads working
-            ASSERT(rehash_flag.load(),"rehash not locked");
-            ASSERT(kickHazaManager.empty() ,"--kickhazamanager not empty");
+            ASSERT(rehash_gate.is_closed(),"rehash not locked");
+            ASSERT(kickHazaManager.quiescent() ,"--kickhazamanager not quiescent");
             ASSERT(check_unique(),"key not unique!");
             ASSERT(check_nolock(),"there are still locks in map!");
             cout<<"thread "<<cuckoo_thread_id<<" calling migrate function"<<endl;
@@ -1105,41 +1570,392 @@ namespace libcuckoo {
             ASSERT(check_unique(),"key not unique!");
             ASSERT(check_nolock(),"there are still locks in map!");
 
+            if (neg_filter) filter_rebuild();
+
             cout<<"-->finish rehash ,now hashpower is "<<buckets_.hashpower()<<endl;
 
         }
 
-        atomic<size_type> * block_when_rehashing(const hash_value hv ){
+        static inline bool put_in_free_slot(buckets_t &b, size_type ind, uint64_t par_ptr) {
+            for (size_type slot = 0; slot < slot_per_bucket(); slot++) {
+                if (b[ind].get_item_ptr(slot) == (uint64_t) nullptr) {
+                    b.set_ptr(ind, slot, par_ptr);
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        //free a slot of bucket ind by moving one of its items to that item's other bucket
+        bool displace_one(buckets_t &b, size_type ind) const {
+            const size_t hp = b.hashpower();
+            for (size_type slot = 0; slot < slot_per_bucket(); slot++) {
+                size_type par_ptr = b[ind].get_item_ptr(slot);
+                size_type ptr = get_ptr(par_ptr);
+                const hash_value hv = hashed_key(ITEM_KEY(ptr), ITEM_KEY_LEN(ptr));
+                const size_type ihash = index_hash(hp, hv.hash);
+                const size_type ahash = alt_index(hp, hv.partial, ihash);
+                if (put_in_free_slot(b, ind == ihash ? ahash : ihash, par_ptr)) {
+                    b.set_ptr(ind, slot, (uint64_t) nullptr);
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // The reverse of move_bucket: halving the table drops bit new_hp from the
+        // index_hash and alt_index of every key, so buckets i and i + hashsize(new_hp)
+        // both fold into bucket i. An item that finds bucket i full goes to its other
+        // bucket in the new table, or makes room in either of them by moving one resident
+        // item to its own other bucket. false when all of that fails.
+        // Items are only copied, the old bucket is left as it is.
+        bool fold_bucket(buckets_t &old_buckets, buckets_t &new_buckets, size_type old_bucket_ind) const {
+            const size_t new_hp = new_buckets.hashpower();
+            const size_type dst_bucket_ind = old_bucket_ind & hashmask(new_hp);
+            bucket &old_bucket = old_buckets[old_bucket_ind];
+
+            for (size_type old_bucket_slot = 0; old_bucket_slot < slot_per_bucket(); ++old_bucket_slot) {
+                size_type par_ptr = old_bucket.get_item_ptr(old_bucket_slot);
+                if (par_ptr == (uint64_t) nullptr) continue;
+                if (put_in_free_slot(new_buckets, dst_bucket_ind, par_ptr)) continue;
+
+                size_type ptr = get_ptr(par_ptr);
+                const hash_value hv = hashed_key(ITEM_KEY(ptr), ITEM_KEY_LEN(ptr));
+                const size_type new_ihash = index_hash(new_hp, hv.hash);
+                const size_type new_ahash = alt_index(new_hp, hv.partial, new_ihash);
+                ASSERT(dst_bucket_ind == new_ihash || dst_bucket_ind == new_ahash, "fold bucket index error");
+                const size_type other_bucket_ind = dst_bucket_ind == new_ihash ? new_ahash : new_ihash;
+                if (put_in_free_slot(new_buckets, other_bucket_ind, par_ptr)) continue;
+                if (displace_one(new_buckets, dst_bucket_ind)) {
+                    put_in_free_slot(new_buckets, dst_bucket_ind, par_ptr);
+                } else if (displace_one(new_buckets, other_bucket_ind)) {
+                    put_in_free_slot(new_buckets, other_bucket_ind, par_ptr);
+                } else {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        //same guarantees as migrate_to_new
+        //false: some bucket pair overflowed, the table is left as it was
+        bool migrate_to_smaller(){
+            ASSERT(rehash_gate.is_closed(),"rehash not locked");
+            ASSERT(kickHazaManager.quiescent() ,"--kickhazamanager not quiescent");
+            ASSERT(check_nolock(),"there are still locks in map!");
+            ASSERT(hashpower() > 1,"hashpower too small to shrink");
+            cout<<"thread "<<cuckoo_thread_id<<" calling shrink function"<<endl;
+
+            size_type start_old_num = buckets_.get_item_num();
+
+            buckets_t new_buckets_(hashpower() - 1);
+            for(size_type i = 0 ; i < buckets_.size(); i++){
+                if(!fold_bucket(buckets_,new_buckets_,i)){
+                    //new_buckets_ is not ready_to_destory, it goes away without touching the items
+                    cout<<"-->shrink abort, bucket "<<i<<" overflow"<<endl;
+                    return false;
+                }
+            }
+            ASSERT(new_buckets_.get_item_num() == start_old_num,"shrink num error");
+
+            for(size_type i = 0 ; i < buckets_.size(); i++){
+                for(size_type j = 0; j < slot_per_bucket(); j++) buckets_.set_ptr(i, j, (uint64_t) nullptr);
+            }
+
+            buckets_.swap(new_buckets_);
+            new_buckets_.set_ready_to_destory();
+
+            ASSERT(buckets_.get_item_num() == start_old_num,"swap buckets error");
+            ASSERT(check_unique(),"key not unique!");
+            if (neg_filter) filter_rebuild();
+
+            cout<<"-->finish shrink ,now hashpower is "<<buckets_.hashpower()<<endl;
+            return true;
+        }
+
+        //load factor over SHRINK_SAMPLE_BUCKETS evenly spread buckets, caller must be registered
+        double sample_load_factor() {
+            size_type stride = buckets_.size() > SHRINK_SAMPLE_BUCKETS ? buckets_.size() / SHRINK_SAMPLE_BUCKETS : 1;
+            size_type used = 0, seen = 0;
+            for (size_type i = 0; i < buckets_.size(); i += stride, seen++) {
+                for (size_type j = 0; j < slot_per_bucket(); j++) {
+                    if (buckets_[i].get_item_ptr(j) != (uint64_t) nullptr) used++;
+                }
+            }
+            return used * 1.0 / (seen * slot_per_bucket());
+        }
+
+        //take the rehash lock the way insert does and halve the table if the exact load factor
+        //is still under the threshold, caller must not be registered
+        void try_shrink() {
+            if (!rehash_gate.try_close()) return;
+            wait_for_other_thread_finish();
+
+            double lf = buckets_.get_item_num() * 1.0 / slot_num();
+            if (hashpower() > 1 && lf < shrink_threshold) {
+                if (rehash_hook) rehash_hook(true);
+                bool done = migrate_to_smaller();
+                if (rehash_hook) rehash_hook(false);
+                //after an overflow wait until the table is clearly emptier before trying again
+                shrink_retry_lf = done ? 1.0 : lf * 0.75;
+            }
+            rehash_gate.open();
+        }
+
+        struct BulkEntry {
+            uint64_t par_ptr;
+            size_type hash;
+        };
+
+        //place par_ptr in bucket i or its alternate, random walk displacement when both are
+        //full. false: some item is left without a slot after BULK_MAX_WALK steps, par_ptr
+        //then holds it.
+        static bool bulk_place(buckets_t &b, uint64_t &par_ptr, size_type i, std::mt19937_64 &rng) {
+            const size_type hp = b.hashpower();
+            for (size_t step = 0; step < BULK_MAX_WALK; step++) {
+                partial_t partial = static_cast<partial_t>((par_ptr & partial_mask) >> partial_offset);
+                size_type alt = alt_index(hp, partial, i);
+                if (put_in_free_slot(b, i, par_ptr) || put_in_free_slot(b, alt, par_ptr)) return true;
+                //kick a random resident of the alternate bucket, it then has to go to its own alternate
+                size_type slot = rng() % SLOT_PER_BUCKET;
+                atomic<uint64_t> &victim = b.get_atomic_par_ptr(alt, slot);
+                uint64_t victim_par_ptr = victim.load(std::memory_order_relaxed);
+                victim.store(par_ptr, std::memory_order_relaxed);
+                par_ptr = victim_par_ptr;
+                i = alt;
+            }
+            return false;
+        }
+
+        //Offline load of distinct keys before any thread uses the map, whatever it holds is
+        //dropped. [first, last) yields records with key / key_len / value / value_len (like
+        //Request in table_test). The table is sized for the count up front. Items are
+        //allocated and hashed by thread_num threads, scattered by primary bucket range, and
+        //every thread fills its own range with plain stores. What does not fit in its primary
+        //bucket is displaced offline afterwards; if that fails the table is rebuilt one
+        //hashpower larger.
+        template<typename It>
+        void bulk_load(It first, It last, int thread_num) {
+            const size_t count = last - first;
+            size_type hp = hashpower();
+            while (hashsize(hp) * SLOT_PER_BUCKET * BULK_LOAD_FACTOR < count) hp++;
+
+            //parts[src * thread_num + dst]: items hashed by src whose primary bucket is in dst's range
+            std::vector<std::vector<BulkEntry>> parts(thread_num * thread_num);
+            std::vector<std::thread> threads;
+            for (int t = 0; t < thread_num; t++) {
+                threads.emplace_back([&, t]() {
+                    size_t step = count / thread_num;
+                    size_t begin = t * step, end = t == thread_num - 1 ? count : begin + step;
+                    for (size_t i = begin; i < end; i++) {
+                        auto &rec = first[i];
+                        Item *p = (Item *) buckets_.deallocator->allocate(t, ITEM_LEN_ALLOC(rec.key_len, rec.value_len));
+                        ASSERT(p != nullptr, "malloc failure");
+                        init_item(p, rec.key, rec.key_len, rec.value, rec.value_len);
+                        const hash_value hv = hashed_key(rec.key, rec.key_len);
+                        size_type dst = index_hash(hp, hv.hash) * thread_num / hashsize(hp);
+                        parts[t * thread_num + dst].push_back(
+                                BulkEntry{merge_partial(hv.partial, (uint64_t) p), hv.hash});
+                    }
+                });
+            }
+            for (auto &th : threads) th.join();
+
+            while (true) {
+                buckets_t new_buckets_(hp);
+                std::vector<std::vector<BulkEntry>> overflow(thread_num);
+                threads.clear();
+                for (int t = 0; t < thread_num; t++) {
+                    threads.emplace_back([&, t]() {
+                        for (int src = 0; src < thread_num; src++) {
+                            for (auto &e : parts[src * thread_num + t]) {
+                                if (!put_in_free_slot(new_buckets_, index_hash(hp, e.hash), e.par_ptr))
+                                    overflow[t].push_back(e);
+                            }
+                        }
+                    });
+                }
+                for (auto &th : threads) th.join();
+
+                bool placed = true;
+                std::mt19937_64 rng(hp);
+                for (int t = 0; t < thread_num && placed; t++) {
+                    for (auto &e : overflow[t]) {
+                        uint64_t par_ptr = e.par_ptr;
+                        if (!bulk_place(new_buckets_, par_ptr, index_hash(hp, e.hash), rng)) {
+                            placed = false;
+                            break;
+                        }
+                    }
+                }
+                if (placed) {
+                    buckets_.swap(new_buckets_);
+                    if (neg_filter) filter_rebuild();
+                    return;
+                }
+                cout << "bulk load overflow at hashpower " << hp << ", rebuild with " << hp + 1 << endl;
+                hp++;
+            }
+        }
+
+        static inline uint64_t snapshot_item_len(uint64_t ptr) { return (ITEM_LEN(ptr) + 7) & ~7ull; }
+
+        //the item at ptr, header and lengths, lies within the room bytes left in the file
+        static bool snapshot_item_fits(uint64_t ptr, uint64_t room) {
+            if (room < sizeof(Item)) return false;
+#ifdef FIX_LEN
+            return true;
+#else
+            return (uint64_t) ITEM_KEY_LEN(ptr) + ITEM_VALUE_LEN(ptr) <= room - sizeof(Item);
+#endif
+        }
+
+        //Stops the world like migrate_to_new, the caller must not be registered.
+        //false on an I/O error, the file is then incomplete.
+        bool save_snapshot(const char *path) {
+            rehash_gate.close();
+            wait_for_other_thread_finish();
+            bool ok = write_snapshot(path);
+            rehash_gate.open();
+            return ok;
+        }
+
+        bool write_snapshot(const char *path) {
+            FILE *f = fopen(path, "wb");
+            if (f == nullptr) return false;
+
+            const size_type slots = slot_num();
+            SnapshotHeader header{SNAPSHOT_MAGIC, SNAPSHOT_VERSION, (uint32_t) SLOT_PER_BUCKET, hashpower(), 0, 0};
+            uint64_t offset = sizeof(SnapshotHeader) + slots * sizeof(uint64_t);
+
+            //slot array first: walk once to hand out offsets, then again to write the items
+            std::vector<uint64_t> buf;
+            buf.reserve(1 << 16);
+            bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+            for (size_type k = 0; k < slots && ok; k++) {
+                uint64_t par_ptr = buckets_[k / SLOT_PER_BUCKET].get_item_ptr(k % SLOT_PER_BUCKET);
+                uint64_t ptr = get_ptr(par_ptr);
+                if (ptr == 0) {
+                    buf.push_back(0);
+                } else {
+                    buf.push_back((par_ptr & partial_mask) | offset);
+                    offset += snapshot_item_len(ptr);
+                    header.item_num++;
+                }
+                if (buf.size() == buf.capacity() || k == slots - 1) {
+                    ok = fwrite(buf.data(), sizeof(uint64_t), buf.size(), f) == buf.size();
+                    buf.clear();
+                }
+            }
+            static const char zero[8] = {0};
+            for (size_type k = 0; k < slots && ok; k++) {
+                uint64_t ptr = get_ptr(buckets_[k / SLOT_PER_BUCKET].get_item_ptr(k % SLOT_PER_BUCKET));
+                if (ptr == 0) continue;
+                uint64_t len = ITEM_LEN(ptr);
+                ok = fwrite((void *) ptr, 1, len, f) == len &&
+                     fwrite(zero, 1, snapshot_item_len(ptr) - len, f) == snapshot_item_len(ptr) - len;
+            }
+
+            header.file_len = offset;
+            ok = ok && fseek(f, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, f) == 1;
+            return fclose(f) == 0 && ok;
+        }
+
+        //Only on a map no thread is using yet, whatever it holds is dropped. The file stays
+        //mapped for the lifetime of the map: items point into it and are never freed, only
+        //the slots are rebuilt, one linear pass and no hashing.
+        bool load_snapshot(const char *path) {
+            int fd = open(path, O_RDONLY);
+            if (fd < 0) return false;
+            struct stat st;
+            if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(SnapshotHeader)) {
+                close(fd);
+                return false;
+            }
+            void *base = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+            close(fd);
+            if (base == MAP_FAILED) return false;
+
+            //a truncated or corrupted file must not send us outside the mapping
+            const SnapshotHeader &header = *(SnapshotHeader *) base;
+            const uint64_t file_len = st.st_size;
+            bool valid = header.magic == SNAPSHOT_MAGIC && header.version == SNAPSHOT_VERSION &&
+                         header.slot_per_bucket == SLOT_PER_BUCKET && header.file_len == file_len &&
+                         header.hashpower < 48;
+            const uint64_t slot_count = valid ? hashsize(header.hashpower) * SLOT_PER_BUCKET : 0;
+            const uint64_t items_begin = sizeof(SnapshotHeader) + slot_count * sizeof(uint64_t);
+            valid = valid && items_begin <= file_len;
+            const uint64_t *slots = (const uint64_t *) ((char *) base + sizeof(SnapshotHeader));
+            for (size_type k = 0; k < slot_count && valid; k++) {
+                if (slots[k] == 0) continue;
+                uint64_t off = slots[k] & ptr_mask;
+                valid = off >= items_begin && off < file_len &&
+                        snapshot_item_fits((uint64_t) base + off, file_len - off);
+            }
+            if (!valid) {
+                munmap(base, st.st_size);
+                return false;
+            }
+
+            buckets_t new_buckets_(header.hashpower);
+            for (size_type k = 0; k < slot_count; k++) {
+                if (slots[k] == 0) continue;
+                new_buckets_.set_ptr(k / SLOT_PER_BUCKET, k % SLOT_PER_BUCKET,
+                                     (slots[k] & partial_mask) | ((uint64_t) base + (slots[k] & ptr_mask)));
+            }
+            buckets_.swap(new_buckets_);
+            buckets_.mapped_begin = (uint64_t) base;
+            buckets_.mapped_end = (uint64_t) base + st.st_size;
+            if (neg_filter) filter_rebuild();
+            return true;
+        }
+
+        //sleeps through a rehash at the gate, the registration lets the rehasher wait for us
+        ParRegisterManager block_when_rehashing(const hash_value hv ){
             atomic<size_type> * tmp_handle;
 
 
             while(true){
 
-                while( rehash_flag.load() ){pthread_yield();}
+                rehash_gate.wait_open();
 
                 tmp_handle = kickHazaManager.register_hash(cuckoo_thread_id,hv.hash);
 
-                if(!rehash_flag.load()) break;
+                if(!rehash_gate.is_closed()) break;
 
-                tmp_handle->store(0ul);
+                kickHazaManager.unregister(tmp_handle);
 
             }
 
-            return tmp_handle;
+            return ParRegisterManager(tmp_handle, ParRegisterDeleter{&kickHazaManager});
         }
 
+        //An insert found no cuckoo path: the first thread to close rehash_gate doubles the table
+        //unless someone already did (ABA), the others just retry. pm is released first since
+        //migrate_to_new waits for every registered thread.
+        void grow_after_full(ParRegisterManager &pm, size_type old_hashpower) {
+            kickHazaManager.unregister(pm.get());
+            if (!rehash_gate.try_close()) return;
+            if (old_hashpower == hashpower()) {
+                wait_for_other_thread_finish();
+
+                if (rehash_hook) rehash_hook(true);
+                migrate_to_new();
+                if (rehash_hook) rehash_hook(false);
+            }
+            rehash_gate.open();
+        }
+
+        //the rehash gate is closed by the caller, so this only waits for operations in flight
         inline void wait_for_other_thread_finish(){
-            while(!kickHazaManager.empty()){pthread_yield();}
+            kickHazaManager.wait_quiescent();
         }
 
 
         inline bool check_insert_unique(table_position pos,TwoBuckets b,hash_value hv,Item * item){
             size_type  par_ptr;
             for(int i = 0; i < pos.slot ; i++) {
-                do{
-                    par_ptr = buckets_.read_from_bucket_slot(pos.index,i);
-                }
-                while(is_kick_locked(par_ptr));
+                par_ptr = read_unkicked(pos.index,i);
 
                 size_type par = get_partial(par_ptr);
                 size_type ptr = get_ptr(par_ptr);
@@ -1152,10 +1968,7 @@ namespace libcuckoo {
             }
             if(pos.index == b.i2){
                 for(int i = 0; i < slot_per_bucket() ; i++) {
-                    do{
-                        par_ptr = buckets_.read_from_bucket_slot(b.i1,i);
-                    }
-                    while(is_kick_locked(par_ptr));
+                    par_ptr = read_unkicked(b.i1,i);
                     size_type par = get_partial(par_ptr);
                     size_type ptr = get_ptr(par_ptr);
                     if(par == hv.partial &&
@@ -1173,6 +1986,206 @@ namespace libcuckoo {
             buckets_.deallocator->initThread(tid);
         }
 
+        // Weakly consistent scans.
+        // A scan walks the slots in order, split into part_num ranges; cursor[p] is the
+        // next slot range p will visit. A slot is visited while holding its kick lock, and a
+        // kicker checks the cursors while holding the kick locks of both slots it moves
+        // between, so the two always agree on whether a slot has been visited. An item a
+        // kicker moves from an unvisited slot to a visited one goes to late; one moved from
+        // a visited slot to an unvisited one goes to skip, since it was handed out already.
+        // Keys that are neither inserted, erased nor updated during the scan are handed out
+        // exactly once. The scan registers like a reader, so no rehash starts while it
+        // runs, and holds one epoch, so every item it hands out stays readable until it ends.
+        struct ScanGroup {
+            std::mutex mtx;
+            std::atomic<bool> active{false};
+            int part_num = 0;
+            size_type part_len = 0, slot_total = 0;
+            std::atomic<size_type> cursor[MAX_SCAN_PARTS];
+            std::unordered_set<uint64_t> skip;
+            std::atomic<size_type> skip_num{0};
+            std::vector<uint64_t> late;
+            atomic<size_type> *registration = nullptr;
+
+            inline size_type part_begin(int p) const { return p * part_len; }
+
+            inline size_type part_end(int p) const { return p == part_num - 1 ? slot_total : (p + 1) * part_len; }
+
+            inline bool visited(size_type k) const {
+                size_type p = k / part_len;
+                if (p >= part_num) p = part_num - 1;
+                return k < cursor[p].load();
+            }
+        };
+
+        ScanGroup scan_groups[MAX_SCAN_GROUPS];
+        std::mutex scan_mtx;
+        atomic<int> active_scans{0};
+
+        int begin_scan(int part_num) {
+            ASSERT(part_num > 0 && part_num <= MAX_SCAN_PARTS, "scan part_num out of range");
+            int g;
+            SpinWait w;
+            while (true) {
+                {
+                    std::lock_guard<std::mutex> guard(scan_mtx);
+                    for (g = 0; g < MAX_SCAN_GROUPS; g++) if (!scan_groups[g].active.load()) break;
+                    if (g < MAX_SCAN_GROUPS) {
+                        scan_groups[g].active.store(true);
+                        break;
+                    }
+                }
+                w.wait();
+            }
+            ScanGroup &sg = scan_groups[g];
+            int tid = cuckoo_thread_num + g;
+            buckets_.deallocator->initThread(tid);
+
+            //same as block_when_rehashing, with the scan's own slot
+            while (true) {
+                rehash_gate.wait_open();
+                sg.registration = kickHazaManager.register_hash(tid, 0);
+                if (!rehash_gate.is_closed()) break;
+                kickHazaManager.unregister(sg.registration);
+            }
+            buckets_.deallocator->startOp(tid);
+
+            {
+                std::lock_guard<std::mutex> guard(sg.mtx);
+                sg.slot_total = slot_num();
+                sg.part_num = std::min((size_type) part_num, sg.slot_total);
+                sg.part_len = sg.slot_total / sg.part_num;
+                for (int p = 0; p < sg.part_num; p++) sg.cursor[p].store(sg.part_begin(p));
+                sg.skip.clear();
+                sg.skip_num.store(0);
+                sg.late.clear();
+            }
+            active_scans++;
+            return g;
+        }
+
+        void end_scan(int g) {
+            ScanGroup &sg = scan_groups[g];
+            active_scans--;
+            {
+                std::lock_guard<std::mutex> guard(sg.mtx);
+                sg.part_num = 0;
+                sg.skip.clear();
+                sg.late.clear();
+            }
+            buckets_.deallocator->endOp(cuckoo_thread_num + g);
+            kickHazaManager.unregister(sg.registration);
+            sg.active.store(false);
+        }
+
+        //visit slot k of part p, returns the item to hand out or 0
+        uint64_t scan_visit(ScanGroup &sg, int p, size_type k) {
+            atomic<uint64_t> &atomic_par_ptr = buckets_.get_atomic_par_ptr(k / SLOT_PER_BUCKET, k % SLOT_PER_BUCKET);
+            SpinWait w;
+            while (!try_kick_lock_par_ptr(atomic_par_ptr))
+                w.wait([&]() { return !is_kick_locked(atomic_par_ptr.load()); },
+                       spin_byte_of(&atomic_par_ptr, kick_lock_mask));
+            uint64_t ptr = get_ptr(atomic_par_ptr.load());
+            sg.cursor[p].store(k + 1);
+            kick_unlock_par_ptr(atomic_par_ptr);
+
+            if (ptr != 0 && sg.skip_num.load() > 0) {
+                std::lock_guard<std::mutex> guard(sg.mtx);
+                if (sg.skip.erase(ptr)) {
+                    sg.skip_num--;
+                    return 0;
+                }
+            }
+            return ptr;
+        }
+
+        //called by a kicker holding the kick locks of both slots
+        void scan_report_move(size_type from_k, size_type to_k, uint64_t ptr) {
+            for (int g = 0; g < MAX_SCAN_GROUPS; g++) {
+                ScanGroup &sg = scan_groups[g];
+                if (!sg.active.load()) continue;
+                std::lock_guard<std::mutex> guard(sg.mtx);
+                if (sg.part_num == 0) continue;
+                bool from_visited = sg.visited(from_k), to_visited = sg.visited(to_k);
+                if (from_visited == to_visited) continue;
+                if (from_visited) {
+                    sg.skip.insert(ptr);
+                    sg.skip_num++;
+                } else if (sg.skip.erase(ptr)) {
+                    sg.skip_num--;
+                } else {
+                    sg.late.push_back(ptr);
+                }
+            }
+        }
+
+        std::vector<uint64_t> scan_take_late(ScanGroup &sg) {
+            std::vector<uint64_t> late;
+            std::lock_guard<std::mutex> guard(sg.mtx);
+            late.swap(sg.late);
+            return late;
+        }
+
+        //Pull style scan on the calling thread. key / value point into the item and stay
+        //valid until the iterator is destroyed. The thread may use the map between next()
+        //calls, but must not insert into it: a rehash would wait for this scan to end.
+        class ScanIterator {
+        public:
+            explicit ScanIterator(new_cuckoohash_map &map) : map_(map), g_(map.begin_scan(1)), k_(0),
+                                                              late_taken_(false), late_pos_(0) {}
+
+            ~ScanIterator() { map_.end_scan(g_); }
+
+            bool next(char *&key, size_t &key_len, char *&value, size_t &value_len) {
+                ScanGroup &sg = map_.scan_groups[g_];
+                uint64_t ptr = 0;
+                while (ptr == 0 && k_ < sg.slot_total) ptr = map_.scan_visit(sg, 0, k_++);
+                if (ptr == 0) {
+                    if (!late_taken_) {
+                        late_ = map_.scan_take_late(sg);
+                        late_taken_ = true;
+                    }
+                    if (late_pos_ == late_.size()) return false;
+                    ptr = late_[late_pos_++];
+                }
+                key = ITEM_KEY(ptr);
+                key_len = ITEM_KEY_LEN(ptr);
+                value = ITEM_VALUE(ptr);
+                value_len = ITEM_VALUE_LEN(ptr);
+                return true;
+            }
+
+        private:
+            new_cuckoohash_map &map_;
+            int g_;
+            size_type k_;
+            bool late_taken_;
+            std::vector<uint64_t> late_;
+            size_t late_pos_;
+        };
+
+        //f(char *key, size_t key_len, char *value, size_t value_len) on every item, the slots
+        //are split across worker_num threads. Same guarantees as ScanIterator; f runs on the
+        //scan threads and must not call into the map.
+        template<typename F>
+        void for_each(F f, int worker_num = 1) {
+            int g = begin_scan(worker_num);
+            ScanGroup &sg = scan_groups[g];
+            std::vector<std::thread> workers;
+            for (int p = 0; p < sg.part_num; p++) {
+                workers.emplace_back([this, &sg, &f, p]() {
+                    for (size_type k = sg.part_begin(p); k < sg.part_end(p); k++) {
+                        uint64_t ptr = scan_visit(sg, p, k);
+                        if (ptr != 0) f(ITEM_KEY(ptr), (size_t) ITEM_KEY_LEN(ptr), ITEM_VALUE(ptr), (size_t) ITEM_VALUE_LEN(ptr));
+                    }
+                });
+            }
+            for (auto &w : workers) w.join();
+            for (uint64_t ptr : scan_take_late(sg))
+                f(ITEM_KEY(ptr), (size_t) ITEM_KEY_LEN(ptr), ITEM_VALUE(ptr), (size_t) ITEM_VALUE_LEN(ptr));
+            end_scan(g);
+        }
+
         class EpochManager{
             friend class new_cuckoohash_map;
 
@@ -1189,15 +2202,120 @@ namespace libcuckoo {
         //true hit , false miss
         bool find(char *key, size_t len);
 
+        //ttl_ms: the item expires that long after the call, 0 never. Needs ITEM_TTL.
+
         //true insert , false key failure_key_duplicated
-        bool insert(char *key, size_t key_len, char *value, size_t value_len);
+        bool insert(char *key, size_t key_len, char *value, size_t value_len, size_t ttl_ms = 0);
 
-        bool insert_or_assign(char *key, size_t key_len, char *value, size_t value_len);
+        bool insert_or_assign(char *key, size_t key_len, char *value, size_t value_len, size_t ttl_ms = 0);
 
         //true erase success, false miss
         bool erase(char *key, size_t key_len);
 
-        atomic<bool> rehash_flag;
+        //In place updates of 8 byte values, no Item is allocated or retired. They are atomic
+        //with respect to each other, finds and erase, but an insert_or_assign of the same key
+        //swaps the whole Item and may swallow an in place update that races with it. A value
+        //of another size is left alone and counts as a miss.
+
+        //true hit, old gets the value before the add
+        bool fetch_add(char *key, size_t key_len, uint64_t delta, uint64_t &old);
+
+        //true value was expected and is now desired. false on a miss with expected untouched,
+        //or on a mismatch with expected set to the current value.
+        bool compare_and_swap_value(char *key, size_t key_len, uint64_t &expected, uint64_t desired);
+
+        //key present: fn(value, value_len) runs on the value in place while the slot is kick
+        //locked, excluding insert_or_assign, erase, kicks and other upsert_fn of the key
+        //(readers spin meanwhile), returns false. Key absent: inserts (key, value), returns true.
+        template<typename F>
+        bool upsert_fn(char *key, size_t key_len, F fn, char *value, size_t value_len) {
+            const hash_value hv = hashed_key(key, key_len);
+            while (true) {
+                {
+                    ParRegisterManager pm(block_when_rehashing(hv));
+                    EpochManager epochManager(buckets_);
+                    table_position pos;
+                    uint64_t par_ptr;
+                    if (find_writable(hv, key, key_len, pos, par_ptr)) {
+                        atomic<uint64_t> &slot = buckets_.get_atomic_par_ptr(pos.index, pos.slot);
+                        uint64_t unlocked = par_ptr & ~kick_lock_mask;
+                        if (!slot.compare_exchange_strong(unlocked, unlocked | kick_lock_mask)) continue;
+                        uint64_t ptr = get_ptr(unlocked);
+                        fn(ITEM_VALUE(ptr), (size_t) ITEM_VALUE_LEN(ptr));
+                        kick_unlock_par_ptr(slot);
+                        return false;
+                    }
+                }
+                //insert takes its own rehash registration
+                if (insert(key, key_len, value, value_len)) return true;
+            }
+        }
+
+        //optional instrumentation, called by the migrating thread right before and after migrate_to_new
+        void (*rehash_hook)(bool begin) = nullptr;
+
+        //erase halves the table once the load factor falls under this, 0 never shrinks.
+        //Keep it well under 0.5 or the next inserts grow the table right back.
+        void set_shrink_threshold(double lf) { shrink_threshold = lf; }
+
+        //Cache mode: the table grows up to max_hp, past that an insert / insert_or_assign that
+        //finds no cuckoo path evicts from the key's two buckets instead (cache_evict) and finds
+        //keep a CLOCK reference bit in the slot word. 0 turns it off.
+        void set_cache_capacity(size_type max_hp) { cache_max_hp = max_hp; }
+
+        uint64_t get_evict_num() { return evict_num.load(); }
+
+        //Negative lookup filter: a counting blocked Bloom filter (negative_filter.h) in front
+        //of find. Inserts count the key before publishing it, unlinks (erase, eviction, expiry)
+        //drop it afterwards, so it never hides a present key. Resizes rebuild it from the
+        //table while everyone else is blocked. Call while no operation is running.
+        void enable_negative_filter() { filter_rebuild(); }
+
+        uint64_t get_filter_bytes() { return neg_filter ? neg_filter->bytes() : 0; }
+
+        //quiescent: a fresh filter sized with the table, filled from every slot
+        void filter_rebuild() {
+            neg_filter.reset(new NegativeFilter(slot_num()));
+            for (size_type i = 0; i < buckets_.size(); i++) {
+                for (size_type j = 0; j < slot_per_bucket(); j++) {
+                    uint64_t ptr = get_ptr(buckets_.read_from_bucket_slot(i, j));
+                    if (ptr != 0) neg_filter->add(hashed_key(ITEM_KEY(ptr), ITEM_KEY_LEN(ptr)).hash);
+                }
+            }
+        }
+
+        //after an unlink of ptr, caller still in the epoch that read it
+        inline void filter_forget(uint64_t ptr) {
+            if (neg_filter) neg_filter->remove(hashed_key(ITEM_KEY(ptr), ITEM_KEY_LEN(ptr)).hash);
+        }
+
+        std::unique_ptr<NegativeFilter> neg_filter;
+
+        //How an insert into two full buckets finds and moves its cuckoo path:
+        //PATH_BFS         breadth first search up to MAX_BFS_PATH_LEN, moved hop by hop
+        //PATH_RANDOM_WALK random walk up to MAX_WALK_PATH_LEN, moved hop by hop
+        //PATH_LOCK_ALL    breadth first search, the whole path locked and moved at once
+        //PATH_MWCAS       breadth first search, the whole path moved by one multi-word CAS
+        //Call while no operation is running.
+        enum PathStrategy { PATH_BFS = 0, PATH_RANDOM_WALK, PATH_LOCK_ALL, PATH_MWCAS };
+
+        void set_path_strategy(PathStrategy s) {
+            path_strategy = s;
+            if (s == PATH_MWCAS && !path_mwcas) path_mwcas.reset(new SlotMwCAS(cuckoo_thread_num + MAX_SCAN_GROUPS + 1));
+            buckets_.mwcas = s == PATH_MWCAS ? path_mwcas.get() : nullptr;
+        }
+
+        PathStrategy path_strategy = PATH_BFS;
+        std::unique_ptr<SlotMwCAS> path_mwcas;
+
+        size_type cache_max_hp = 0;
+        atomic<uint64_t> evict_num{0};
+
+        double shrink_threshold = 0;
+        double shrink_retry_lf = 1.0;
+
+        //closed while one thread rehashes, snapshots or shrinks; everybody else waits at it
+        WaitGate rehash_gate;
 
         mutable buckets_t buckets_;
 
@@ -1212,29 +2330,45 @@ namespace libcuckoo {
         const hash_value hv = hashed_key(key, key_len);
 
         ParRegisterManager pm(block_when_rehashing(hv));
+        EpochManager epochManager(buckets_);
+
+        if (neg_filter && !neg_filter->may_contain(hv.hash)) {
+            filter_negative_l++;
+            return false;
+        }
 
-        TwoBuckets b = get_two_buckets(hv);
-        table_position pos = cuckoo_find(key, key_len, hv.partial, b.i1, b.i2);
-        if (pos.status == ok) {
+        while (true) {
+            TwoBuckets b = get_two_buckets(hv);
+            table_position pos = cuckoo_find(key, key_len, hv.partial, b.i1, b.i2);
+            if (pos.status != ok) {
+                if (neg_filter) filter_false_positive_l++;
+                return false;
+            }
 
-            //do some thing
+            //the slot may have been erased or kicked away since cuckoo_find matched it, look again
             size_t par_ptr = buckets_.read_from_bucket_slot(pos.index,pos.slot);
-            size_t ptr = get_ptr(par_ptr);
-            bool a = str_equal_to()(ITEM_KEY(ptr),ITEM_KEY_LEN(ptr),key,key_len);
-            ASSERT(a,"key error");
+            if (!check_ptr(get_ptr(par_ptr), key, key_len)) continue;
             buckets_.deallocator->read(cuckoo_thread_id);
+#ifdef ITEM_TTL
+            if (ttl_reap(pos, par_ptr)) return false;
+#endif
+            if (cache_max_hp) cache_touch(pos);
             return true;
         }
-        return false;
     }
 
 
 
-    bool new_cuckoohash_map::insert(char *key, size_t key_len, char *value, size_t value_len) {
+    bool new_cuckoohash_map::insert(char *key, size_t key_len, char *value, size_t value_len, size_t ttl_ms) {
         while(true){
 
             //Item *item = allocate_item(key, key_len, value, value_len);
             Item * item = buckets_.allocate_item(key,key_len,value,value_len);
+#ifdef ITEM_TTL
+            item->expire = ttl_deadline(ttl_ms);
+#else
+            ASSERT(ttl_ms == 0, "ttl needs ITEM_TTL");
+#endif
             const hash_value hv = hashed_key(key, key_len);
 
             ParRegisterManager pm(block_when_rehashing(hv));
@@ -1246,42 +2380,42 @@ namespace libcuckoo {
 
             try {
 
+                cache_make_room(hv, b, key, key_len);
                 pos = cuckoo_insert_loop(hv, b, key, key_len);
 
             }catch (need_rehash){
 
-                pm.get()->store(0ul);
-
-                bool old_flag = false;
-                if(rehash_flag.compare_exchange_strong(old_flag,true)){
-
-                    if(old_hashpower != hashpower()){
-                        //ABA,other thread has finished rehash.release rehash_flag and redo
-                        rehash_flag.store(false);
-                        continue;
-                    }else{
-                        wait_for_other_thread_finish();
-
-                        migrate_to_new();
-
-                        rehash_flag.store(false);
-
-                        continue;
-                    }
-
-                }else{
+                if (cache_max_hp && old_hashpower >= cache_max_hp) {
+                    cache_evict(b);
+                    buckets_.deallocator->deallocate(cuckoo_thread_id, item);
                     continue;
                 }
 
+                buckets_.deallocator->deallocate(cuckoo_thread_id, item);
+                grow_after_full(pm, old_hashpower);
+                continue;
+
             }
 
             if (pos.status == ok) {
+                //counted before it is visible, so a find never filters out a present key
+                if (neg_filter) neg_filter->add(hv.hash);
                 if (buckets_.try_insertKV(pos.index, pos.slot, merge_partial(hv.partial, (uint64_t) item))) {
                     return true;
                     //return check_insert_unique(pos,b,hv,item);
                 }
+                if (neg_filter) neg_filter->remove(hv.hash);
             } else {
                 //key_duplicated
+#ifdef ITEM_TTL
+                //an expired duplicate does not count, unlink it and insert again; one that moved
+                //on since the match is looked up again too
+                uint64_t dup = buckets_.read_from_bucket_slot(pos.index, pos.slot);
+                if (!check_ptr(get_ptr(dup), key, key_len) || ttl_reap(pos, dup)) {
+                    buckets_.deallocator->deallocate(cuckoo_thread_id, item);
+                    continue;
+                }
+#endif
                 //buckets_.deallocator->read(cuckoo_thread_id);
                 buckets_.deallocator->deallocate(cuckoo_thread_id,item);
                 return false;
@@ -1291,22 +2425,38 @@ namespace libcuckoo {
 
     }
 
-    bool new_cuckoohash_map::insert_or_assign(char *key, size_t key_len, char *value, size_t value_len) {
+    bool new_cuckoohash_map::insert_or_assign(char *key, size_t key_len, char *value, size_t value_len, size_t ttl_ms) {
         //Item *item = allocate_item(key, key_len, value, value_len);
         Item * item = buckets_.allocate_item(key,key_len,value,value_len);
+#ifdef ITEM_TTL
+        item->expire = ttl_deadline(ttl_ms);
+#else
+        ASSERT(ttl_ms == 0, "ttl needs ITEM_TTL");
+#endif
         const hash_value hv = hashed_key(key, key_len);
-        //protect from kick
-        ParRegisterManager pm(block_when_rehashing(hv));
         while (true) {
+            //protect from kick, registered per attempt since growing the table drops it
+            ParRegisterManager pm(block_when_rehashing(hv));
             EpochManager epochManager(buckets_);
 
             TwoBuckets b = get_two_buckets(hv);
-            table_position pos = cuckoo_insert_loop(hv, b, key, key_len);
+            table_position pos;
+            size_type old_hashpower = hashpower();
+            try {
+                cache_make_room(hv, b, key, key_len);
+                pos = cuckoo_insert_loop(hv, b, key, key_len);
+            } catch (need_rehash) {
+                if (cache_max_hp && old_hashpower >= cache_max_hp) cache_evict(b);
+                else grow_after_full(pm, old_hashpower);
+                continue;
+            }
             if (pos.status == ok) {
+                if (neg_filter) neg_filter->add(hv.hash);
                 if (buckets_.try_insertKV(pos.index, pos.slot, merge_partial(hv.partial, (uint64_t) item))) {
 
                     return true;
                 }
+                if (neg_filter) neg_filter->remove(hv.hash);
             } else {
                 uint64_t par_ptr = buckets_.read_from_bucket_slot(pos.index,pos.slot);
                 uint64_t update_ptr = get_ptr(par_ptr);
@@ -1319,10 +2469,40 @@ namespace libcuckoo {
         }
     }
 
+    bool new_cuckoohash_map::fetch_add(char *key, size_t key_len, uint64_t delta, uint64_t &old) {
+        const hash_value hv = hashed_key(key, key_len);
+        ParRegisterManager pm(block_when_rehashing(hv));
+        EpochManager epochManager(buckets_);
+        table_position pos;
+        uint64_t par_ptr;
+        if (!find_writable(hv, key, key_len, pos, par_ptr)) return false;
+        uint64_t ptr = get_ptr(par_ptr);
+        if (ITEM_VALUE_LEN(ptr) != sizeof(uint64_t)) return false;
+        old = __sync_fetch_and_add((uint64_t *) ITEM_VALUE(ptr), delta);
+        return true;
+    }
+
+    bool new_cuckoohash_map::compare_and_swap_value(char *key, size_t key_len, uint64_t &expected, uint64_t desired) {
+        const hash_value hv = hashed_key(key, key_len);
+        ParRegisterManager pm(block_when_rehashing(hv));
+        EpochManager epochManager(buckets_);
+        table_position pos;
+        uint64_t par_ptr;
+        if (!find_writable(hv, key, key_len, pos, par_ptr)) return false;
+        uint64_t ptr = get_ptr(par_ptr);
+        if (ITEM_VALUE_LEN(ptr) != sizeof(uint64_t)) return false;
+        uint64_t cur = __sync_val_compare_and_swap((uint64_t *) ITEM_VALUE(ptr), expected, desired);
+        if (cur == expected) return true;
+        expected = cur;
+        return false;
+    }
+
     bool new_cuckoohash_map::erase(char *key, size_t key_len) {
         const hash_value hv = hashed_key(key, key_len);
         //protect from kick
         ParRegisterManager pm(block_when_rehashing(hv));
+        //the item we unlink may still be read by others, retire it inside an epoch
+        EpochManager epochManager(buckets_);
         while (true) {
             TwoBuckets b = get_two_buckets(hv);
             table_position pos = cuckoo_find(key, key_len, hv.partial, b.i1, b.i2);
@@ -1332,6 +2512,14 @@ namespace libcuckoo {
                 if (check_ptr(erase_ptr, key, key_len)) {
                     if (buckets_.try_eraseKV(pos.index, pos.slot, par_ptr)) {
                         buckets_.deallocator->read(cuckoo_thread_id);
+                        if (neg_filter) neg_filter->remove(hv.hash);
+                        if (shrink_threshold > 0 && ++shrink_check_l % SHRINK_CHECK_INTERVAL == 0) {
+                            double lf = sample_load_factor();
+                            if (lf < shrink_threshold && lf < shrink_retry_lf) {
+                                kickHazaManager.unregister(pm.get());
+                                try_shrink();
+                            }
+                        }
                         return true;
                     }
                 }
@@ -0,0 +1,151 @@
+#ifndef RESEARCH_PERF_COUNTERS_H
+#define RESEARCH_PERF_COUNTERS_H
+
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+//Per-thread hardware counters through perf_event_open.
+//All events of a thread form one group (PERF_FORMAT_GROUP), so a single read()
+//returns every counter, scheduled on the PMU together and sampled at the same instant.
+//Counting is user space only (works with perf_event_paranoid <= 2). Events the
+//CPU / VM does not expose are left out. Without a PMU at all the leader falls
+//back to the task-clock software event so the phases still get a time base.
+class PerfGroup {
+public:
+    enum Event {
+        Cycles = 0,
+        Instructions,
+        L1DMiss,
+        LLCMiss,
+        DTLBMiss,
+        BranchMiss,
+        EVENT_NUM
+    };
+
+    struct Sample {
+        uint64_t v[EVENT_NUM];
+
+        void clear() { memset(v, 0, sizeof(v)); }
+
+        void add(const Sample &s) { for (int i = 0; i < EVENT_NUM; i++) v[i] += s.v[i]; }
+
+        void sub(const Sample &s) { for (int i = 0; i < EVENT_NUM; i++) v[i] -= s.v[i]; }
+    };
+
+    static const char *event_name(int e) {
+        static const char *names[EVENT_NUM] = {"cycles", "instr", "L1D_miss", "LLC_miss", "dTLB_miss", "br_miss"};
+        return names[e];
+    }
+
+    PerfGroup() : leader(-1), sw_leader(false) {
+        for (int i = 0; i < EVENT_NUM; i++) fds[i] = -1;
+    }
+
+    ~PerfGroup() { close_all(); }
+
+    //open the group for the calling thread, false if not even task-clock is available
+    bool open() {
+        close_all();
+        leader = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, -1);
+        sw_leader = leader < 0;
+        if (sw_leader) leader = open_event(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, -1);
+        if (leader < 0) return false;
+        fds[Cycles] = leader;
+        if (!sw_leader) {
+            fds[Instructions] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, leader);
+            fds[L1DMiss] = open_event(PERF_TYPE_HW_CACHE, cache_config(PERF_COUNT_HW_CACHE_L1D), leader);
+            fds[LLCMiss] = open_event(PERF_TYPE_HW_CACHE, cache_config(PERF_COUNT_HW_CACHE_LL), leader);
+            fds[DTLBMiss] = open_event(PERF_TYPE_HW_CACHE, cache_config(PERF_COUNT_HW_CACHE_DTLB), leader);
+            fds[BranchMiss] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, leader);
+        }
+        //order of the members in the group read buffer
+        member_num = 0;
+        for (int i = 0; i < EVENT_NUM; i++) if (fds[i] >= 0) member_event[member_num++] = i;
+        ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        return true;
+    }
+
+    bool opened() const { return leader >= 0; }
+
+    //true when Cycles holds task-clock nanoseconds instead of cycles
+    bool software_only() const { return sw_leader; }
+
+    bool has(int e) const { return fds[e] >= 0; }
+
+    //current counter values, scaled up if the group was multiplexed
+    void read(Sample &s) const {
+        s.clear();
+        if (leader < 0) return;
+        uint64_t buf[3 + EVENT_NUM];
+        if (::read(leader, buf, sizeof(buf)) < (ssize_t) (3 * sizeof(uint64_t))) return;
+        uint64_t nr = buf[0], enabled = buf[1], running = buf[2];
+        double scale = running ? (double) enabled / running : 1.0;
+        for (uint64_t i = 0; i < nr && i < member_num; i++)
+            s.v[member_event[i]] = (uint64_t) (buf[3 + i] * scale);
+    }
+
+    //phase accounting: start() .. stop() adds the delta to acc
+    inline void start() { read(begin); }
+
+    inline void stop(Sample &acc) {
+        Sample now;
+        read(now);
+        now.sub(begin);
+        acc.add(now);
+    }
+
+private:
+    static uint64_t cache_config(uint64_t cache) {
+        return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    }
+
+    int open_event(uint32_t type, uint64_t config, int group_fd) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = group_fd < 0;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        return (int) syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0);
+    }
+
+    void close_all() {
+        for (int i = 0; i < EVENT_NUM; i++) {
+            if (fds[i] >= 0) ::close(fds[i]);
+            fds[i] = -1;
+        }
+        leader = -1;
+    }
+
+    int fds[EVENT_NUM];
+    int leader;
+    bool sw_leader;
+    int member_event[EVENT_NUM];
+    uint64_t member_num = 0;
+    Sample begin;
+};
+
+//"cycles 812.3 instr 401.2 L1D_miss 3.1 ..." per op, n/a for events that did not open
+static std::string perf_per_op_str(const PerfGroup::Sample &s, uint64_t ops, bool sw_only, const bool *has) {
+    std::string res;
+    char buf[64];
+    for (int e = 0; e < PerfGroup::EVENT_NUM; e++) {
+        const char *name = e == PerfGroup::Cycles && sw_only ? "task_ns" : PerfGroup::event_name(e);
+        if (has[e]) snprintf(buf, sizeof(buf), "%s %.2f ", name, ops ? (double) s.v[e] / ops : 0.0);
+        else snprintf(buf, sizeof(buf), "%s n/a ", name);
+        res += buf;
+    }
+    return res;
+}
+
+#endif //RESEARCH_PERF_COUNTERS_H
@@ -11,6 +11,9 @@
 #include "new_map.hh"
 #include "assert_msg.h"
 #include "ycsb_loader.h"
+#include "latency_histogram.h"
+#include "workload.h"
+#include "perf_counters.h"
 
 
 #define LOCAL 1
@@ -35,7 +38,9 @@ enum Op_type {
 //    Update = 3,
     Erase = 2,
     Insert = 3,
-    Rand = 4
+    Rand = 4,
+    Scan = 5,            // only inside a workload mix
+    ReadModifyWrite = 6  // only inside a workload mix
 };
 
 
@@ -52,6 +57,7 @@ typedef struct Request {
 
 Request *requests;
 Request *loads;
+size_t load_count;
 std::vector<YCSB_request *> ycsb_loads;
 std::vector<YCSB_request *> ycsb_requests;
 
@@ -63,14 +69,40 @@ size_t init_hashpower = 1;
 size_t key_range = 1;
 size_t total_count = 1;
 int timer_range = 0;
-int distribution = 0; // 0 unif; 1 zipf
+int distribution = 0; // Key_distribution: 0 unif; 1 zipf; 2 scrambled zipf; 3 hotspot; 4 latest
 Op_type op_chose = Rand;
+char workload = 0;      // YCSB mix a-f, 0 -> every request is op_chose
+bool churn = false;     // insert-new / erase-oldest over per-thread sliding windows
+int churn_read = 50;    // percent of churn requests that are finds inside the live window
+double theta = 0.99;
+double hot_set = 0.2, hot_ops = 0.8;
+int scan_len = 100;
+double target_rate = 0; // aggregate ops/s of the open-loop generator, 0 -> closed loop
+int rate_steps = 1;     // open-loop sweep: target_rate * k / rate_steps, k = 1..rate_steps
+int scan_workers = 0;   // >0: a background for_each over scan_workers threads keeps scanning during the run
+double shrink_threshold = 0; // new_cuckoohash_map halves itself when erases push the load factor under this
+string snapshot_save, snapshot_load; // write the table after the load phase / start from a snapshot instead
+bool bulk = false;      // load phase through bulk_load instead of insert_thread_num inserting threads
+char rmw = 0;           // ReadModifyWrite as find + insert_or_assign (0), fetch_add ('a'), CAS loop ('c') or upsert_fn ('f')
+size_t cache_hashpower = 0; // cache mode: the table stops growing here and evicts, a find miss inserts the key
+uint64_t cache_evict_load;  // evictions of the load phase
+size_t item_ttl = 0;    // ms every inserted item lives, 0 forever (table_test_ttl)
+int sweep_cpu = 0;      // percent of a core for the background TTL sweeper, 0 -> expiry is only lazy
+bool neg_filter = false; // negative lookup filter in front of find
+int miss_pct = 0;        // percent of the run's finds aimed past key_range, i.e. at absent keys
+int path_strategy = 0;   // new_cuckoohash_map::PathStrategy of the cuckoo path search / move
+int lf_bands = 0;        // >0: report the load phase in that many equal slices of its inserts
+//per load thread and band: end time (ns), kicks and paths found invalid when moving, cumulative
+uint64_t *band_end_ns, *band_kicks, *band_invalid;
 
 static size_t find_success, find_failure;
 static size_t insert_success, insert_failure;
 static size_t set_insert, set_assign;
 static size_t update_success, update_failure;
 static size_t erase_success, erase_failure;
+static size_t scan_success, scan_failure;
+static size_t cache_fill;
+static size_t filter_negative, filter_false_positive, partial_false_match;
 static size_t kick_num,
                 depth0, // ready to kick, then find empty slot
                 kick_lock_failure_data_check,
@@ -87,9 +119,31 @@ thread_local static size_t insert_success_l, insert_failure_l;
 thread_local static size_t set_insert_l, set_assign_l;
 thread_local static size_t update_success_l, update_failure_l;
 thread_local static size_t erase_success_l, erase_failure_l;
+thread_local static size_t scan_success_l, scan_failure_l;
+thread_local static size_t churn_pair_l, limbo_peak_l;
+thread_local static size_t cache_fill_l;
+
+static uint64_t num_item_alloc, num_new_item_malloc, num_retire, num_reclaim, limbo_peak;
+//churn windows, in per-thread sequence numbers: thread t owns keys t + thread_num * seq
+uint64_t *churn_oldest, *churn_newest;
+
+//perf=1: per-thread counter groups, the rehash phase is cut out of the load / run phase it happened in
+enum Perf_phase { Perf_load = 0, Perf_run, Perf_rehash, PERF_PHASE_NUM };
+static const char *perf_phase_str[PERF_PHASE_NUM] = {"load", "run", "rehash"};
+bool perf = false;
+bool perf_opened = false, perf_sw_only = false;
+bool perf_has[PerfGroup::EVENT_NUM];
+PerfGroup::Sample perf_phase[PERF_PHASE_NUM];
+uint64_t perf_rehash_items;
+std::mutex perf_mtx;
+thread_local PerfGroup perf_group;
+thread_local PerfGroup::Sample perf_rehash_begin_l, perf_rehash_l;
+
+uint64_t scan_passes, scan_items, scan_time, scan_missing, scan_duplicated;
 
 uint64_t *runtimelist;
 uint64_t op_num;
+LatencyHistogram *latency_hists;
 
 std::atomic<int> stopMeasure(0);
 
@@ -109,28 +163,6 @@ struct table_position {
 };
 
 
-template<typename R>
-class RandomGenerator {
-public:
-    static inline void generate(R *array, size_t range, size_t count, double skew = 0.0) {
-        struct stat buffer;
-        if (skew < zipf_distribution<R>::epsilon) {
-            std::default_random_engine engine(
-                    static_cast<R>(chrono::steady_clock::now().time_since_epoch().count()));
-            std::uniform_int_distribution<size_t> dis(0, range + FUZZY_BOUND);
-            for (size_t i = 0; i < count; i++) {
-                array[i] = static_cast<R>(dis(engine));
-            }
-        } else {
-            zipf_distribution<R> engine(range, skew);
-            mt19937 mt;
-            for (size_t i = 0; i < count; i++) {
-                array[i] = engine(mt);
-            }
-        }
-    }
-};
-
 inline void merge_log() {
     __sync_fetch_and_add(&find_success, find_success_l);
     __sync_fetch_and_add(&find_failure, find_failure_l);
@@ -142,12 +174,61 @@ inline void merge_log() {
     __sync_fetch_and_add(&update_failure, update_failure_l);
     __sync_fetch_and_add(&erase_success, erase_success_l);
     __sync_fetch_and_add(&erase_failure, erase_failure_l);
+    __sync_fetch_and_add(&scan_success, scan_success_l);
+    __sync_fetch_and_add(&scan_failure, scan_failure_l);
+    __sync_fetch_and_add(&cache_fill, cache_fill_l);
+    __sync_fetch_and_add(&filter_negative, filter_negative_l);
+    __sync_fetch_and_add(&filter_false_positive, filter_false_positive_l);
+    __sync_fetch_and_add(&partial_false_match, partial_false_match_l);
+    //a churn request is an insert plus an erase, the worker only counted it once
+    __sync_fetch_and_add(&op_num, churn_pair_l);
+
+    __sync_fetch_and_add(&num_item_alloc, tw_info.num_item_alloc);
+    __sync_fetch_and_add(&num_new_item_malloc, tw_info.num_new_item_malloc);
+    __sync_fetch_and_add(&num_retire, tw_info.num_retire);
+    __sync_fetch_and_add(&num_reclaim, tw_info.num_mlq_reclaim);
+    uint64_t peak = limbo_peak;
+    while (limbo_peak_l > peak && !__sync_bool_compare_and_swap(&limbo_peak, peak, limbo_peak_l)) peak = limbo_peak;
 }
 
+//in place read-modify-write of the 8 byte value, a hit counts as update_success
+void rmw_func(const Request &req) {
+    uint64_t old;
+    bool hit = false;
+    switch (rmw) {
+        case 'a':
+            hit = store.fetch_add(req.key, req.key_len, 1, old);
+            break;
+        case 'c': {
+            //a mismatch moves expected to the current value, a miss leaves it
+            uint64_t expected = *(uint64_t *) req.value, tried;
+            do tried = expected;
+            while (!(hit = store.compare_and_swap_value(req.key, req.key_len, expected, expected + 1)) &&
+                   expected != tried);
+        }
+            break;
+        case 'f':
+            //a miss inserts, which counts as set_insert to keep item_num == insert - erase
+            if (store.upsert_fn(req.key, req.key_len, [](char *v, size_t) { (*(uint64_t *) v)++; },
+                                req.value, req.value_len)) {
+                set_insert_l++;
+                return;
+            }
+            hit = true;
+            break;
+        default:
+            ASSERT(false, "rmw mode error");
+    }
+    if (hit)
+        update_success_l++;
+    else
+        update_failure_l++;
+}
 
 void op_func(const Request &req) {
 
-    Op_type switch_option = op_chose == Rand ? static_cast<Op_type>(rand() % 3) : op_chose;
+    //mixed ops were drawn in prepare(), nothing random is left on this path
+    Op_type switch_option = op_chose == Rand ? req.optype : op_chose;
 
     switch (switch_option) {
 
@@ -155,12 +236,15 @@ void op_func(const Request &req) {
         case Find : {
             if (store.find(req.key, req.key_len))
                 find_success_l++;
-            else
+            else {
                 find_failure_l++;
+                //read through: a cache miss fetches the key and keeps it
+                if (cache_hashpower && store.insert(req.key, req.key_len, req.value, req.value_len, item_ttl)) cache_fill_l++;
+            }
         }
             break;
         case Insert : {
-            if (store.insert(req.key, req.key_len, req.value, req.value_len)) {
+            if (store.insert(req.key, req.key_len, req.value, req.value_len, item_ttl)) {
                 insert_success_l++;
             } else {
                 insert_failure_l++;
@@ -168,7 +252,7 @@ void op_func(const Request &req) {
         }
             break;
         case Set : {
-            if (store.insert_or_assign(req.key, req.key_len, req.value, req.value_len)) {
+            if (store.insert_or_assign(req.key, req.key_len, req.value, req.value_len, item_ttl)) {
                 set_insert_l++;
             } else {
                 set_assign_l++;
@@ -194,9 +278,66 @@ void op_func(const Request &req) {
             }
         }
             break;
+        //the map has no ordered iteration, a scan is scan_len point lookups over consecutive key ids
+        case Scan : {
+            uint64_t k = *(uint64_t *) req.key;
+            size_t hit = 0;
+            for (int i = 0; i < scan_len; i++, k++) {
+                if (store.find((char *) &k, sizeof(uint64_t))) hit++;
+            }
+            if (hit)
+                scan_success_l++;
+            else
+                scan_failure_l++;
+        }
+            break;
+        case ReadModifyWrite : {
+            if (rmw) {
+                rmw_func(req);
+                break;
+            }
+            if (store.find(req.key, req.key_len)) {
+                (*(uint64_t *) req.value)++;
+            }
+            if (store.insert_or_assign(req.key, req.key_len, req.value, req.value_len, item_ttl)) {
+                set_insert_l++;
+            } else {
+                set_assign_l++;
+            }
+        }
+            break;
+        default:
+            ASSERT(false, "optype error");
+    }
+
+}
 
+//Table size stays constant: Insert requests add the thread's next new key and erase its
+//oldest one, Find requests look up a key inside the live window (req.key is an offset).
+void churn_op_func(int tid, const Request &req) {
+    if (req.optype == Find) {
+        uint64_t window = churn_newest[tid] - churn_oldest[tid];
+        uint64_t k = tid + thread_num * (churn_oldest[tid] + *(uint64_t *) req.key % window);
+        if (store.find((char *) &k, sizeof(uint64_t)))
+            find_success_l++;
+        else
+            find_failure_l++;
+        return;
     }
 
+    uint64_t k = tid + thread_num * churn_newest[tid]++;
+    if (store.insert((char *) &k, sizeof(uint64_t), (char *) &k, sizeof(uint64_t), item_ttl)) {
+        insert_success_l++;
+    } else {
+        insert_failure_l++;
+    }
+    k = tid + thread_num * churn_oldest[tid]++;
+    if (store.erase((char *) &k, sizeof(uint64_t))) {
+        erase_success_l++;
+    } else {
+        erase_failure_l++;
+    }
+    churn_pair_l++;
 }
 
 void ycsb_op_func(YCSB_request * req){
@@ -232,19 +373,65 @@ void ycsb_op_func(YCSB_request * req){
 }
 
 
+void perf_rehash_hook(bool begin) {
+    PerfGroup::Sample now;
+    perf_group.read(now);
+    if (begin) {
+        perf_rehash_begin_l = now;
+        __sync_fetch_and_add(&perf_rehash_items, store.get_item_num());
+    } else {
+        now.sub(perf_rehash_begin_l);
+        perf_rehash_l.add(now);
+    }
+}
+
+void perf_phase_start() {
+    if (!perf || (!perf_group.opened() && !perf_group.open())) return;
+    perf_rehash_l.clear();
+    perf_group.start();
+}
+
+void perf_phase_stop(Perf_phase phase) {
+    if (!perf || !perf_group.opened()) return;
+    PerfGroup::Sample s;
+    s.clear();
+    perf_group.stop(s);
+    s.sub(perf_rehash_l);
+
+    std::lock_guard<std::mutex> lock(perf_mtx);
+    perf_phase[phase].add(s);
+    perf_phase[Perf_rehash].add(perf_rehash_l);
+    perf_opened = true;
+    perf_sw_only = perf_group.software_only();
+    for (int e = 0; e < PerfGroup::EVENT_NUM; e++) perf_has[e] = perf_group.has(e);
+}
+
 void insert_worker(int tid){
     cuckoo_thread_id = tid;
     store.brown_init_thread(tid);
 
     //Prevent tail debris
-    size_t step =  total_count / insert_thread_num;
-    size_t num = tid == insert_thread_num -1 ?  step + total_count % insert_thread_num : step;
+    size_t step =  load_count / insert_thread_num;
+    size_t num = tid == insert_thread_num -1 ?  step + load_count % insert_thread_num : step;
     size_t base = tid * step;
 
+    perf_phase_start();
+    int band = 0;
+    size_t band_next = lf_bands ? num / lf_bands : 0;
+    auto band_begin = chrono::steady_clock::now();
+    auto end_band = [&]() {
+        size_t b = tid * lf_bands + band;
+        band_end_ns[b] = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - band_begin).count();
+        band_kicks[b] = kick_num_l;
+        band_invalid[b] = kick_lock_failure_data_check_l + kick_lock_failure_data_check_after_l;
+        band++;
+        band_next = num * (band + 1) / lf_bands;
+    };
     for (size_t i = 0; i < num ; i++) {
+        while (band < lf_bands && i == band_next) end_band();
         if(!YCSB){
-            auto &req = requests[base + i];
-            if (store.insert(req.key, req.key_len, req.value, req.value_len)) {
+            auto &req = loads[base + i];
+            if (store.insert(req.key, req.key_len, req.value, req.value_len, item_ttl)) {
                 insert_success_l++;
             } else {
                 insert_failure_l++;
@@ -259,6 +446,8 @@ void insert_worker(int tid){
         }
 
     }
+    while (band < lf_bands) end_band();
+    perf_phase_stop(Perf_load);
 
 
     __sync_fetch_and_add(&kick_num, kick_num_l);
@@ -289,12 +478,14 @@ void worker(int tid) {
 
     Tracer t;
     t.startTime();
+    perf_phase_start();
 
     while (stopMeasure.load(std::memory_order_relaxed) == 0) {
 
         for (size_t i = 0; i < num; i++) {
             if(!YCSB){
-                op_func(requests[base + i]);
+                if (churn) churn_op_func(tid, requests[base + i]);
+                else op_func(requests[base + i]);
             }else{
                 ycsb_op_func(ycsb_requests[base + i]);
             }
@@ -302,48 +493,203 @@ void worker(int tid) {
         }
 
         __sync_fetch_and_add(&op_num, num);
+        limbo_peak_l = std::max(limbo_peak_l, store.get_limbo_size(tid));
 
         uint64_t tmptruntime = t.fetchTime();
         if (tmptruntime / 1000000 >= timer_range) {
             stopMeasure.store(1, memory_order_relaxed);
         }
     }
+    perf_phase_stop(Perf_run);
     merge_log();
     runtimelist[tid] = t.getRunTime();
 }
 
+//Open loop: each thread issues rate / thread_num requests per second with Poisson
+//inter-arrival, independent of how fast the map answers. Latency is measured from
+//the intended send time, so time spent queued behind a slow request is counted.
+void open_loop_worker(int tid, double rate) {
+    cuckoo_thread_id = tid;
+    store.brown_init_thread(tid);
+
+    size_t step =  total_count / thread_num;
+    size_t num = tid == thread_num -1 ?  step + total_count % thread_num : step;
+    size_t base = tid * step;
+
+    LatencyHistogram &hist = latency_hists[tid];
+    PoissonArrival arrival(rate / thread_num, chrono::steady_clock::now().time_since_epoch().count() + tid);
+    uint64_t issued = 0;
+    size_t i = 0;
 
+    Tracer t;
+    t.startTime();
+
+    while (stopMeasure.load(std::memory_order_relaxed) == 0) {
+        uint64_t intended = arrival.wait_next();
+        if(!YCSB){
+            if (churn) churn_op_func(tid, requests[base + i]);
+            else op_func(requests[base + i]);
+        }else{
+            ycsb_op_func(ycsb_requests[base + i]);
+        }
+        hist.record(arrival.elapsed_ns() - intended);
+        if (++i == num) i = 0;
+
+        if ((++issued & 0x3f) == 0) {
+            limbo_peak_l = std::max(limbo_peak_l, store.get_limbo_size(tid));
+            if (t.fetchTime() / 1000000 >= timer_range) stopMeasure.store(1, memory_order_relaxed);
+        }
+    }
+    __sync_fetch_and_add(&op_num, issued);
+    merge_log();
+    runtimelist[tid] += t.getRunTime();
+}
+
+//With workload c or d the preloaded keys are never written, so every pass must
+//hand out each of them exactly once however the inserts kick them around.
+void scan_worker() {
+    bool stable = workload == 'c' || workload == 'd';
+    uint8_t *seen = new uint8_t[load_count];
+    while (stopMeasure.load(std::memory_order_relaxed) == 0) {
+        memset(seen, 0, load_count);
+        uint64_t items = 0;
+        Tracer t;
+        t.startTime();
+        store.for_each([&](char *key, size_t key_len, char *value, size_t value_len) {
+            __sync_fetch_and_add(&items, 1);
+            uint64_t k = *(uint64_t *) key;
+            if (k < load_count) __sync_fetch_and_add(&seen[k], 1);
+        }, scan_workers);
+        scan_time += t.getRunTime();
+        scan_passes++;
+        scan_items += items;
+        if (!stable) continue;
+        for (size_t k = 0; k < load_count; k++) {
+            if (seen[k] == 0) scan_missing++;
+            else scan_duplicated += seen[k] - 1;
+        }
+    }
+    delete[] seen;
+}
+
+//Sweep the offered load and print one point of the throughput-latency curve per step
+void run_open_loop() {
+    latency_hists = new LatencyHistogram[thread_num];
+    cout << "open loop: target_rate(ops/s) throughput(ops/s) p50(us) p90(us) p99(us) p999(us) max(us)" << endl;
+    for (int k = 1; k <= rate_steps; k++) {
+        double rate = target_rate * k / rate_steps;
+        for (int i = 0; i < thread_num; i++) latency_hists[i].reset();
+        uint64_t op_before = op_num;
+        stopMeasure.store(0);
+
+        Tracer t;
+        t.startTime();
+        std::vector<std::thread> threads;
+        for (int i = 0; i < thread_num; i++) threads.emplace_back(std::thread(open_loop_worker, i, rate));
+        for (int i = 0; i < thread_num; i++) threads[i].join();
+        uint64_t elapsed = t.getRunTime();
+
+        LatencyHistogram all;
+        for (int i = 0; i < thread_num; i++) all.merge(latency_hists[i]);
+        cout << "curve " << rate
+             << " " << (op_num - op_before) * 1000000.0 / elapsed
+             << " " << all.percentile(0.5) / 1000.0
+             << " " << all.percentile(0.9) / 1000.0
+             << " " << all.percentile(0.99) / 1000.0
+             << " " << all.percentile(0.999) / 1000.0
+             << " " << all.max() / 1000.0 << endl;
+    }
+    delete[] latency_hists;
+}
+
+
+
+static Op_type workload_op_type(Workload_op op) {
+    switch (op) {
+        case W_Read: return Find;
+        case W_Update: return Set;
+        case W_Insert: return Insert;
+        case W_Scan: return Scan;
+        case W_ReadModifyWrite: return ReadModifyWrite;
+        case W_Erase: return Erase;
+    }
+    return Find;
+}
+
+static Request *make_requests(const uint64_t *keys, const Workload_op *ops, size_t count) {
+    Request *reqs = new Request[count];
+    for (size_t i = 0; i < count; i++) {
+        reqs[i].optype = ops ? workload_op_type(ops[i]) : Find;
+
+        reqs[i].key = (char *) calloc(1, 8 * sizeof(char));
+        reqs[i].key_len = default_key_len;
+        *((size_t *) reqs[i].key) = keys[i];
+
+        reqs[i].value = (char *) calloc(1, 8 * sizeof(char));
+        reqs[i].value_len = default_value_len;
+        *((size_t *) reqs[i].value) = keys[i];
+    }
+    return reqs;
+}
 
 void prepare(){
 
     if(!YCSB){
-        double skew = distribution == 0? 0.0:0.99;
+        WorkloadGenerator generator(key_range, static_cast<Key_distribution>(distribution), theta, hot_set, hot_ops);
+        uint64_t seed = chrono::steady_clock::now().time_since_epoch().count();
 
-        uint64_t *loads = new uint64_t[total_count]();
-        RandomGenerator<uint64_t>::generate(loads,key_range,total_count,skew);
+        uint64_t *keys = new uint64_t[total_count]();
+        Workload_op *ops = nullptr;
+        Workload_mix mix = workload ? Workload_mix::ycsb(workload) : Workload_mix::rand_mix();
+        if (churn) mix = Workload_mix{'x', churn_read, 0, 100 - churn_read, 0, 0, 0};
+        if (op_chose == Rand) ops = new Workload_op[total_count];
+        generator.generate(keys, ops, op_chose == Rand ? &mix : nullptr, total_count, thread_num, seed);
 
-        srand((unsigned) time(NULL));
         //init_req
-        static_assert(op_type_num == 4);
-        requests = new Request[total_count];
-        for (size_t i = 0; i < total_count; i++) {
-            requests[i].optype = Find;//rand() % 2 == 0? Find : Set;
-
-            requests[i].key = (char *) calloc(1, 8 * sizeof(char));
-            requests[i].key_len = default_key_len;
-            *((size_t *) requests[i].key) = loads[i];
-
-            requests[i].value = (char *) calloc(1, 8 * sizeof(char));
-            requests[i].value_len = default_value_len;
-            *((size_t *) requests[i].value) = loads[i];
+        static_assert(op_type_num == 4, "");
+        requests = make_requests(keys, ops, total_count);
+
+        if (miss_pct) {
+            //only the preloaded key space [0, key_range) exists, shift finds out of it
+            ASSERT(workload, "miss needs a workload, whose loaded keys are apart from the requests");
+            std::mt19937_64 rng(seed);
+            for (size_t i = 0; i < total_count; i++) {
+                if (requests[i].optype == Find && (int) (rng() % 100) < miss_pct)
+                    *(uint64_t *) requests[i].key += key_range;
+            }
+        }
 
+        if (churn) {
+            //every thread starts with a full window of key_range / thread_num keys
+            uint64_t window = key_range / thread_num;
+            ASSERT(window > 0, "key_range must be at least thread_num for churn");
+            load_count = window * thread_num;
+            churn_oldest = new uint64_t[thread_num]();
+            churn_newest = new uint64_t[thread_num];
+            for (int t = 0; t < thread_num; t++) churn_newest[t] = window;
+            uint64_t *load_keys = new uint64_t[load_count];
+            for (size_t i = 0; i < load_count; i++) load_keys[i] = i;
+            loads = make_requests(load_keys, nullptr, load_count);
+            delete[] load_keys;
+        } else if (workload) {
+            //YCSB load phase: every record of the key space exists before the run
+            load_count = key_range;
+            uint64_t *load_keys = new uint64_t[load_count];
+            for (size_t i = 0; i < load_count; i++) load_keys[i] = i;
+            loads = make_requests(load_keys, nullptr, load_count);
+            delete[] load_keys;
+        } else {
+            load_count = total_count;
+            loads = requests;
         }
 
-        delete[] loads;
+        delete[] keys;
+        delete[] ops;
     }else{
         YCSBLoader loader(load_filepath.c_str());
         ycsb_loads=loader.load();
         total_count = ycsb_loads.size();
+        load_count = total_count;
 
         YCSBLoader loader1(run_filepath.c_str());
         ycsb_requests=loader1.load();
@@ -355,13 +701,61 @@ void prepare(){
 }
 
 bool check_unique();
+bool check_loaded();
+bool check_rmw_value_len();
 void show_info_insert();
+void show_load_bands();
 void show_info_before();
 void show_info_after();
 void prepare();
 
+//name=value arguments, accepted after the positional ones in any order
+bool parse_option(const char *arg) {
+    const char *eq = strchr(arg, '=');
+    if (eq == nullptr) return false;
+    string name(arg, eq - arg);
+    const char *val = eq + 1;
+    if (name == "rate") target_rate = std::atof(val);
+    else if (name == "steps") rate_steps = std::atol(val);
+    else if (name == "workload" && string(val) == "churn") churn = true;
+    else if (name == "workload") workload = val[0];
+    else if (name == "scan") scan_workers = std::atoi(val);
+    else if (name == "save") snapshot_save = val;
+    else if (name == "load") snapshot_load = val;
+    else if (name == "bulk") bulk = std::atoi(val) != 0;
+    else if (name == "cache") cache_hashpower = std::atol(val);
+    else if (name == "filter") neg_filter = std::atoi(val) != 0;
+    else if (name == "miss") miss_pct = std::atoi(val);
+    else if (name == "path")
+        path_strategy = string(val) == "walk" ? 1 : string(val) == "lockall" ? 2 : string(val) == "mwcas" ? 3 : 0;
+    else if (name == "bands") lf_bands = std::atoi(val);
+#ifdef ITEM_TTL
+    else if (name == "ttl") item_ttl = std::atol(val);
+    else if (name == "sweep") sweep_cpu = std::atoi(val);
+#endif
+    else if (name == "rmw") rmw = string(val) == "add" ? 'a' : string(val) == "cas" ? 'c' : string(val) == "fn" ? 'f' : 0;
+    else if (name == "shrink") shrink_threshold = std::atof(val);
+    else if (name == "perf") perf = std::atoi(val) != 0;
+    else if (name == "churn_read") churn_read = std::atol(val);
+    else if (name == "theta") theta = std::atof(val);
+    else if (name == "hot_set") hot_set = std::atof(val);
+    else if (name == "hot_ops") hot_ops = std::atof(val);
+    else if (name == "scan_len") scan_len = std::atol(val);
+    else return false;
+    return true;
+}
+
 int main(int argc, char **argv) {
-    if (argc == 9) {
+    std::vector<char *> args{argv[0]};
+    bool bad_option = false;
+    for (int i = 1; i < argc; i++) {
+        if (strchr(argv[i], '=') == nullptr) args.push_back(argv[i]);
+        else if (!parse_option(argv[i])) bad_option = true;
+    }
+    argc = args.size();
+    argv = args.data();
+
+    if (argc == 9 && !bad_option) {
         insert_thread_num = std::atol(argv[1]);
         thread_num = std::atol(argv[2]);
         init_hashpower = std::atol(argv[3]);
@@ -371,7 +765,8 @@ int main(int argc, char **argv) {
         distribution = std::atol(argv[7]);
         timer_range = std::atol(argv[8]);
         YCSB = false;
-    } else if(argc == 5){
+        if (workload || churn) op_chose = Rand;
+    } else if(argc == 5 && !bad_option){
         insert_thread_num = std::atol(argv[1]);
         thread_num = std::atol(argv[2]);
         init_hashpower = std::atol(argv[3]);
@@ -380,11 +775,44 @@ int main(int argc, char **argv) {
     }else{
         cout << "micro_benchmark:"<<endl;
         cout << "./a.out <insert_thread_num> <thread_num> <init_hashpower> <op_chose> <key_range>"
-                "<total_count> <distribution> <timer_range>" << endl;
+                "<total_count> <distribution> <timer_range> [options]" << endl;
         cout << "ycsb:"<<endl;
-        cout << "./a.out <insert_thread_num> <thread_num> <init_hashpower> <timer_range>" << endl;
+        cout << "./a.out <insert_thread_num> <thread_num> <init_hashpower> <timer_range> [options]" << endl;
         cout << "op_chose    :0-Find,1-Set,2-Erase,3-Insert,4-Rand " << endl;
-        cout << "distribution:0-unif,1-zipf" << endl;
+        cout << "distribution:0-unif,1-zipf,2-scrambled zipf,3-hotspot,4-latest" << endl;
+        cout << "options:" << endl;
+        cout << "  rate=<ops/s> steps=<n>    open loop, the offered load is swept over rate * k / steps "
+                "(k = 1..steps), each step lasting timer_range" << endl;
+        cout << "  workload=<a-f>            YCSB mix over key_range preloaded records, overrides op_chose "
+                "(standard: a,b,c,e,f zipf, d latest)" << endl;
+        cout << "  workload=churn churn_read=<0-100>   constant table size: each thread slides a window of "
+                "key_range / thread_num keys, inserting the next key and erasing the oldest; churn_read percent "
+                "of the requests are finds inside the window" << endl;
+        cout << "  scan=<n>                  keep running for_each over n threads during the closed-loop run; "
+                "with workload=c/d every pass must see each preloaded key exactly once" << endl;
+        cout << "  save=<file> load=<file>   snapshot the table after the load phase / skip the load phase and "
+                "map a snapshot taken with the same arguments" << endl;
+        cout << "  bulk=1                    build the loaded table offline with bulk_load over insert_thread_num "
+                "threads (workload / churn, whose load keys are distinct)" << endl;
+        cout << "  rmw=<add|cas|fn>          ReadModifyWrite (workload f) in place through fetch_add, a "
+                "compare_and_swap_value loop or upsert_fn instead of find + insert_or_assign" << endl;
+        cout << "  cache=<hashpower>         cache mode: grow up to this hashpower, then evict (CLOCK); a find "
+                "miss inserts the key; reports hit ratio and eviction rate" << endl;
+        cout << "  filter=1 miss=<0-100>     negative lookup filter in front of find; with a workload, miss percent "
+                "of the finds go to keys that were never loaded" << endl;
+        cout << "  path=<bfs|walk|lockall|mwcas>   cuckoo path search / move: BFS hop by hop, random walk hop by "
+                "hop, BFS with the whole path locked and moved at once, BFS with the path moved by one MwCAS" << endl;
+        cout << "  bands=<n>                 load phase in n slices: load factor, insert Mops, kicks per insert "
+                "and invalidated paths per kick of each" << endl;
+#ifdef ITEM_TTL
+        cout << "  ttl=<ms> sweep=<cpu %>    inserted items expire after ttl ms; finds and inserts drop "
+                "expired items, sweep > 0 adds a background sweeper using that share of a core" << endl;
+#endif
+        cout << "  shrink=<lf>               halve the table once erases bring the load factor under lf" << endl;
+        cout << "  perf=1                    per-op cycles, L1D/LLC/dTLB misses and branch misses of the load, "
+                "run (closed loop only) and rehash phases via perf_event_open" << endl;
+        cout << "  theta=<0-1> hot_set=<frac> hot_ops=<frac> scan_len=<n>   distribution / scan parameters"
+             << endl;
 
         exit(-1);
     }
@@ -392,30 +820,93 @@ int main(int argc, char **argv) {
     show_info_before();
 
     {
-        new_cuckoohash_map tmp(init_hashpower,thread_num);
+        //the scan groups and the sweeper take the slots after the largest worker tid
+        new_cuckoohash_map tmp(init_hashpower, std::max(thread_num, insert_thread_num));
         store.swap_first(tmp);
     }
+    if (perf) store.rehash_hook = perf_rehash_hook;
+    store.set_shrink_threshold(shrink_threshold);
+    store.set_cache_capacity(cache_hashpower);
+    if (neg_filter) store.enable_negative_filter();
+    store.set_path_strategy(static_cast<new_cuckoohash_map::PathStrategy>(path_strategy));
 
 
 
     prepare();
 
-    std::vector<std::thread> insert_threads;
-    for (int i = 0; i < insert_thread_num; i++) insert_threads.emplace_back(std::thread(insert_worker, i));
-    for (int i = 0; i < insert_thread_num; i++) insert_threads[i].join();
+    if (!snapshot_load.empty()) {
+        ASSERT(!YCSB, "snapshot load only in micro benchmark");
+        Tracer t;
+        t.startTime();
+        ASSERT(store.load_snapshot(snapshot_load.c_str()), "snapshot load failed");
+        uint64_t load_time = t.getRunTime();
+        uint64_t loaded = store.get_item_num();
+        ASSERT(loaded == load_count, "snapshot does not hold the keys of this run");
+        insert_success += loaded;
+        cout << "snapshot load " << loaded << " items in " << load_time << " us, hashpower " << store.hashpower() << endl;
+    } else if (bulk) {
+        ASSERT(!YCSB && (workload || churn), "bulk load needs distinct load keys (workload / churn)");
+        Tracer t;
+        t.startTime();
+        store.bulk_load(loads, loads + load_count, insert_thread_num);
+        uint64_t load_time = t.getRunTime();
+        insert_success += load_count;
+        cout << "bulk load " << load_count << " items in " << load_time << " us, hashpower " << store.hashpower() << endl;
+    } else {
+        std::vector<std::thread> insert_threads;
+        if (lf_bands) {
+            band_end_ns = new uint64_t[insert_thread_num * lf_bands]();
+            band_kicks = new uint64_t[insert_thread_num * lf_bands]();
+            band_invalid = new uint64_t[insert_thread_num * lf_bands]();
+        }
+        Tracer t;
+        t.startTime();
+        for (int i = 0; i < insert_thread_num; i++) insert_threads.emplace_back(std::thread(insert_worker, i));
+        for (int i = 0; i < insert_thread_num; i++) insert_threads[i].join();
+        cout << "load phase " << load_count << " inserts in " << t.getRunTime() << " us" << endl;
+        if (lf_bands) show_load_bands();
+    }
+
+    if (!snapshot_save.empty()) {
+        Tracer t;
+        t.startTime();
+        ASSERT(store.save_snapshot(snapshot_save.c_str()), "snapshot save failed");
+        cout << "snapshot save " << store.get_item_num() << " items in " << t.getRunTime() << " us" << endl;
+    }
+
+    cache_evict_load = store.get_evict_num();
 
     show_info_insert();
 
-    if(!YCSB) std::random_shuffle(requests, requests + total_count);
+    //workload streams keep their per-thread order (latest depends on it)
+    if(!YCSB && !workload && !churn) std::random_shuffle(requests, requests + total_count);
 
     ASSERT(store.check_unique(),"key not unique!");
     ASSERT(store.check_nolock(),"there are still locks in map!");
+    ASSERT(check_loaded(),"loaded key lost!");
+    if (rmw) ASSERT(check_rmw_value_len(), "in place update of a value that is not 8 bytes!");
 
     runtimelist = new uint64_t[thread_num]();
 
-    std::vector<std::thread> threads;
-    for (int i = 0; i < thread_num; i++) threads.emplace_back(std::thread(worker, i));
-    for (int i = 0; i < thread_num; i++) threads[i].join();
+    //the checks walk items outside any epoch, the sweeper only runs with the workload
+#ifdef ITEM_TTL
+    if (sweep_cpu) store.start_ttl_sweeper(sweep_cpu);
+#endif
+
+    if (target_rate > 0) {
+        ASSERT(rate_steps > 0, "rate_steps must be positive");
+        run_open_loop();
+    } else {
+        std::vector<std::thread> threads;
+        for (int i = 0; i < thread_num; i++) threads.emplace_back(std::thread(worker, i));
+        std::thread scanner;
+        if (scan_workers > 0) scanner = std::thread(scan_worker);
+        for (int i = 0; i < thread_num; i++) threads[i].join();
+        if (scan_workers > 0) scanner.join();
+    }
+#ifdef ITEM_TTL
+    store.stop_ttl_sweeper();
+#endif
 
     ASSERT(store.check_unique(),"key not unique!");
     ASSERT(store.check_nolock(),"there are still locks in map!");
@@ -424,6 +915,54 @@ int main(int argc, char **argv) {
 
 }
 
+//one line per band of the load phase: load factor at its end (against the final table), insert
+//throughput while the slowest thread was in it, kicks per insert and invalid paths per kick
+void show_load_bands() {
+    cout << "#lf_end\tMops\tkicks_per_insert\tinvalid_per_kick" << endl;
+    uint64_t prev_end = 0, inserted = 0;
+    for (int k = 0; k < lf_bands; k++) {
+        uint64_t end = 0, items = 0, kicks = 0, invalid = 0;
+        for (int t = 0; t < insert_thread_num; t++) {
+            size_t b = t * lf_bands + k;
+            size_t step = load_count / insert_thread_num;
+            size_t num = t == insert_thread_num - 1 ? step + load_count % insert_thread_num : step;
+            end = std::max(end, band_end_ns[b]);
+            items += num * (k + 1) / lf_bands - num * k / lf_bands;
+            kicks += band_kicks[b] - (k ? band_kicks[b - 1] : 0);
+            invalid += band_invalid[b] - (k ? band_invalid[b - 1] : 0);
+        }
+        inserted += items;
+        cout << inserted * 1.0 / store.slot_num() << "\t" << items * 1000.0 / std::max<uint64_t>(end - prev_end, 1)
+             << "\t" << kicks * 1.0 / std::max<uint64_t>(items, 1) << "\t" << invalid * 1.0 / std::max<uint64_t>(kicks, 1)
+             << endl;
+        prev_end = end;
+    }
+}
+
+//each load key was inserted by the load phase or found there already, the kicks
+//of the concurrent inserts must not have lost one. Not for cache mode or TTL,
+//which drop keys on purpose.
+bool check_loaded() {
+    if (YCSB || cache_hashpower || item_ttl) return true;
+    size_t missing = 0;
+    for (size_t i = 0; i < load_count; i++)
+        if (!store.find(loads[i].key, loads[i].key_len)) missing++;
+    if (missing) cout << missing << " of " << load_count << " loaded keys not found" << endl;
+    return missing == 0;
+}
+
+//fetch_add and compare_and_swap_value only take 8 byte values, on another size they
+//must miss and leave expected alone. Inserted and erased again outside key_range.
+bool check_rmw_value_len() {
+    uint64_t key = ~0ull, old, expected = 0;
+    uint32_t value = 7;
+    if (!store.insert((char *) &key, sizeof(key), (char *) &value, sizeof(value))) return false;
+    bool ok = !store.fetch_add((char *) &key, sizeof(key), 1, old) &&
+              !store.compare_and_swap_value((char *) &key, sizeof(key), expected, 1) && expected == 0;
+    store.erase((char *) &key, sizeof(key));
+    return ok;
+}
+
 void show_info_insert(){
 
     cout << ">>>>>pre insert finish" <<"\tinsert_success: "<<insert_success<<"\tkick_num: "<<kick_num<< endl;
@@ -448,6 +987,8 @@ void show_info_before() {
         std::cout << " thread_num " << thread_num
                  << " init_hashpower " << init_hashpower
                  << " timer_range " << timer_range << std::endl;
+        if (target_rate > 0)
+            std::cout << " open_loop target_rate " << target_rate << " rate_steps " << rate_steps << std::endl;
         std::cout << "---YCSB--- "<<std::endl;
         std::cout << "loadpath:\t"<<load_filepath<<std::endl;
         std::cout << "runpath:\t"<<run_filepath<<std::endl;
@@ -474,8 +1015,13 @@ void show_info_before() {
                 ASSERT(false, "op_chose not defined");
         }
 
-        ASSERT(distribution == 0 || distribution == 1, "distribution not defined");
-        string distribution_str = distribution == 0 ? "uinf" : "zipf";
+        ASSERT(distribution >= Uniform && distribution <= Latest, "distribution not defined");
+        string distribution_str = key_distribution_str[distribution];
+        if (distribution != Uniform && distribution != Hotspot) distribution_str += " theta " + to_string(theta);
+        if (distribution == Hotspot)
+            distribution_str += " hot_set " + to_string(hot_set) + " hot_ops " + to_string(hot_ops);
+        if (workload) op_chose_str = string("ycsb-") + workload;
+        if (churn) op_chose_str = "churn read " + to_string(churn_read) + "%";
 
         std::cout << " thread_num " << thread_num
                   << " init_hashpower " << init_hashpower
@@ -484,6 +1030,8 @@ void show_info_before() {
                   << " total_count " << total_count
                   << " distribution " << distribution_str
                   << " timer_range " << timer_range << std::endl;
+        if (target_rate > 0)
+            std::cout << " open_loop target_rate " << target_rate << " rate_steps " << rate_steps << std::endl;
 
         uint64_t total_slot_num = 4 * (1ull << init_hashpower);
         std::cout << "total_slot_num " << total_slot_num << std::endl;
@@ -498,6 +1046,7 @@ void show_info_after() {
     std::cout << " set_insert " << set_insert << "\tset_assign " << set_assign << std::endl;
     std::cout << " update_success " << update_success << "\tupdate_failure " << update_failure << std::endl;
     std::cout << " erase_success " << erase_success << "\terase_failure " << erase_failure << std::endl;
+    std::cout << " scan_success " << scan_success << "\tscan_failure " << scan_failure << std::endl;
 
 
 
@@ -509,7 +1058,49 @@ void show_info_after() {
                                         <<key_position[1] << " : "
                                         <<key_position[2] << " : "
                                         <<key_position[3] <<std::endl;
-    std::cout<< "occupancy "<< item_num * 1.0 / store.slot_num() <<std::endl;
+    std::cout<< "occupancy "<< item_num * 1.0 / store.slot_num() << " hashpower " << store.hashpower() <<std::endl;
+
+    std::cout << "reclaim: retired " << num_retire << " reclaimed " << num_reclaim
+              << " limbo_backlog " << store.get_limbo_size() << " limbo_peak_per_thread " << limbo_peak << std::endl;
+    std::cout << "alloc: items " << num_item_alloc << " malloc " << num_new_item_malloc
+              << " reused " << num_item_alloc - num_new_item_malloc << std::endl;
+
+    //workload f only reads and increments: every value started as its key
+    if (rmw && workload == 'f') {
+        uint64_t increments = 0;
+        new_cuckoohash_map::ScanIterator it(store);
+        char *key, *value;
+        size_t key_len, value_len;
+        while (it.next(key, key_len, value, value_len)) increments += *(uint64_t *) value - *(uint64_t *) key;
+        std::cout << "rmw: in place increments " << increments << std::endl;
+        ASSERT(increments == update_success, "in place increments lost");
+    }
+
+    if (scan_workers > 0) {
+        std::cout << "scan: passes " << scan_passes << " avg_items " << (scan_passes ? scan_items / scan_passes : 0)
+                  << " avg_time(us) " << (scan_passes ? scan_time / scan_passes : 0) << " missing " << scan_missing
+                  << " duplicated " << scan_duplicated << std::endl;
+        ASSERT(scan_missing == 0 && scan_duplicated == 0, "scan lost or repeated a stable key");
+
+        size_t exported = 0;
+        {
+            new_cuckoohash_map::ScanIterator it(store);
+            char *key, *value;
+            size_t key_len, value_len;
+            while (it.next(key, key_len, value, value_len)) exported++;
+        }
+        ASSERT(exported == item_num, "quiescent scan count != item_num");
+    }
+
+    if (perf && !perf_opened) std::cout << "perf: perf_event_open not available" << std::endl;
+    if (perf_opened) {
+        uint64_t phase_ops[PERF_PHASE_NUM] = {YCSB ? ycsb_loads.size() : load_count, op_num, perf_rehash_items};
+        if (perf_sw_only) std::cout << "perf: no hardware counters, only task-clock" << std::endl;
+        for (int p = 0; p < PERF_PHASE_NUM; p++) {
+            std::cout << "perf " << perf_phase_str[p] << " ops " << phase_ops[p] << " per op: "
+                      << perf_per_op_str(perf_phase[p], phase_ops[p], perf_sw_only, perf_has) << std::endl;
+        }
+    }
 
     std::cout << endl << " op_num " << op_num << std::endl;
 
@@ -523,13 +1114,38 @@ void show_info_after() {
     double throughput = op_num * 1.0 / runtime;
     std::cout << "***throughput " << throughput << std::endl;
 
+    uint64_t evictions = store.get_evict_num();
+    uint64_t expired = 0;
+#ifdef ITEM_TTL
+    expired = store.get_ttl_lazy_num() + store.get_ttl_sweep_num();
+    std::cout << "ttl: " << item_ttl << " ms expired_lazy " << store.get_ttl_lazy_num() << " expired_swept "
+              << store.get_ttl_sweep_num() << " sweep_passes " << store.get_ttl_sweep_passes() << std::endl;
+#endif
+    //against the slot fingerprints: partial_false_matches are slots whose 8 bit partial matched
+    //another key, each one a key compare through the item pointer
+    std::cout << "filter: " << (neg_filter ? "on" : "off") << " bytes " << store.get_filter_bytes()
+              << " negatives " << filter_negative << " false_positives " << filter_false_positive
+              << " fp_rate " << filter_false_positive * 1.0 / std::max<size_t>(filter_negative + filter_false_positive, 1)
+              << " partial_false_matches " << partial_false_match << " per_find "
+              << partial_false_match * 1.0 / std::max<size_t>(find_success + find_failure, 1) << std::endl;
+    if (cache_hashpower) {
+        uint64_t run_evictions = evictions - cache_evict_load;
+        std::cout << "cache: hit_ratio " << find_success * 1.0 / std::max<size_t>(find_success + find_failure, 1)
+                  << " fills " << cache_fill << " evictions " << run_evictions << " (load " << cache_evict_load
+                  << ") evict_rate(Mops) " << run_evictions * 1.0 / runtime << " evict_per_op "
+                  << run_evictions * 1.0 / std::max<uint64_t>(op_num, 1) << std::endl;
+    }
+
 
     ASSERT(op_num == find_success + find_failure
                      + set_insert + set_assign
                      + erase_success + erase_failure
-                     + insert_success + insert_failure - total_count, "op_num not correct");
+                     + scan_success + scan_failure
+                     + update_success + update_failure
+                     + insert_success + insert_failure - load_count, "op_num not correct");
 
-    ASSERT(insert_success + set_insert - erase_success == item_num, "item != inert - erase");
+    ASSERT(insert_success + set_insert + cache_fill - erase_success - evictions - expired == item_num,
+           "item != inert - erase");
 
 
 }
@@ -0,0 +1,211 @@
+#ifndef RESEARCH_WORKLOAD_H
+#define RESEARCH_WORKLOAD_H
+
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+#include "assert_msg.h"
+
+//xorshift64*: one per generating thread, no shared state and no lock unlike rand()
+class xorshift64 {
+public:
+    explicit xorshift64(uint64_t seed) : s(seed ? seed : 0x9e3779b97f4a7c15ull) {}
+
+    inline uint64_t next() {
+        s ^= s >> 12;
+        s ^= s << 25;
+        s ^= s >> 27;
+        return s * 0x2545f4914f6cdd1dull;
+    }
+
+    //uniform in [0,1)
+    inline double next_double() { return (next() >> 11) * (1.0 / 9007199254740992.0); }
+
+    //uniform in [0,n)
+    inline uint64_t next(uint64_t n) { return next() % n; }
+
+private:
+    uint64_t s;
+};
+
+static inline uint64_t fnv_hash64(uint64_t v) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (int i = 0; i < 8; i++) {
+        h ^= v & 0xff;
+        h *= 0x100000001b3ull;
+        v >>= 8;
+    }
+    return h;
+}
+
+enum Key_distribution {
+    Uniform = 0,
+    Zipfian = 1,
+    ScrambledZipfian = 2, // zipf rank hashed over the key space, hot keys are scattered
+    Hotspot = 3,          // hot_ops of the requests go to the first hot_set of the key space
+    Latest = 4            // zipf over recency, the newest keys are the hottest
+};
+
+static const char *key_distribution_str[5] = {"unif", "zipf", "scrambled_zipf", "hotspot", "latest"};
+
+/** Zipf ranks in [0, n), rank 0 being the hottest.
+ *
+ * "Quickly generating billion-record synthetic databases", Jim Gray et al.
+ * SIGMOD 1994, the same constant time sampler YCSB uses. zeta(n) is computed
+ * once, next() is stateless so one instance is shared by all generating threads.
+ */
+class zipfian_generator {
+public:
+    zipfian_generator(uint64_t n, double theta) : n(n), theta(theta) {
+        ASSERT(theta > 0 && theta < 1, "zipfian theta must be in (0,1)");
+        zetan = zeta(n, theta);
+        double zeta2 = zeta(2, theta);
+        alpha = 1.0 / (1.0 - theta);
+        eta = (1 - std::pow(2.0 / n, 1 - theta)) / (1 - zeta2 / zetan);
+        half_pow_theta = 1.0 + std::pow(0.5, theta);
+    }
+
+    inline uint64_t next(xorshift64 &rng) const {
+        double u = rng.next_double();
+        double uz = u * zetan;
+        if (uz < 1.0) return 0;
+        if (uz < half_pow_theta) return 1;
+        uint64_t rank = (uint64_t) (n * std::pow(eta * u - eta + 1, alpha));
+        return rank < n ? rank : n - 1;
+    }
+
+private:
+    static double zeta(uint64_t n, double theta) {
+        double sum = 0;
+        for (uint64_t i = 1; i <= n; i++) sum += 1.0 / std::pow((double) i, theta);
+        return sum;
+    }
+
+    uint64_t n;
+    double theta;
+    double zetan, alpha, eta, half_pow_theta;
+};
+
+enum Workload_op {
+    W_Read = 0,
+    W_Update,
+    W_Insert,
+    W_Scan,
+    W_ReadModifyWrite,
+    W_Erase
+};
+
+//Operation mix in percent. YCSB defines a-c,e,f over zipfian keys and d over
+//latest, the key distribution itself is chosen separately.
+struct Workload_mix {
+    char name;
+    int read, update, insert, scan, rmw, erase;
+
+    //find / insert_or_assign / erase in equal parts, the old Rand mode of table_test
+    static Workload_mix rand_mix() { return Workload_mix{'r', 34, 33, 0, 0, 0, 33}; }
+
+    //YCSB core workloads A-F
+    static Workload_mix ycsb(char w) {
+        switch (w) {
+            case 'a': return Workload_mix{'a', 50, 50, 0, 0, 0, 0};
+            case 'b': return Workload_mix{'b', 95, 5, 0, 0, 0, 0};
+            case 'c': return Workload_mix{'c', 100, 0, 0, 0, 0, 0};
+            case 'd': return Workload_mix{'d', 95, 0, 5, 0, 0, 0};
+            case 'e': return Workload_mix{'e', 0, 0, 5, 95, 0, 0};
+            case 'f': return Workload_mix{'f', 50, 0, 0, 0, 50, 0};
+            default:
+                ASSERT(false, "ycsb workload must be one of a-f");
+        }
+        return Workload_mix{0, 100, 0, 0, 0, 0, 0};
+    }
+
+    inline Workload_op pick(xorshift64 &rng) const {
+        int r = (int) rng.next(100);
+        if ((r -= read) < 0) return W_Read;
+        if ((r -= update) < 0) return W_Update;
+        if ((r -= insert) < 0) return W_Insert;
+        if ((r -= scan) < 0) return W_Scan;
+        if ((r -= rmw) < 0) return W_ReadModifyWrite;
+        return W_Erase;
+    }
+};
+
+//Pregenerates key (and optionally op) streams so nothing random is left in the
+//measured loop. The stream is cut into thread_num contiguous parts, the same
+//way the workers in table_test split it, and each part is produced by its own
+//thread with its own xorshift64.
+class WorkloadGenerator {
+public:
+    WorkloadGenerator(uint64_t record_count, Key_distribution dist, double theta,
+                      double hot_set = 0.2, double hot_ops = 0.8)
+            : record_count(record_count), dist(dist), hot_set(hot_set), hot_ops(hot_ops), zipf(nullptr) {
+        if (dist == Zipfian || dist == ScrambledZipfian || dist == Latest)
+            zipf = new zipfian_generator(record_count, theta);
+        hot_count = (uint64_t) (record_count * hot_set);
+        if (hot_count == 0) hot_count = 1;
+        if (hot_count > record_count) hot_count = record_count;
+    }
+
+    ~WorkloadGenerator() { delete zipf; }
+
+    //newest: number of keys that exist so far (only used by Latest)
+    inline uint64_t next_key(xorshift64 &rng, uint64_t newest) const {
+        switch (dist) {
+            case Uniform:
+                return rng.next(record_count);
+            case Zipfian:
+                return zipf->next(rng);
+            case ScrambledZipfian:
+                return fnv_hash64(zipf->next(rng)) % record_count;
+            case Hotspot:
+                if (hot_count == record_count || rng.next_double() < hot_ops) return rng.next(hot_count);
+                return hot_count + rng.next(record_count - hot_count);
+            case Latest: {
+                uint64_t rank = zipf->next(rng);
+                return newest - 1 - rank % newest;
+            }
+            default:
+                ASSERT(false, "key distribution not defined");
+        }
+        return 0;
+    }
+
+    //Fill keys[0,count) (and ops, if given) with thread_num generator threads.
+    //Inserted keys start at record_count and are interleaved by thread id, so
+    //threads never insert the same key.
+    void generate(uint64_t *keys, Workload_op *ops, const Workload_mix *mix, size_t count, int thread_num,
+                  uint64_t seed) const {
+        std::vector<std::thread> threads;
+        for (int t = 0; t < thread_num; t++) {
+            threads.emplace_back([=]() {
+                size_t step = count / thread_num;
+                size_t num = t == thread_num - 1 ? step + count % thread_num : step;
+                size_t base = t * step;
+                xorshift64 rng(seed * 0x9e3779b97f4a7c15ull + t + 1);
+                uint64_t inserted = 0;
+                for (size_t i = base; i < base + num; i++) {
+                    Workload_op op = mix ? mix->pick(rng) : W_Read;
+                    if (op == W_Insert) {
+                        keys[i] = record_count + inserted * thread_num + t;
+                        inserted++;
+                    } else {
+                        keys[i] = next_key(rng, record_count + inserted * thread_num);
+                    }
+                    if (ops) ops[i] = op;
+                }
+            });
+        }
+        for (auto &th : threads) th.join();
+    }
+
+private:
+    uint64_t record_count;
+    Key_distribution dist;
+    double hot_set, hot_ops;
+    uint64_t hot_count;
+    zipfian_generator *zipf;
+};
+
+#endif //RESEARCH_WORKLOAD_H
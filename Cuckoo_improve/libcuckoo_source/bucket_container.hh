@@ -196,6 +196,12 @@ public:
   bucket &operator[](size_type i) { return buckets_[i]; }
   const bucket &operator[](size_type i) const { return buckets_[i]; }
 
+  // The bucket array itself, or nullptr once it has been deallocated or
+  // moved out.
+  const bucket *data() const noexcept {
+    return buckets_ == nullptr ? nullptr : std::addressof(*buckets_);
+  }
+
   // Constructs live data in a bucket
   template <typename K, typename... Args>
   void setKV(size_type ind, size_type slot, partial_t p, K &&k,
@@ -0,0 +1,158 @@
+/** \file */
+
+#ifndef _CUCKOOHASH_LOCKS_HH
+#define _CUCKOOHASH_LOCKS_HH
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// rwlocks.h has no include guard, this header is its only include site here
+#include "../../Concurrent_componet/RWlock/rwlocks.h"
+#include "../../Concurrent_componet/RWlock/spin_wait.h"
+
+namespace libcuckoo {
+
+// Bucket lock policies for cuckoohash_map. A policy provides a @c lock_type
+// with lock/unlock/try_lock for writers, lock_shared/unlock_shared for
+// readers, and a seqlock-style version() that is odd while a writer holds the
+// lock. It also says whether find_fn should take shared locks and how many
+// optimistic, lock-free reads find_fn tries by default.
+
+// Base of the exclusive locks: keeps the version. Only the holder writes it,
+// so plain stores are enough.
+class versioned_lock_base {
+public:
+  versioned_lock_base() noexcept : version_(0) {}
+  versioned_lock_base(const versioned_lock_base &) noexcept : version_(0) {}
+
+  size_t version() const noexcept {
+    return version_.load(std::memory_order_acquire);
+  }
+
+protected:
+  void begin_write() noexcept {
+    version_.store(version_.load(std::memory_order_relaxed) + 1,
+                   std::memory_order_relaxed);
+    // writes to the buckets must not become visible before the odd version
+    std::atomic_thread_fence(std::memory_order_release);
+  }
+
+  void end_write() noexcept {
+    version_.store(version_.load(std::memory_order_relaxed) + 1,
+                   std::memory_order_release);
+  }
+
+private:
+  std::atomic<size_t> version_;
+};
+
+//! Exclusive test-and-test-and-set spinlock, readers lock like writers. The
+//! stock libcuckoo behaviour, except that waiters back off and eventually park
+//! (see spin_wait.h) instead of spinning on the exchange.
+struct spin_lock_policy {
+  class lock_type : public versioned_lock_base {
+  public:
+    lock_type() noexcept : lock_(0) {}
+    lock_type(const lock_type &other) noexcept
+        : versioned_lock_base(other), lock_(0) {}
+
+    void lock() noexcept {
+      if (lock_.exchange(1, std::memory_order_acquire)) {
+        lock_slow();
+      }
+      begin_write();
+    }
+
+    void unlock() noexcept {
+      end_write();
+      // an exchange rather than a store, spin_wake needs the release ordered
+      // before its look at the parked count
+      lock_.exchange(0, std::memory_order_seq_cst);
+      spin_wake(&lock_);
+    }
+
+    bool try_lock() noexcept {
+      if (lock_.load(std::memory_order_relaxed) ||
+          lock_.exchange(1, std::memory_order_acquire)) {
+        return false;
+      }
+      begin_write();
+      return true;
+    }
+
+    void lock_shared() noexcept { lock(); }
+    void unlock_shared() noexcept { unlock(); }
+
+  private:
+    void lock_slow() noexcept {
+      SpinWait w;
+      auto unlocked = [this] {
+        return !lock_.load(std::memory_order_relaxed);
+      };
+      do {
+        while (!unlocked()) {
+          w.wait(unlocked, &lock_);
+        }
+      } while (lock_.exchange(1, std::memory_order_acquire));
+    }
+
+    std::atomic<uint32_t> lock_;
+  };
+
+  static constexpr bool shared_reads = false;
+  static constexpr size_t default_optimistic_retries = 0;
+};
+
+//! Reader-writer lock from Concurrent_componet/RWlock: finds take the two
+//! bucket locks shared, so readers of the same hot bucket run in parallel.
+struct rw_lock_policy {
+  class lock_type : public versioned_lock_base {
+  public:
+    lock_type() noexcept {}
+    lock_type(const lock_type &other) noexcept : versioned_lock_base(other) {}
+
+    void lock() noexcept {
+      rw_.wLock();
+      begin_write();
+    }
+
+    void unlock() noexcept {
+      end_write();
+      rw_.wUnlock();
+    }
+
+    bool try_lock() noexcept {
+      if (!rw_.try_write_lock()) {
+        return false;
+      }
+      begin_write();
+      return true;
+    }
+
+    void lock_shared() noexcept { rw_.rLock(); }
+    void unlock_shared() noexcept { rw_.rUnlock(); }
+
+  private:
+    ::Lock rw_;
+  };
+
+  static constexpr bool shared_reads = true;
+  static constexpr size_t default_optimistic_retries = 0;
+};
+
+//! Exclusive spinlock for writers. Finds can read without locking and
+//! validate the versions, falling back to the lock after a few failed
+//! attempts, but only once a caller turns that on with
+//! cuckoohash_map::optimistic_read_retries; out of the box it behaves like
+//! spin_lock_policy.
+struct optimistic_lock_policy {
+  using lock_type = spin_lock_policy::lock_type;
+
+  static constexpr bool shared_reads = false;
+  static constexpr size_t default_optimistic_retries = 0;
+};
+
+}  // namespace libcuckoo
+
+#endif // _CUCKOOHASH_LOCKS_HH
@@ -10,6 +10,7 @@
 #include <cassert>
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <functional>
 #include <iostream>
 #include <iterator>
@@ -26,6 +27,7 @@
 
 #include "cuckoohash_config.hh"
 #include "cuckoohash_util.hh"
+#include "cuckoohash_locks.hh"
 #include "bucket_container.hh"
 
 namespace libcuckoo {
@@ -41,11 +43,14 @@ namespace libcuckoo {
  * because the table relies on types that are over-aligned to optimize
  * concurrent cache usage.
  * @tparam SLOT_PER_BUCKET number of slots for each bucket in the table
+ * @tparam LockPolicy bucket lock policy, one of @ref spin_lock_policy, @ref
+ * rw_lock_policy or @ref optimistic_lock_policy
  */
 template <class Key, class T, class Hash = std::hash<Key>,
           class KeyEqual = std::equal_to<Key>,
           class Allocator = std::allocator<std::pair<const Key, T>>,
-          std::size_t SLOT_PER_BUCKET = DEFAULT_SLOT_PER_BUCKET>
+          std::size_t SLOT_PER_BUCKET = DEFAULT_SLOT_PER_BUCKET,
+          class LockPolicy = spin_lock_policy>
 class cuckoohash_map {
 private:
   // Type of the partial key
@@ -108,10 +113,13 @@ public:
         buckets_(reserve_calc(n), alloc),
         old_buckets_(0, alloc),
         all_locks_(get_allocator()),
+        retired_buckets_(get_allocator()),
+        buckets_seq_(0),
         num_remaining_lazy_rehash_locks_(0),
         minimum_load_factor_(DEFAULT_MINIMUM_LOAD_FACTOR),
         maximum_hashpower_(NO_MAXIMUM_HASHPOWER),
-        max_num_worker_threads_(0) {
+        max_num_worker_threads_(0),
+        optimistic_read_retries_(LockPolicy::default_optimistic_retries) {
     all_locks_.emplace_back(std::min(bucket_count(), size_type(kMaxNumLocks)),
                             spinlock(), get_allocator());
   }
@@ -159,11 +167,14 @@ public:
         buckets_(other.buckets_, alloc),
         old_buckets_(other.old_buckets_, alloc),
         all_locks_(alloc),
+        retired_buckets_(alloc),
+        buckets_seq_(0),
         num_remaining_lazy_rehash_locks_(
             other.num_remaining_lazy_rehash_locks_),
         minimum_load_factor_(other.minimum_load_factor_),
         maximum_hashpower_(other.maximum_hashpower_),
-        max_num_worker_threads_(other.max_num_worker_threads_) {
+        max_num_worker_threads_(other.max_num_worker_threads_),
+        optimistic_read_retries_(other.optimistic_read_retries_) {
     if (other.get_allocator() == alloc) {
       all_locks_ = other.all_locks_;
     } else {
@@ -191,11 +202,14 @@ public:
         buckets_(std::move(other.buckets_), alloc),
         old_buckets_(std::move(other.old_buckets_), alloc),
         all_locks_(alloc),
+        retired_buckets_(alloc),
+        buckets_seq_(0),
         num_remaining_lazy_rehash_locks_(
             other.num_remaining_lazy_rehash_locks_),
         minimum_load_factor_(other.minimum_load_factor_),
         maximum_hashpower_(other.maximum_hashpower_),
-        max_num_worker_threads_(other.max_num_worker_threads_) {
+        max_num_worker_threads_(other.max_num_worker_threads_),
+        optimistic_read_retries_(other.optimistic_read_retries_) {
     if (other.get_allocator() == alloc) {
       all_locks_ = std::move(other.all_locks_);
     } else {
@@ -441,6 +455,33 @@ public:
     return max_num_worker_threads_.load(std::memory_order_acquire);
   }
 
+  /**
+   * Sets how many times @ref find_fn tries to read without taking the bucket
+   * locks before it falls back to locking. Each spinlock carries a version
+   * that is odd while the lock is held; an optimistic read snapshots the
+   * versions of both bucket locks, copies the value out, and succeeds only if
+   * neither version moved. 0 always locks; the default comes from the lock
+   * policy.
+   *
+   * Only used when both key and mapped types are trivially copyable, since a
+   * read racing with a writer may see a torn copy before it is thrown away.
+   * Such a table keeps the bucket arrays a resize replaces until it is
+   * destroyed, so a reader that is still searching one never touches freed
+   * memory; the retired arrays cost at most as much as the current one.
+   *
+   * @param retries the number of optimistic attempts per lookup
+   */
+  void optimistic_read_retries(size_type retries) {
+    optimistic_read_retries_.store(retries, std::memory_order_release);
+  }
+
+  /**
+   * Returns the number of optimistic attempts per lookup.
+   */
+  size_type optimistic_read_retries() const {
+    return optimistic_read_retries_.load(std::memory_order_acquire);
+  }
+
   /**@}*/
 
   /** @name Table Operations
@@ -464,6 +505,18 @@ public:
    */
   template <typename K, typename F> bool find_fn(const K &key, F fn) const {
     const hash_value hv = hashed_key(key);
+    for (size_type tries = optimistic_read_retries(); tries > 0; --tries) {
+      int found = optimistic_find(key, hv, fn, is_optimistic_readable());
+      if (found != -1) {
+        return found == 1;
+      }
+    }
+    if (LockPolicy::shared_reads) {
+      int found = shared_find(key, hv, fn);
+      if (found != -1) {
+        return found == 1;
+      }
+    }
     const auto b = snapshot_and_lock_two<normal_mode>(hv);
     const table_position pos = cuckoo_find(key, hv.partial, b.i1, b.i2);
     if (pos.status == ok) {
@@ -785,7 +838,7 @@ private:
   // Counter type
   using counter_type = int64_t;
 
-  // A fast, lightweight spinlock
+  // The bucket lock: the policy's lock_type plus per-lock metadata
   //
   // Per-spinlock, we also maintain some metadata about the contents of the
   // table. Storing data per-spinlock avoids false sharing issues when multiple
@@ -800,16 +853,17 @@ private:
   // Instead, we'll mark all of the locks as not migrated. So anybody trying to
   // acquire the lock must also migrate the corresponding buckets if
   // !is_migrated.
+  //
+  // The lock_type also keeps a seqlock-style version, odd while a writer
+  // holds the lock, for optimistic reads.
   LIBCUCKOO_SQUELCH_PADDING_WARNING
-  class LIBCUCKOO_ALIGNAS(64) spinlock {
+  class LIBCUCKOO_ALIGNAS(64) spinlock : public LockPolicy::lock_type {
   public:
-    spinlock() : elem_counter_(0), is_migrated_(true) { lock_.clear(); }
+    spinlock() : elem_counter_(0), is_migrated_(true) {}
 
     spinlock(const spinlock &other) noexcept
-        : elem_counter_(other.elem_counter()),
-          is_migrated_(other.is_migrated()) {
-      lock_.clear();
-    }
+        : LockPolicy::lock_type(other), elem_counter_(other.elem_counter()),
+          is_migrated_(other.is_migrated()) {}
 
     spinlock &operator=(const spinlock &other) noexcept {
       elem_counter() = other.elem_counter();
@@ -817,17 +871,6 @@ private:
       return *this;
     }
 
-    void lock() noexcept {
-      while (lock_.test_and_set(std::memory_order_acq_rel))
-        ;
-    }
-
-    void unlock() noexcept { lock_.clear(std::memory_order_release); }
-
-    bool try_lock() noexcept {
-      return !lock_.test_and_set(std::memory_order_acq_rel);
-    }
-
     counter_type &elem_counter() noexcept { return elem_counter_; }
     counter_type elem_counter() const noexcept { return elem_counter_; }
 
@@ -835,7 +878,6 @@ private:
     bool is_migrated() const noexcept { return is_migrated_; }
 
   private:
-    std::atomic_flag lock_;
     counter_type elem_counter_;
     bool is_migrated_;
   };
@@ -846,6 +888,7 @@ private:
 
   using locks_t = std::vector<spinlock, rebind_alloc<spinlock>>;
   using all_locks_t = std::list<locks_t, rebind_alloc<locks_t>>;
+  using all_buckets_t = std::list<buckets_t, rebind_alloc<buckets_t>>;
 
   // Classes for managing locked buckets. By storing and moving around sets of
   // locked buckets in these classes, we can ensure that they are unlocked
@@ -1064,6 +1107,115 @@ private:
     }
   }
 
+  // Optimistic reads are only attempted when a torn copy of a key or value is
+  // harmless to look at and throw away.
+  using is_optimistic_readable = std::integral_constant<
+      bool, std::is_trivially_copyable<key_type>::value &&
+                std::is_trivially_copyable<mapped_type>::value>;
+
+  // optimistic_find looks up the key without taking any locks. It picks up
+  // the hashpower and bucket array together (buckets_seq_ must not move
+  // between them), snapshots the versions of both bucket locks, searches that
+  // array and copies the value out, then checks that the versions and
+  // buckets_seq_ are unchanged. The array is never indexed past its own
+  // hashpower, and retire_buckets keeps it allocated if a resize replaces it
+  // meanwhile. fn only ever sees a validated copy. Returns 1 if found, 0 if
+  // not found, and -1 if a writer got in the way and the caller should retry
+  // or lock.
+  template <typename K, typename F>
+  int optimistic_find(const K &, const hash_value &, F &,
+                      std::false_type) const {
+    return -1;
+  }
+
+  template <typename K, typename F>
+  int optimistic_find(const K &key, const hash_value &hv, F &fn,
+                      std::true_type) const {
+    const size_type seq = buckets_seq_.load(std::memory_order_acquire);
+    if (seq & 1) {
+      return -1;
+    }
+    const size_type hp = hashpower();
+    const bucket *const arr = buckets_.data();
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (buckets_seq_.load(std::memory_order_relaxed) != seq) {
+      return -1;
+    }
+    const size_type i1 = index_hash(hp, hv.hash);
+    const size_type i2 = alt_index(hp, hv.partial, i1);
+    locks_t &locks = get_current_locks();
+    const spinlock &l1 = locks[lock_ind(i1)];
+    const spinlock &l2 = locks[lock_ind(i2)];
+    const size_type v1 = l1.version();
+    const size_type v2 = l2.version();
+    // a held lock, or buckets still waiting for a lazy rehash, need the slow
+    // path
+    if ((v1 & 1) || (v2 & 1) || !l1.is_migrated() || !l2.is_migrated()) {
+      return -1;
+    }
+    typename std::aligned_storage<sizeof(mapped_type),
+                                  alignof(mapped_type)>::type copy;
+    size_type ind = i1;
+    int slot = try_read_from_bucket(arr[i1], hv.partial, key);
+    if (slot == -1) {
+      ind = i2;
+      slot = try_read_from_bucket(arr[i2], hv.partial, key);
+    }
+    if (slot != -1) {
+      std::memcpy(&copy, &arr[ind].mapped(slot), sizeof(mapped_type));
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (l1.version() != v1 || l2.version() != v2 ||
+        buckets_seq_.load(std::memory_order_relaxed) != seq) {
+      return -1;
+    }
+    if (slot == -1) {
+      return 0;
+    }
+    fn(*reinterpret_cast<const mapped_type *>(&copy));
+    return 1;
+  }
+
+  // shared_find takes the two bucket locks shared, in index order like
+  // lock_two. Shared holders may not rehash, so buckets still waiting for a
+  // lazy rehash return -1 and the caller takes the exclusive path. Returns 1
+  // if found, 0 if not found.
+  template <typename K, typename F>
+  int shared_find(const K &key, const hash_value &hv, F &fn) const {
+    while (true) {
+      const size_type hp = hashpower();
+      const size_type i1 = index_hash(hp, hv.hash);
+      const size_type i2 = alt_index(hp, hv.partial, i1);
+      size_type l1 = lock_ind(i1);
+      size_type l2 = lock_ind(i2);
+      if (l2 < l1) {
+        std::swap(l1, l2);
+      }
+      locks_t &locks = get_current_locks();
+      locks[l1].lock_shared();
+      if (hashpower() != hp) {
+        locks[l1].unlock_shared();
+        continue;
+      }
+      if (l2 != l1) {
+        locks[l2].lock_shared();
+      }
+      int found = -1;
+      if (locks[l1].is_migrated() && locks[l2].is_migrated()) {
+        const table_position pos = cuckoo_find(key, hv.partial, i1, i2);
+        found = pos.status == ok;
+        if (found) {
+          fn(buckets_[pos.index].mapped(pos.slot));
+        }
+      }
+      if (l2 != l1) {
+        locks[l2].unlock_shared();
+      }
+      locks[l1].unlock_shared();
+      return found;
+    }
+  }
+
   // lock_all takes all the locks, and returns a deleter object that releases
   // the locks upon destruction. It does NOT perform any hashpower checks, or
   // rehash any un-migrated buckets.
@@ -1697,11 +1849,14 @@ private:
     maybe_resize_locks(size_type(1) << new_hp);
     locks_t &current_locks = get_current_locks();
 
-    // Move the current buckets into old_buckets_, and create a new empty
-    // buckets container, which will become the new current one. The
-    // old_buckets_ data will be destroyed when move-assigning to buckets_.
+    // Move the current buckets into old_buckets_, and swap in a new empty
+    // buckets container, which becomes the new current one. old_buckets_ was
+    // emptied above, so new_buckets ends up holding nothing.
+    buckets_t new_buckets(new_hp, get_allocator());
+    begin_buckets_change();
     old_buckets_.swap(buckets_);
-    buckets_ = buckets_t(new_hp, get_allocator());
+    buckets_.swap(new_buckets);
+    end_buckets_change();
 
     // If we have less than kMaxNumLocks buckets, we do a full rehash in the
     // current thread. On-demand rehashing wouldn't be very easy with less than
@@ -1882,11 +2037,14 @@ private:
     new_map.rehash_with_workers();
 
     // Swap the buckets_ container with new_map's. This is okay, because we
-    // have all the locks, so nobody else should be reading from the buckets
-    // array. Then the old buckets will be deleted when new_map is deleted.
+    // have all the locks, so only optimistic readers can still be looking at
+    // the old buckets array, and retire_buckets keeps it around for them.
     maybe_resize_locks(new_map.bucket_count());
+    begin_buckets_change();
     buckets_.swap(new_map.buckets_);
-    
+    end_buckets_change();
+    retire_buckets(new_map.buckets_);
+
     return ok;
   }
 
@@ -2017,8 +2175,36 @@ private:
 
   locks_t &get_current_locks() const { return all_locks_.back(); }
 
+  // Bucket arrays are only replaced with all the locks taken, but
+  // optimistic_find reads buckets_ without any. buckets_seq_ is odd while
+  // buckets_ is being replaced, so a reader can tell whether the hashpower and
+  // array it picked up belong together.
+  void begin_buckets_change() {
+    buckets_seq_.store(buckets_seq_.load(std::memory_order_relaxed) + 1,
+                       std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+  }
+
+  void end_buckets_change() {
+    buckets_seq_.store(buckets_seq_.load(std::memory_order_relaxed) + 1,
+                       std::memory_order_release);
+  }
+
+  // retire_buckets destroys the elements left in b and takes its array. When
+  // optimistic reads are possible the memory is kept in retired_buckets_ until
+  // the map is destroyed, since a reader may still be searching it; otherwise
+  // it is freed right away.
+  void retire_buckets(buckets_t &b) const {
+    if (!is_optimistic_readable::value || b.data() == nullptr) {
+      b.clear_and_deallocate();
+      return;
+    }
+    b.clear();
+    retired_buckets_.emplace_back(std::move(b));
+  }
+
   // Get/set/decrement num remaining lazy rehash locks. If we reach 0 remaining
-  // lazy locks, we can deallocate the memory in old_buckets_.
+  // lazy locks, we can retire the memory in old_buckets_.
   size_type num_remaining_lazy_rehash_locks() const {
     return num_remaining_lazy_rehash_locks_.load(
         std::memory_order_acquire);
@@ -2028,7 +2214,7 @@ private:
     num_remaining_lazy_rehash_locks_.store(
         n, std::memory_order_release);
     if (n == 0) {
-      old_buckets_.clear_and_deallocate();
+      retire_buckets(old_buckets_);
     }
   }
 
@@ -2037,7 +2223,7 @@ private:
       1, std::memory_order_acq_rel);
     assert(old_num_remaining >= 1);
     if (old_num_remaining == 1) {
-      old_buckets_.clear_and_deallocate();
+      retire_buckets(old_buckets_);
     }
   }
 
@@ -2077,6 +2263,12 @@ private:
   // mutable so that const methods can access and take locks.
   mutable all_locks_t all_locks_;
 
+  // Bucket arrays replaced by a resize, kept for the same reason as the lock
+  // containers: optimistic_find may still be searching one. Only used when
+  // is_optimistic_readable, and the elements are destroyed before an array
+  // gets here.
+  mutable all_buckets_t retired_buckets_;
+
   // A small wrapper around std::atomic to make it copyable for constructors.
   template <typename AtomicT>
   class CopyableAtomic : public std::atomic<AtomicT> {
@@ -2093,6 +2285,10 @@ private:
     }
   };
 
+  // Bumped before and after every change of the buckets_ array, see
+  // begin_buckets_change.
+  CopyableAtomic<size_type> buckets_seq_;
+
   // We keep track of the number of remaining locks in the latest locks array,
   // that remain to be rehashed. Once this reaches 0, we can free the memory of
   // the old buckets. It should only be accessed or modified when
@@ -2116,6 +2312,9 @@ private:
   // operations.
   CopyableAtomic<size_type> max_num_worker_threads_;
 
+  // Number of lock-free attempts find_fn makes before taking the locks.
+  CopyableAtomic<size_type> optimistic_read_retries_;
+
 public:
   /**
    * An ownership wrapper around a @ref cuckoohash_map table instance. When
@@ -2735,11 +2934,11 @@ public:
  * @param lhs the map on the right side to swap
  */
 template <class Key, class T, class Hash, class KeyEqual, class Allocator,
-          std::size_t SLOT_PER_BUCKET>
-void swap(
-    cuckoohash_map<Key, T, Hash, KeyEqual, Allocator, SLOT_PER_BUCKET> &lhs,
-    cuckoohash_map<Key, T, Hash, KeyEqual, Allocator, SLOT_PER_BUCKET>
-        &rhs) noexcept {
+          std::size_t SLOT_PER_BUCKET, class LockPolicy>
+void swap(cuckoohash_map<Key, T, Hash, KeyEqual, Allocator, SLOT_PER_BUCKET,
+                         LockPolicy> &lhs,
+          cuckoohash_map<Key, T, Hash, KeyEqual, Allocator, SLOT_PER_BUCKET,
+                         LockPolicy> &rhs) noexcept {
   lhs.swap(rhs);
 }
 
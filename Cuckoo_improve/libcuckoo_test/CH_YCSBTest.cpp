@@ -17,8 +17,11 @@
 
 using namespace ycsb;
 
+//every run is repeated once per bucket lock policy, see cuckoohash_locks.hh
 #if WITH_STRING == 1
-typedef libcuckoo::cuckoohash_map<string, string> cmap;
+template<class Policy>
+using policy_map = libcuckoo::cuckoohash_map<string, string, std::hash<string>, std::equal_to<string>,
+        std::allocator<std::pair<const string, string>>, libcuckoo::DEFAULT_SLOT_PER_BUCKET, Policy>;
 #else
 constexpr uint32_t kHashSeed = 7079;
 
@@ -85,10 +88,13 @@ struct str_hash {
     }
 };
 
-typedef libcuckoo::cuckoohash_map<char *, char *, str_hash<char *>, str_equal_to<char *>, std::allocator<std::pair<const char *, char *>>> cmap;
+template<class Policy>
+using policy_map = libcuckoo::cuckoohash_map<char *, char *, str_hash<char *>, str_equal_to<char *>,
+        std::allocator<std::pair<const char *, char *>>, libcuckoo::DEFAULT_SLOT_PER_BUCKET, Policy>;
 #endif
 
-cmap *store;
+template<class Map>
+Map *store;
 
 std::vector<YCSB_request *> loads;
 
@@ -128,14 +134,15 @@ int readPercentage = (totalPercentage - updatePercentage - erasePercentage);
 
 struct target {
     int tid;
-    cmap *store;
 };
 
 pthread_t *workers;
 
 struct target *parms;
 
+template<class Map>
 void simpleInsert() {
+    Map *store = ::store<Map>;
     Tracer tracer;
     tracer.startTime();
     int inserted = 0;
@@ -160,7 +167,9 @@ void simpleInsert() {
     cout << inserted << " " << tracer.getRunTime() << " " << store->size() << endl;
 }
 
+template<class Map>
 void *insertWorker(void *args) {
+    Map *store = ::store<Map>;
     struct target *work = (struct target *) args;
     uint64_t inserted = 0;
     for (int i = work->tid * key_range / thread_number; i < (work->tid + 1) * key_range / thread_number; i++) {
@@ -174,7 +183,9 @@ void *insertWorker(void *args) {
     __sync_fetch_and_add(&exists, inserted);
 }
 
+template<class Map>
 void *measureWorker(void *args) {
+    Map *store = ::store<Map>;
     Tracer tracer;
     tracer.startTime();
     struct target *work = (struct target *) args;
@@ -252,7 +263,6 @@ void prepare() {
     output = new stringstream[thread_number];
     for (int i = 0; i < thread_number; i++) {
         parms[i].tid = i;
-        parms[i].store = store;
     }
 }
 
@@ -263,7 +273,9 @@ void finish() {
     delete[] output;
 }
 
+template<class Map>
 void multiWorkers() {
+    delete[] output;
     output = new stringstream[thread_number];
     Tracer tracer;
     tracer.startTime();
@@ -271,7 +283,7 @@ void multiWorkers() {
     Timer timer;
     timer.start();
     for (int i = 0; i < thread_number; i++) {
-        pthread_create(&workers[i], nullptr, measureWorker, &parms[i]);
+        pthread_create(&workers[i], nullptr, measureWorker<Map>, &parms[i]);
     }
     while (timer.elapsedSeconds() < timer_range) {
         sleep(1);
@@ -285,6 +297,36 @@ void multiWorkers() {
     cout << "Gathering ..." << endl;
 }
 
+//loads the table, runs the measured phase and returns its throughput; retries turns on lock-free finds
+template<class Map>
+double runPolicy(const char *name, size_t retries = 0) {
+    Map *store = new Map(root_capacity);
+    store->optimistic_read_retries(retries);
+    ::store<Map> = store;
+    exists = 0;
+    read_success = modify_success = read_failure = modify_failure = 0;
+    total_time = 0;
+    stopMeasure.store(0);
+    cout << "policy: " << name << endl;
+    cout << "simple" << endl;
+    simpleInsert<Map>();
+    cout << " threads: " << thread_number << " range: " << key_range << " count: " << total_count << " timer: "
+         << timer_range << " skew: " << skew << " u:e:r = " << updatePercentage << ":" << erasePercentage << ":"
+         << readPercentage << " hash size: " << store->bucket_count() << " capacity: " << store->capacity()
+         << " load factor: " << store->load_factor() << " loads: " << store->size() << endl;
+    cout << "multiinsert" << endl;
+    multiWorkers<Map>();
+    double throughput =
+            (double) (read_success + read_failure + modify_success + modify_failure) * thread_number / total_time;
+    cout << "read operations: " << read_success << " read failure: " << read_failure << " modify operations: "
+         << modify_success << " modify failure: " << modify_failure << " throughput: " << throughput
+         << " hash size: " << store->bucket_count() << " capacity: " << store->capacity() << " load factor: "
+         << store->load_factor() << endl;
+    ::store<Map> = nullptr;
+    delete store;
+    return throughput;
+}
+
 int main(int argc, char **argv) {
     if (argc > 7) {
         thread_number = std::atol(argv[1]);
@@ -298,27 +340,32 @@ int main(int argc, char **argv) {
     }
     if (argc > 8)
         root_capacity = std::atoi(argv[8]);
-    store = new cmap(root_capacity);
+    //the YCSB workload: load and run trace files
+    if (argc > 10) {
+        loadpath = argv[9];
+        runpath = argv[10];
+    }
     YCSBLoader loader(loadpath, key_range);
     loads = loader.load();
     key_range = loader.size();
-    prepare();
-    cout << "simple" << endl;
-    simpleInsert();
     YCSBLoader runner(runpath, total_count);
     runs = runner.load();
     total_count = runner.size();
-    cout << " threads: " << thread_number << " range: " << key_range << " count: " << total_count << " timer: "
-         << timer_range << " skew: " << skew << " u:e:r = " << updatePercentage << ":" << erasePercentage << ":"
-         << readPercentage << " hash size: " << store->bucket_count() << " capacity: " << store->capacity()
-         << " load factor: " << store->load_factor() << " loads: " << store->size() << endl;
-    cout << "multiinsert" << endl;
-    multiWorkers();
-    cout << "read operations: " << read_success << " read failure: " << read_failure << " modify operations: "
-         << modify_success << " modify failure: " << modify_failure << " throughput: "
-         << (double) (read_success + read_failure + modify_success + modify_failure) * thread_number / total_time
-         << " hash size: " << store->bucket_count() << " capacity: " << store->capacity() << " load factor: "
-         << store->load_factor() << endl;
+    prepare();
+
+    const char *names[] = {"spin", "rw", "optimistic"};
+    double results[3];
+    results[0] = runPolicy<policy_map<libcuckoo::spin_lock_policy>>(names[0]);
+    results[1] = runPolicy<policy_map<libcuckoo::rw_lock_policy>>(names[1]);
+    results[2] = runPolicy<policy_map<libcuckoo::optimistic_lock_policy>>(names[2], 4);
+
+    int best = 0;
+    cout << "workload: " << runpath << endl;
+    for (int i = 0; i < 3; i++) {
+        cout << names[i] << " throughput: " << results[i] << endl;
+        if (results[i] > results[best]) best = i;
+    }
+    cout << "winner: " << names[best] << endl;
     loads.clear();
     runs.clear();
     finish();